@@ -1,5 +1,5 @@
-mkdir "/Equipment/Fixed Probes/Settings/output"
-cd "/Equipment/Fixed Probes/Settings/output"
+mkdir "/Equipment/Fixed Probes00/Settings/output"
+cd "/Equipment/Fixed Probes00/Settings/output"
 
 create BOOL write_midas
 set write_midas y
@@ -19,10 +19,10 @@ set write_full_waveforms false
 create INT full_waveform_subsampling
 set full_waveform_subsampling 100
 
-mkdir "/Equipment/Fixed Probes/Settings/devices/sis_3302"
-mkdir "/Equipment/Fixed Probes/Settings/devices/sis_3316"
-mkdir "/Equipment/Fixed Probes/Settings/devices/dio_triggers"
-cd "/Equipment/Fixed Probes/Settings/devices"
+mkdir "/Equipment/Fixed Probes00/Settings/devices/sis_3302"
+mkdir "/Equipment/Fixed Probes00/Settings/devices/sis_3316"
+mkdir "/Equipment/Fixed Probes00/Settings/devices/dio_triggers"
+cd "/Equipment/Fixed Probes00/Settings/devices"
 
 ln "/Settings/Hardware/sis_3316/0" "sis_3316/sis_3316_0"
 ln "/Settings/Hardware/sis_3302/0" "sis_3316/sis_3302_0"
@@ -30,30 +30,90 @@ ln "/Settings/Hardware/dio_trigger/0" "dio_triggers/trg_0"
 ln "/Settings/Hardware/dio_trigger/1" "dio_triggers/trg_1"
 ln "/Settings/Hardware/dio_trigger/2" "dio_triggers/trg_2"
 
-mkdir "/Equipment/Fixed Probes/Settings/config"
-cd "/Equipment/Fixed Probes/Settings/config"
+mkdir "/Equipment/Fixed Probes00/Settings/config"
+cd "/Equipment/Fixed Probes00/Settings/config"
 
 ln "/Settings/NMR Sequence/Fixed Probes" mux_sequence
 ln "/Settings/Hardware/mux_connections" mux_connections
 ln "/Settings/Analysis/online_fid_params" fid_analysis
 
-cd "/Equipment/Fixed Probes/Settings"
+cd "/Equipment/Fixed Probes00/Settings"
 
 create INT max_event_time
 set max_event_time 150000
 
-create INT min_event_time
-set max_event_time 50000
+create INT gather_poll_time
+set gather_poll_time 50
 
 create INT mux_switch_time
 set mux_switch_time 10000
 
+create BOOL pipeline_mux_switching
+set pipeline_mux_switching n
+
 create BOOL analyze_fids_online
 set analyze_fids_online y
 
 create BOOL use_fast_fids_class
 set use_fast_fids_class n
 
+create INT fid_analysis_threads
+set fid_analysis_threads 0
+
+create BOOL stream_rounds
+set stream_rounds n
+
+create INT priority_interval
+set priority_interval 0
+
+create INT round_timeout_us
+set round_timeout_us 1000000
+
+create INT round_retries
+set round_retries 2
+
+create INT trigger_retries
+set trigger_retries 5
+
+create BOOL coalesce_triggers
+set coalesce_triggers y
+
+create INT shots_per_round
+set shots_per_round 1
+
+create BOOL plan_sequence
+set plan_sequence false
+
+create INT round_overhead_us
+set round_overhead_us 20000
+
+create INT prune_after
+set prune_after 0
+
+create INT prune_revisit
+set prune_revisit 10
+
+create DOUBLE prune_health_min
+set prune_health_min 10.0
+
+create INT record_fir_taps
+set record_fir_taps 0
+
+create STRING backend
+set backend "vme"
+
+create INT data_queue_size
+set data_queue_size 100
+
+create STRING data_queue_policy
+set data_queue_policy "drop_newest"
+
+create INT run_queue_size
+set run_queue_size 4
+
+create STRING run_queue_policy
+set run_queue_policy "drop_newest"
+
 create BOOL simulation_mode
 set simulation_mode false
 
@@ -63,6 +123,60 @@ set generate_software_triggers false
 create BOOL recrunch_in_fe
 set recrunch_in_fe false
 
+create BOOL batch_recrunch
+set batch_recrunch false
+
+create BOOL direct_bank
+set direct_bank false
+
+mkdir gps_clock
+cd gps_clock
+
+create STRING cmd
+set cmd "/usr/bin/mbgfasttstamp"
+
+create INT period_ms
+set period_ms 1000
+
+create INT window
+set window 16
+
+cd ..
+
+mkdir fid_workers
+cd fid_workers
+
+create STRING job_address
+set job_address ""
+
+create STRING result_address
+set result_address "tcp://*:5582"
+
+create INT deadline_ms
+set deadline_ms 500
+
+cd ..
+
+mkdir shards
+cd shards
+
+create INT num_shards
+set num_shards 1
+
+create STRING trigger_address
+set trigger_address "tcp://127.0.0.1:5571"
+
+create STRING merge_address
+set merge_address "tcp://127.0.0.1:5572"
+
+create INT merge_timeout_ms
+set merge_timeout_ms 5000
+
+create INT max_gps_skew_ms
+set max_gps_skew_ms 500
+
+cd ..
+
 mkdir output
 cd output
 
@@ -0,0 +1,309 @@
+#ifndef FRONTENDS_INCLUDE_EVENT_QUEUE_HH_
+#define FRONTENDS_INCLUDE_EVENT_QUEUE_HH_
+
+/*===========================================================================*\
+
+author: Matthias W. Smith
+email:  mwsmith2@uw.edu
+file:   event_queue.hh
+
+about:  A bounded event queue with an explicit policy for when it is
+        full: block the producer, drop the oldest queued event, or drop
+        the incoming one.  Every push and drop is counted per run, along
+        with the high-water mark, so lost events can be traced to the
+        stage that lost them.  Slots are recycled as in SpscRing, and
+        the hand-off stays lock-free: the mutex is only taken to wait
+        on a full queue under kBlock or an empty one in PopFor, and for
+        every access under kDropOldest, where the producer evicts the
+        consumer's item.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+//--- project includes ------------------------------------------------------//
+#include "spsc_ring.hh"
+
+namespace g2field {
+
+enum class QueuePolicy { kBlock, kDropOldest, kDropNewest };
+
+// Parses "block", "drop_oldest" or "drop_newest", else returns fallback.
+inline QueuePolicy parse_queue_policy(const std::string &name,
+                                      QueuePolicy fallback)
+{
+  if (name == std::string("block")) return QueuePolicy::kBlock;
+  if (name == std::string("drop_oldest")) return QueuePolicy::kDropOldest;
+  if (name == std::string("drop_newest")) return QueuePolicy::kDropNewest;
+
+  return fallback;
+}
+
+inline const char *queue_policy_name(QueuePolicy policy)
+{
+  switch (policy) {
+    case QueuePolicy::kBlock:
+      return "block";
+
+    case QueuePolicy::kDropOldest:
+      return "drop_oldest";
+
+    default:
+      return "drop_newest";
+  }
+}
+
+// Per-run accounting of one queue.
+struct queue_stats_t {
+  uint64_t capacity;
+  uint64_t size;
+  uint64_t enqueued;    // events accepted
+  uint64_t dropped;     // events lost, queued or incoming
+  uint64_t high_water;  // most events queued at once
+  uint64_t blocked;     // pushes that had to wait for space
+  double blocked_us;    // total time producers waited
+};
+
+template <typename T>
+class EventQueue {
+
+ public:
+
+  EventQueue() : policy_(QueuePolicy::kDropNewest), interrupted_(false),
+                 num_waiting_(0), num_popping_(0) {
+    ResetStats();
+  };
+
+  // Allocate the slots.  Call while both sides are idle.
+  void Reset(std::size_t capacity, const T &prototype=T(),
+             QueuePolicy policy=QueuePolicy::kDropNewest) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ring_.Reset(capacity, prototype);
+    policy_ = policy;
+    interrupted_ = false;
+    ResetStats();
+  };
+
+  // Drop all queued items and lift an Interrupt, keeping the slots and
+  // the counters.  Call while the producer is idle.
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ring_.Clear();
+    interrupted_ = false;
+  };
+
+  // Copy prototype into every free slot.
+  void Prime(const T &prototype) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ring_.Prime(prototype);
+  };
+
+  // Swap item in, item receives a recycled slot.  Returns false if the
+  // incoming item was dropped, or under kBlock if the queue was
+  // interrupted while waiting for space.  Lock-free unless the queue is
+  // full or the policy is kDropOldest.
+  bool Push(T &item) {
+
+    if (policy_ == QueuePolicy::kDropOldest) {
+
+      bool pushed;
+
+      // The eviction races the consumer's pop, so both sides lock.
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (ring_.full()) {
+          ring_.Discard();
+          ++dropped_;
+        }
+
+        pushed = ring_.Push(item);
+      }
+
+      return Pushed(pushed);
+    }
+
+    if (ring_.Push(item)) {
+      return Pushed(true);
+
+    } else if (policy_ == QueuePolicy::kDropNewest) {
+
+      ++dropped_;
+      return false;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    bool pushed = false;
+    ++blocked_;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ++num_waiting_;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      not_full_.wait(lock, [this] { return !ring_.full() || interrupted_; });
+      --num_waiting_;
+
+      pushed = ring_.Push(item);
+    }
+
+    blocked_us_ = blocked_us_ + std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - t0).count();
+
+    if (!pushed) ++dropped_;
+    return Pushed(pushed);
+  };
+
+  // Swap the oldest item out into item.  Returns false if empty.
+  bool Pop(T &item) {
+
+    if (policy_ == QueuePolicy::kDropOldest) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return ring_.Pop(item);
+    }
+
+    bool popped = ring_.Pop(item);
+    if (popped) WakeProducer();
+    return popped;
+  };
+
+  // Pop, waiting up to timeout_us for an item.  Returns false if there
+  // was none by then, an Interrupt does not cut the wait short.
+  bool PopFor(T &item, int64_t timeout_us) {
+
+    if (Pop(item)) return true;
+    if (timeout_us <= 0) return false;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ++num_popping_;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      not_empty_.wait_for(lock, std::chrono::microseconds(timeout_us),
+                          [this] { return !ring_.empty(); });
+      --num_popping_;
+    }
+
+    return Pop(item);
+  };
+
+  // Copy the oldest item into item.  Returns false if empty.
+  bool CopyFront(T &item) {
+    std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+    if (policy_ == QueuePolicy::kDropOldest) lock.lock();
+
+    T *front = ring_.Front();
+    if (front == nullptr) return false;
+
+    item = *front;
+    return true;
+  };
+
+  // Remove the oldest item, counted as consumed rather than dropped.
+  void Discard() {
+
+    if (policy_ == QueuePolicy::kDropOldest) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ring_.Discard();
+      return;
+    }
+
+    ring_.Discard();
+    WakeProducer();
+  };
+
+  // Wake a blocked producer, its push fails.  Lifted by Reset or Clear.
+  void Interrupt() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      interrupted_ = true;
+    }
+
+    not_full_.notify_all();
+  };
+
+  // Zero the counters.  Call while the producer is idle.
+  void ResetStats() {
+    enqueued_ = 0;
+    dropped_ = 0;
+    high_water_ = 0;
+    blocked_ = 0;
+    blocked_us_ = 0.0;
+  };
+
+  queue_stats_t GetStats() const {
+    queue_stats_t stats;
+    stats.capacity = ring_.capacity();
+    stats.size = ring_.size();
+    stats.enqueued = enqueued_;
+    stats.dropped = dropped_;
+    stats.high_water = high_water_;
+    stats.blocked = blocked_;
+    stats.blocked_us = blocked_us_;
+    return stats;
+  };
+
+  inline std::size_t size() const { return ring_.size(); };
+  inline bool empty() const { return ring_.empty(); };
+  inline std::size_t capacity() const { return ring_.capacity(); };
+  inline QueuePolicy policy() const { return policy_; };
+
+ private:
+
+  SpscRing<T> ring_;
+  QueuePolicy policy_;
+  bool interrupted_;
+
+  // Only the producer writes the counters, the reads are for reporting.
+  std::atomic<uint64_t> enqueued_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> high_water_;
+  std::atomic<uint64_t> blocked_;
+  std::atomic<double> blocked_us_;
+
+  // Guards interrupted_ and the waits of a blocked producer or consumer,
+  // and under kDropOldest every access to the ring.
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::atomic<int> num_waiting_;
+  std::atomic<int> num_popping_;
+
+  // Counts an accepted item and wakes a waiting consumer, passing the
+  // result through.
+  bool Pushed(bool pushed) {
+    if (!pushed) return false;
+
+    ++enqueued_;
+
+    uint64_t size = ring_.size();
+    if (size > high_water_) high_water_ = size;
+
+    Wake(num_popping_, not_empty_);
+    return true;
+  };
+
+  void WakeProducer() { Wake(num_waiting_, not_full_); };
+
+  // A side blocks only after counting itself under the lock, so one that
+  // is not counted yet will see the change.
+  void Wake(std::atomic<int> &num_blocked, std::condition_variable &cv) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (num_blocked > 0) {
+      { std::lock_guard<std::mutex> lock(mutex_); }
+      cv.notify_one();
+    }
+  };
+};
+
+} // ::g2field
+
+#endif
@@ -31,6 +31,11 @@ about:  Contains helper functions for MIDAS frontends.
 #include <boost/filesystem.hpp>
 #include "midas.h"
 
+// Event IDs added here, on top of those in g2field/core/field_constants.hh.
+#ifndef EVENTID_FIXED_PROBE_ROUNDS
+#define EVENTID_FIXED_PROBE_ROUNDS 32
+#endif
+
 // Load the config from the ODB as json format.
 inline int load_settings(char *frontend, boost::property_tree::ptree& conf)
 {
@@ -122,7 +127,7 @@ inline uint64_t parse_mbg_string_ns(std::string ts="")
 
   // If necessary, grab a timestamp, and push result into stringstream.
   if (ts == "") {
-    ss.str(exec("/usr/bin/mgbfasttstamp"));
+    ss.str(exec("/usr/bin/mbgfasttstamp"));
   } else {
     ss.str(ts);
   }
@@ -0,0 +1,287 @@
+#ifndef FRONTENDS_INCLUDE_GPS_CLOCK_HH_
+#define FRONTENDS_INCLUDE_GPS_CLOCK_HH_
+
+/*===========================================================================*\
+
+author: Matthias W. Smith
+email:  mwsmith2@uw.edu
+file:   gps_clock.hh
+
+about:  A long-lived GPS time service.  A background thread samples the
+        Meinberg reference (mbgfasttstamp) periodically and fits the
+        offset and drift of GPS time against CLOCK_MONOTONIC.  Reading
+        the time is then a monotonic clock read plus the interpolated
+        model, so the acquisition hot paths never fork a process.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+#include <deque>
+#include <cstdint>
+#include <cmath>
+#include <time.h>
+
+//--- project includes ------------------------------------------------------//
+#include "frontend_utils.hh"
+
+namespace g2field {
+
+// Summary of the current clock model.
+struct gps_clock_fit_t {
+  bool locked;           // a good sample arrived within the holdover time
+  uint64_t num_samples;  // good samples taken since Start
+  uint64_t num_failures; // samples with no valid timestamp
+  int window;            // samples in the current fit
+  double offset_ns;      // GPS - monotonic at the last sample
+  double drift_ppm;      // rate of GPS relative to monotonic, minus one
+  double residual_ns;    // rms residual of the fit
+  double sample_us;      // mean wall time of taking one sample
+};
+
+class GpsClock {
+
+ public:
+
+  GpsClock() : running_(false), seq_(0), x_ref_(0), y_ref_(0),
+               a_(0.0), b_(0.0), valid_(false),
+               num_samples_(0), num_failures_(0), last_good_ns_(0),
+               residual_ns_(0.0), sample_us_(0.0) {};
+
+  ~GpsClock() { Stop(); };
+
+  // The clock shared by everything in the process.
+  static GpsClock &Instance() {
+    static GpsClock clock;
+    return clock;
+  };
+
+  // Starts the sampling thread, restarting it if the settings changed.
+  void Start(const std::string &cmd="/usr/bin/mbgfasttstamp",
+             int period_ms=1000, int window=16) {
+
+    if (running_ && (cmd == cmd_) && (period_ms == period_ms_) &&
+        (window == window_)) {
+      return;
+    }
+
+    Stop();
+
+    cmd_ = cmd;
+    period_ms_ = (period_ms > 0) ? period_ms : 1000;
+    window_ = (window > 1) ? window : 2;
+
+    running_ = true;
+    thread_ = std::thread(&GpsClock::SampleLoop, this);
+  };
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      running_ = false;
+    }
+    cv_.notify_all();
+
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  };
+
+  // Monotonic time in nanoseconds.
+  static inline int64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  };
+
+  // GPS time in nanoseconds, zero until the first good sample.
+  inline uint64_t now_gps_ns() const {
+    return to_gps_ns(monotonic_ns());
+  };
+
+  // Maps a monotonic time onto GPS time with the current model.
+  inline uint64_t to_gps_ns(int64_t mono_ns) const {
+    int64_t x_ref, y_ref;
+    double a, b;
+    bool valid;
+    uint32_t s0;
+
+    // Seqlock read, retry if the model changed underneath us.
+    do {
+      s0 = seq_.load(std::memory_order_acquire);
+      x_ref = x_ref_.load(std::memory_order_relaxed);
+      y_ref = y_ref_.load(std::memory_order_relaxed);
+      a = a_.load(std::memory_order_relaxed);
+      b = b_.load(std::memory_order_relaxed);
+      valid = valid_.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((s0 & 1) || (s0 != seq_.load(std::memory_order_relaxed)));
+
+    if (!valid) return 0;
+
+    double dx = (double)(mono_ns - x_ref);
+    return (uint64_t)(mono_ns + y_ref + (int64_t)std::llround(a + b * dx));
+  };
+
+  // Takes one reference sample now and refits.  Returns 0 on success.
+  int Sample() {
+    int64_t t0 = monotonic_ns();
+    std::string out = exec(cmd_.c_str());
+    int64_t t1 = monotonic_ns();
+
+    std::lock_guard<std::mutex> lock(fit_mutex_);
+    sample_us_ = (sample_us_ * num_samples_ + 1e-3 * (t1 - t0)) /
+      (num_samples_ + 1);
+
+    // Check first, the parser complains loudly about bad strings.
+    if (out.find("HR time raw:") == std::string::npos) {
+      ++num_failures_;
+      return -1;
+    }
+
+    uint64_t gps_ns = parse_mbg_string_ns(out);
+
+    if (gps_ns == 0) {
+      ++num_failures_;
+      return -1;
+    }
+
+    // The reference was read somewhere between t0 and t1.
+    sample_t s;
+    s.mono_ns = t0 + (t1 - t0) / 2;
+    s.gps_ns = gps_ns;
+    s.half_width_ns = 0.5 * (t1 - t0) + 1.0;
+
+    samples_.push_back(s);
+    while ((int)samples_.size() > window_) samples_.pop_front();
+
+    ++num_samples_;
+    last_good_ns_ = s.mono_ns;
+    Fit();
+
+    return 0;
+  };
+
+  gps_clock_fit_t GetFit() const {
+    std::lock_guard<std::mutex> lock(fit_mutex_);
+    gps_clock_fit_t fit;
+
+    int64_t holdover_ns = 10LL * period_ms_ * 1000000LL;
+
+    fit.locked = valid_ && (monotonic_ns() - last_good_ns_ < holdover_ns);
+    fit.num_samples = num_samples_;
+    fit.num_failures = num_failures_;
+    fit.window = samples_.size();
+    fit.offset_ns = samples_.empty() ? 0.0 :
+      (double)((int64_t)samples_.back().gps_ns - samples_.back().mono_ns);
+    fit.drift_ppm = 1e6 * b_.load();
+    fit.residual_ns = residual_ns_;
+    fit.sample_us = sample_us_;
+
+    return fit;
+  };
+
+ private:
+
+  struct sample_t {
+    int64_t mono_ns;
+    uint64_t gps_ns;
+    double half_width_ns; // uncertainty of when the sample was taken
+  };
+
+  std::string cmd_;
+  int period_ms_;
+  int window_;
+
+  std::atomic<bool> running_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+
+  // The model, gps = mono + y_ref + a + b * (mono - x_ref).
+  std::atomic<uint32_t> seq_;
+  std::atomic<int64_t> x_ref_;
+  std::atomic<int64_t> y_ref_;
+  std::atomic<double> a_;
+  std::atomic<double> b_;
+  std::atomic<bool> valid_;
+
+  mutable std::mutex fit_mutex_;
+  std::deque<sample_t> samples_;
+  uint64_t num_samples_;
+  uint64_t num_failures_;
+  int64_t last_good_ns_;
+  double residual_ns_;
+  double sample_us_;
+
+  void SampleLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (running_) {
+      lock.unlock();
+      Sample();
+      lock.lock();
+
+      cv_.wait_for(lock, std::chrono::milliseconds(period_ms_));
+    }
+  };
+
+  // Weighted least squares of (gps - mono) against mono, weighting each
+  // sample by how tightly its read time is known.  Needs fit_mutex_.
+  void Fit() {
+    const sample_t &ref = samples_.back();
+    int64_t x_ref = ref.mono_ns;
+    int64_t y_ref = (int64_t)ref.gps_ns - ref.mono_ns;
+
+    double sw = 0.0, sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+
+    for (auto &s : samples_) {
+      double w = 1.0 / (s.half_width_ns * s.half_width_ns);
+      double x = (double)(s.mono_ns - x_ref);
+      double y = (double)((int64_t)s.gps_ns - s.mono_ns - y_ref);
+
+      sw += w;
+      sx += w * x;
+      sy += w * y;
+      sxx += w * x * x;
+      sxy += w * x * y;
+    }
+
+    double a = sy / sw;
+    double b = 0.0;
+    double det = sw * sxx - sx * sx;
+
+    if ((samples_.size() > 1) && (det > 0.0)) {
+      b = (sw * sxy - sx * sy) / det;
+      a = (sy - b * sx) / sw;
+    }
+
+    double rss = 0.0;
+    for (auto &s : samples_) {
+      double x = (double)(s.mono_ns - x_ref);
+      double y = (double)((int64_t)s.gps_ns - s.mono_ns - y_ref);
+      rss += (y - a - b * x) * (y - a - b * x);
+    }
+
+    residual_ns_ = std::sqrt(rss / samples_.size());
+
+    // Seqlock write, readers retry while seq_ is odd.
+    seq_.fetch_add(1, std::memory_order_acq_rel);
+    std::atomic_thread_fence(std::memory_order_release);
+    x_ref_.store(x_ref, std::memory_order_relaxed);
+    y_ref_.store(y_ref, std::memory_order_relaxed);
+    a_.store(a, std::memory_order_relaxed);
+    b_.store(b, std::memory_order_relaxed);
+    valid_.store(true, std::memory_order_relaxed);
+    seq_.fetch_add(1, std::memory_order_release);
+  };
+};
+
+} // ::g2field
+
+#endif
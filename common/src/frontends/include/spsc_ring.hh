@@ -0,0 +1,123 @@
+#ifndef FRONTENDS_INCLUDE_SPSC_RING_HH_
+#define FRONTENDS_INCLUDE_SPSC_RING_HH_
+
+/*===========================================================================*\
+
+author: Matthias W. Smith
+email:  mwsmith2@uw.edu
+file:   spsc_ring.hh
+
+about:  A bounded, lock-free ring buffer for exactly one producer thread
+        and one consumer thread.  The slots are allocated up front and
+        items are swapped in and out, so the caller always gets a
+        recycled slot back and large payloads (e.g., traces) are never
+        reallocated once the ring has been primed.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+namespace g2field {
+
+template <typename T>
+class SpscRing {
+
+ public:
+
+  SpscRing() : head_(0), tail_(0) {};
+
+  // Allocate the slots.  Not thread-safe, call while both sides are idle.
+  void Reset(std::size_t capacity, const T &prototype=T()) {
+    slots_.assign(capacity > 0 ? capacity : 1, prototype);
+    head_.store(0);
+    tail_.store(0);
+  };
+
+  // Drop all items, keeping the slot allocations.  Call while idle.
+  void Clear() {
+    head_.store(tail_.load());
+  };
+
+  // Producer side: copy prototype into every slot the producer owns.
+  void Prime(const T &prototype) {
+    std::size_t tail = tail_.load(std::memory_order_relaxed);
+    std::size_t head = head_.load(std::memory_order_acquire);
+
+    for (std::size_t i = tail; i < head + slots_.size(); ++i) {
+      slots_[i % slots_.size()] = prototype;
+    }
+  };
+
+  // Producer side: swap item into the ring, item receives the recycled
+  // contents of the slot.  Returns false if the ring is full.
+  bool Push(T &item) {
+    std::size_t tail = tail_.load(std::memory_order_relaxed);
+
+    if (tail - head_.load(std::memory_order_acquire) >= slots_.size()) {
+      return false;
+    }
+
+    std::swap(slots_[tail % slots_.size()], item);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  };
+
+  // Consumer side: swap the oldest item out into item.  Returns false
+  // if the ring is empty.
+  bool Pop(T &item) {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    std::swap(slots_[head % slots_.size()], item);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  };
+
+  // Consumer side: peek at the oldest item, nullptr if empty.
+  T *Front() {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+
+    return &slots_[head % slots_.size()];
+  };
+
+  // Consumer side: drop the oldest item.
+  void Discard() {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+
+    if (head != tail_.load(std::memory_order_acquire)) {
+      head_.store(head + 1, std::memory_order_release);
+    }
+  };
+
+  inline std::size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+      head_.load(std::memory_order_acquire);
+  };
+
+  inline bool empty() const { return size() == 0; };
+  inline bool full() const { return size() >= slots_.size(); };
+  inline std::size_t capacity() const { return slots_.size(); };
+
+ private:
+
+  std::vector<T> slots_;
+
+  // Keep the indices on separate cache lines to avoid false sharing.
+  alignas(64) std::atomic<std::size_t> head_;
+  alignas(64) std::atomic<std::size_t> tail_;
+};
+
+} // ::g2field
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef FRONTENDS_INCLUDE_THREAD_SIGNAL_HH_
+#define FRONTENDS_INCLUDE_THREAD_SIGNAL_HH_
+
+/*===========================================================================*\
+
+author: Matthias W. Smith
+email:  mwsmith2@uw.edu
+file:   thread_signal.hh
+
+about:  A latched flag that threads can block on.  It replaces the
+        set-a-flag-and-sleep-poll pattern with a condition variable,
+        so the waiting thread wakes as soon as the flag is raised.
+        Each signal also keeps a running tally of the hand-off latency,
+        i.e., the time between Set() and the waiter waking up.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace g2field {
+
+// Summary of the hand-off latency of a signal in microseconds.
+struct signal_latency_t {
+  uint64_t count;
+  double mean_us;
+  double max_us;
+};
+
+class ThreadSignal {
+
+ public:
+
+  ThreadSignal() : flag_(false), count_(0), sum_ns_(0), max_ns_(0) {};
+
+  // Raise the flag and wake anyone waiting on it.
+  inline void Set() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!flag_) {
+        set_time_ = std::chrono::steady_clock::now();
+      }
+      flag_ = true;
+    }
+    cv_.notify_all();
+  };
+
+  // Lower the flag.
+  inline void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flag_ = false;
+  };
+
+  // Wake all waiters without raising the flag, so they can recheck
+  // any run state (e.g., when stopping threads).
+  inline void Interrupt() {
+    cv_.notify_all();
+  };
+
+  inline bool IsSet() const { return flag_; };
+
+  // Block until the flag is raised or timeout_us passes, returns the flag.
+  inline bool WaitFor(int timeout_us) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (!flag_) {
+      cv_.wait_for(lock, std::chrono::microseconds(timeout_us));
+
+      if (flag_) {
+        RecordLatency();
+      }
+    }
+
+    return flag_;
+  };
+
+  // Block until the flag is raised, then lower it atomically.
+  inline bool WaitAndClear(int timeout_us) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (!flag_) {
+      cv_.wait_for(lock, std::chrono::microseconds(timeout_us));
+
+      if (flag_) {
+        RecordLatency();
+      }
+    }
+
+    bool rc = flag_;
+    flag_ = false;
+    return rc;
+  };
+
+  // Return and reset the accumulated latency statistics.
+  inline signal_latency_t GetLatency(bool reset=false) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    signal_latency_t lat;
+
+    lat.count = count_;
+    lat.mean_us = (count_ > 0) ? 1.0e-3 * sum_ns_ / count_ : 0.0;
+    lat.max_us = 1.0e-3 * max_ns_;
+
+    if (reset) {
+      count_ = 0;
+      sum_ns_ = 0;
+      max_ns_ = 0;
+    }
+
+    return lat;
+  };
+
+ private:
+
+  std::atomic<bool> flag_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::chrono::steady_clock::time_point set_time_;
+
+  uint64_t count_;
+  uint64_t sum_ns_;
+  uint64_t max_ns_;
+
+  // Must be called with mutex_ held.
+  inline void RecordLatency() {
+    using namespace std::chrono;
+    auto dt = steady_clock::now() - set_time_;
+    uint64_t ns = duration_cast<nanoseconds>(dt).count();
+
+    ++count_;
+    sum_ns_ += ns;
+    if (ns > max_ns_) max_ns_ = ns;
+  };
+};
+
+} // ::g2field
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef FRONTENDS_INCLUDE_TRACE_ACCUMULATOR_HH_
+#define FRONTENDS_INCLUDE_TRACE_ACCUMULATOR_HH_
+
+/*===========================================================================*\
+
+author: Matthias W. Smith
+email:  mwsmith2@uw.edu
+file:   trace_accumulator.hh
+
+about:  Running sums of repeated digitizer traces for coherent averaging.
+        Each slot holds the 32-bit sum of one channel's shots, so up to
+        kMaxShots 16-bit traces add without overflow and the average is
+        exact in single precision.  The average is written rounded for
+        the stored trace, or unrounded and strided for the analysis.
+        The loops are plain element-wise kernels on unaliased buffers
+        so they vectorize.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <vector>
+#include <cstdint>
+
+namespace g2field {
+
+namespace accumulation {
+
+// sum[i] = in[i]
+inline void assign(const unsigned short * __restrict__ in,
+                   uint32_t * __restrict__ sum, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    sum[i] = in[i];
+  }
+}
+
+// sum[i] += in[i]
+inline void add(const unsigned short * __restrict__ in,
+                uint32_t * __restrict__ sum, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    sum[i] += in[i];
+  }
+}
+
+// out[i] = round(sum[i] / num_shots)
+inline void average(const uint32_t * __restrict__ sum,
+                    unsigned short * __restrict__ out, int n, int num_shots)
+{
+  const float scale = 1.0f / num_shots;
+
+  for (int i = 0; i < n; ++i) {
+    out[i] = (unsigned short)(sum[i] * scale + 0.5f);
+  }
+}
+
+// out[i] = sum[offset + Stride * i] / num_shots, Stride known at
+// compile time.
+template <int Stride>
+inline void average(const uint32_t * __restrict__ sum,
+                    float * __restrict__ out, int n, int num_shots,
+                    int offset)
+{
+  const float scale = 1.0f / num_shots;
+  sum += offset;
+
+  for (int i = 0; i < n; ++i) {
+    out[i] = sum[Stride * i] * scale;
+  }
+}
+
+} // ::accumulation
+
+class TraceAccumulator {
+
+ public:
+
+  // 65535 * kMaxShots stays below 2^24, where floats stop being exact.
+  static const int kMaxShots = 256;
+
+  // Starts the sum of a slot with its first shot.
+  void Start(int slot, const unsigned short *in, int len) {
+    if ((int)sums_.size() <= slot) sums_.resize(slot + 1);
+    if ((int)sums_[slot].size() < len) sums_[slot].resize(len);
+
+    accumulation::assign(in, &sums_[slot][0], len);
+  };
+
+  // Adds a later shot, samples past the first shot's length are ignored.
+  void Add(int slot, const unsigned short *in, int len) {
+    if (len > (int)sums_[slot].size()) len = sums_[slot].size();
+    accumulation::add(in, &sums_[slot][0], len);
+  };
+
+  // Writes the average of num_shots shots of a slot.
+  void Average(int slot, unsigned short *out, int len, int num_shots) const {
+    accumulation::average(&sums_[slot][0], out, len, num_shots);
+  };
+
+  // Writes the unrounded average of the first n odd samples of a slot,
+  // the FID of a sis3302 trace.
+  void AverageOdd(int slot, float *out, int n, int num_shots) const {
+    accumulation::average<2>(&sums_[slot][0], out, n, num_shots, 1);
+  };
+
+ private:
+
+  std::vector<std::vector<uint32_t>> sums_;
+};
+
+} // ::g2field
+
+#endif
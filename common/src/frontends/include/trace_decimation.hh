@@ -0,0 +1,220 @@
+#ifndef FRONTENDS_INCLUDE_TRACE_DECIMATION_HH_
+#define FRONTENDS_INCLUDE_TRACE_DECIMATION_HH_
+
+/*===========================================================================*\
+
+author: Matthias W. Smith
+email:  mwsmith2@uw.edu
+file:   trace_decimation.hh
+
+about:  Strided decimation of digitizer traces, e.g., taking the odd
+        samples to skip the sis3302 spikes or every tenth sample for
+        the recorded FIDs.  The common strides get kernels with the
+        stride fixed at compile time so the gather vectorizes.  An
+        optional windowed-sinc FIR low-pass can be applied at the kept
+        samples to limit aliasing; its taps can step over samples, so
+        the sis3302 spikes stay out of the filter too.  Time axes for
+        the decimated traces are cached, so they are built once per
+        sample spacing.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <vector>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <memory>
+#include <cmath>
+#include <cstdint>
+
+namespace g2field {
+
+namespace decimation {
+
+// Store a filtered value, rounding and clamping for integer samples.
+inline void store(double val, double &out) { out = val; }
+inline void store(double val, float &out) { out = val; }
+inline void store(double val, unsigned short &out) {
+  val = (val < 0.0) ? 0.0 : ((val > 65535.0) ? 65535.0 : val);
+  out = (unsigned short)(val + 0.5);
+}
+
+// out[i] = in[offset + Stride * i], Stride known at compile time.
+template <int Stride, typename In, typename Out>
+inline void gather(const In * __restrict__ in, Out * __restrict__ out,
+                   int n, int offset)
+{
+  in += offset;
+
+  for (int i = 0; i < n; ++i) {
+    out[i] = in[Stride * i];
+  }
+}
+
+// The same with a run time stride, for the uncommon cases.
+template <typename In, typename Out>
+inline void gather(const In * __restrict__ in, Out * __restrict__ out,
+                   int n, int offset, int stride)
+{
+  switch (stride) {
+    case 1:
+      gather<1>(in, out, n, offset);
+      break;
+
+    case 2:
+      gather<2>(in, out, n, offset);
+      break;
+
+    case 4:
+      gather<4>(in, out, n, offset);
+      break;
+
+    case 10:
+      gather<10>(in, out, n, offset);
+      break;
+
+    default:
+      in += offset;
+      for (int i = 0; i < n; ++i) {
+        out[i] = in[stride * i];
+      }
+  }
+}
+
+// out[i] = in[2 * i + 1], the FID of a sis3302 trace without the
+// spikes in its even samples.
+template <typename In, typename Out>
+inline void odd_samples(const In * __restrict__ in, Out * __restrict__ out,
+                        int n)
+{
+  gather<2>(in, out, n, 1);
+}
+
+} // ::decimation
+
+class TraceDecimator {
+
+ public:
+
+  // Keeps in[offset + stride * i].  With num_taps > 0, each kept
+  // sample is first low-passed at the decimated Nyquist frequency.
+  TraceDecimator(int stride=1, int offset=0, int num_taps=0) :
+    stride_(stride > 0 ? stride : 1), offset_(offset), tap_step_(1)
+  {
+    SetFilter(num_taps);
+  };
+
+  // Builds a Hamming-windowed sinc with the given (odd) number of taps,
+  // zero taps turns filtering off.  The taps are tap_step samples apart,
+  // e.g., 2 filters only the odd samples of a sis3302 trace.  The stride
+  // must be a multiple of tap_step.
+  void SetFilter(int num_taps, int tap_step=1) {
+    taps_.resize(0);
+    tap_step_ = ((tap_step > 0) && (stride_ % tap_step == 0)) ? tap_step : 1;
+
+    if (num_taps <= 1) return;
+    if (num_taps % 2 == 0) ++num_taps;
+
+    const double pi = 3.141592653589793;
+    const double fc = 0.5 * tap_step_ / stride_;
+    const int half = num_taps / 2;
+    double norm = 0.0;
+
+    taps_.resize(num_taps);
+
+    for (int k = 0; k < num_taps; ++k) {
+      int m = k - half;
+      double sinc = (m == 0) ? 2 * fc : std::sin(2 * pi * fc * m) / (pi * m);
+      double window = 0.54 - 0.46 * std::cos(2 * pi * k / (num_taps - 1));
+      taps_[k] = sinc * window;
+      norm += taps_[k];
+    }
+
+    for (auto &tap : taps_) {
+      tap /= norm;
+    }
+  };
+
+  // Writes n decimated samples of in (in_len samples long) to out.
+  template <typename In, typename Out>
+  void Decimate(const In *in, int in_len, Out *out, int n) const {
+
+    int max_n = (in_len - offset_ + stride_ - 1) / stride_;
+    if (n > max_n) n = max_n;
+    if (n <= 0) return;
+
+    if (taps_.empty()) {
+      decimation::gather(in, out, n, offset_, stride_);
+      return;
+    }
+
+    // Only the kept samples are filtered, edges are clamped to the
+    // first and last samples the taps can land on.
+    const int num_taps = taps_.size();
+    const int span = tap_step_ * (num_taps - 1);
+    const int lo = offset_ % tap_step_;
+    const int hi = lo + tap_step_ * ((in_len - 1 - lo) / tap_step_);
+
+    for (int i = 0; i < n; ++i) {
+      int j0 = offset_ + stride_ * i - span / 2;
+      double acc = 0.0;
+
+      if ((j0 >= 0) && (j0 + span < in_len)) {
+
+        const In *p = in + j0;
+        for (int k = 0; k < num_taps; ++k) {
+          acc += taps_[k] * p[tap_step_ * k];
+        }
+
+      } else {
+
+        for (int k = 0; k < num_taps; ++k) {
+          int j = j0 + tap_step_ * k;
+          j = (j < lo) ? lo : ((j > hi) ? hi : j);
+          acc += taps_[k] * in[j];
+        }
+      }
+
+      decimation::store(acc, out[i]);
+    }
+  };
+
+  inline int stride() const { return stride_; };
+  inline int offset() const { return offset_; };
+  inline int num_taps() const { return taps_.size(); };
+  inline int tap_step() const { return tap_step_; };
+
+ private:
+
+  int stride_;
+  int offset_;
+  int tap_step_;
+  std::vector<double> taps_;
+};
+
+// Returns t0 + dt * i for i < n.  Axes are built once and shared, so
+// the reference stays valid for the life of the program.
+inline const std::vector<double> &time_axis(double dt, int n, double t0=0.0)
+{
+  typedef std::tuple<double, int, double> key_t;
+  static std::mutex mutex;
+  static std::map<key_t, std::unique_ptr<std::vector<double>>> cache;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &axis = cache[key_t(dt, n, t0)];
+
+  if (!axis) {
+    axis.reset(new std::vector<double>(n));
+
+    for (int i = 0; i < n; ++i) {
+      (*axis)[i] = t0 + dt * i;
+    }
+  }
+
+  return *axis;
+}
+
+} // ::g2field
+
+#endif
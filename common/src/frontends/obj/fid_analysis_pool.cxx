@@ -0,0 +1,84 @@
+#include "fid_analysis_pool.hh"
+
+//--- other includes --------------------------------------------------------//
+#include <fftw3.h>
+
+namespace g2field {
+
+FidAnalysisPool::FidAnalysisPool(int num_threads, int scratch_size, job_t job) :
+  job_(job), scratch_size_(scratch_size), num_running_(0), thread_live_(true)
+{
+  // The Fid constructors plan their transforms on the worker threads.
+  static std::once_flag planner_once;
+  std::call_once(planner_once, [] { fftw_make_planner_thread_safe(); });
+
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.push_back(std::thread(&FidAnalysisPool::WorkLoop, this));
+  }
+}
+
+FidAnalysisPool::~FidAnalysisPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    thread_live_ = false;
+  }
+  job_cv_.notify_all();
+
+  for (auto &t : threads_) {
+    if (t.joinable()) {
+      t.join();
+    }
+  }
+}
+
+void FidAnalysisPool::Submit(int idx)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(idx);
+  }
+  job_cv_.notify_one();
+}
+
+void FidAnalysisPool::WaitIdle()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this] { return jobs_.empty() && (num_running_ == 0); });
+}
+
+void FidAnalysisPool::WorkLoop()
+{
+  std::vector<double> wf(scratch_size_, 0.0);
+
+  while (true) {
+
+    int idx;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_cv_.wait(lock, [this] { return !jobs_.empty() || !thread_live_; });
+
+      if (jobs_.empty()) {
+        return;
+      }
+
+      idx = jobs_.front();
+      jobs_.pop_front();
+      ++num_running_;
+    }
+
+    job_(idx, wf);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --num_running_;
+
+      if (jobs_.empty() && (num_running_ == 0)) {
+        idle_cv_.notify_all();
+      }
+    }
+  }
+}
+
+} // ::g2field
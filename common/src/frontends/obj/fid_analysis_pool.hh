@@ -0,0 +1,71 @@
+#ifndef FIELD_DAQ_FRONTENDS_OBJ_FID_ANALYSIS_POOL_HH_
+#define FIELD_DAQ_FRONTENDS_OBJ_FID_ANALYSIS_POOL_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   fid_analysis_pool.hh
+
+  about:  A fixed set of worker threads that analyze FIDs by probe
+          index.  The sequencer submits the probes of a round as soon
+          as their traces are copied and joins before the event is
+          queued, so analysis overlaps the next mux round.
+
+          libfid makes FFTW plans in every Fid it builds and the FFTW
+          planner is not thread safe, so the first pool to start makes
+          it so with fftw_make_planner_thread_safe().
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace g2field {
+
+class FidAnalysisPool {
+
+public:
+
+  // The job receives the probe index and a scratch buffer that belongs
+  // to the worker thread running it.
+  typedef std::function<void(int, std::vector<double>&)> job_t;
+
+  //ctor
+  FidAnalysisPool(int num_threads, int scratch_size, job_t job);
+
+  //dtor
+  ~FidAnalysisPool();
+
+  // Queue the analysis of one probe.
+  void Submit(int idx);
+
+  // Block until every submitted probe has been analyzed.
+  void WaitIdle();
+
+  inline int num_threads() const { return threads_.size(); };
+
+private:
+
+  job_t job_;
+  int scratch_size_;
+  int num_running_;
+  bool thread_live_;
+
+  std::deque<int> jobs_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable job_cv_;
+  std::condition_variable idle_cv_;
+
+  void WorkLoop();
+};
+
+} // ::g2field
+
+#endif
@@ -0,0 +1,442 @@
+#include "fid_batch.hh"
+
+//--- std includes ----------------------------------------------------------//
+#include <algorithm>
+#include <cmath>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include "fid.h"
+
+namespace g2field {
+
+namespace {
+
+const int kTile = FidBatch::kTileProbes;
+const double kPi = 3.14159265358979323846;
+
+// atan2 without branches, so the loops calling it still vectorize.  The
+// argument is folded to |u| < tan(pi/8), where the series is good to
+// 1e-10 rad, well below what the phase fit resolves.
+inline double batch_atan2(double y, double x)
+{
+  double ax = std::fabs(x);
+  double ay = std::fabs(y);
+  double hi = (ax > ay) ? ax : ay;
+  double lo = (ax > ay) ? ay : ax;
+  double a = lo / ((hi > 0.0) ? hi : 1.0);
+
+  bool fold = a > 0.41421356237309503;
+  double u = fold ? (a - 1.0) / (a + 1.0) : a;
+  double u2 = u * u;
+
+  double r = 1.0 / 21;
+  r = r * u2 - 1.0 / 19;
+  r = r * u2 + 1.0 / 17;
+  r = r * u2 - 1.0 / 15;
+  r = r * u2 + 1.0 / 13;
+  r = r * u2 - 1.0 / 11;
+  r = r * u2 + 1.0 / 9;
+  r = r * u2 - 1.0 / 7;
+  r = r * u2 + 1.0 / 5;
+  r = r * u2 - 1.0 / 3;
+  r = (r * u2 + 1.0) * u;
+
+  r = fold ? 0.25 * kPi + r : r;
+  r = (ay > ax) ? 0.5 * kPi - r : r;
+  r = (x < 0.0) ? kPi - r : r;
+
+  return (y < 0.0) ? -r : r;
+}
+
+} // ::(anonymous)
+
+FidBatch::FidBatch() : num_probes_(0), num_tiles_(0), len_(0), dt_(1.0)
+{
+  params_.edge_ignore = 100;
+  params_.zc_width = 200;
+  params_.start_thresh = 0.37;
+  params_.hyst_thresh = 0.3;
+}
+
+int FidBatch::LoadParams(const std::string &file)
+{
+  boost::property_tree::ptree pt;
+
+  try {
+
+    boost::property_tree::read_json(file, pt);
+
+  } catch (boost::property_tree::ptree_error &err) {
+
+    return -1;
+  }
+
+  params_.edge_ignore = pt.get<int>("fid.params.edge_ignore",
+                                    params_.edge_ignore);
+  params_.zc_width = pt.get<int>("fid.params.zc_width", params_.zc_width);
+  params_.start_thresh = pt.get<double>("fid.params.start_thresh",
+                                        params_.start_thresh);
+  params_.hyst_thresh = pt.get<double>("fid.params.hyst_thresh",
+                                       params_.hyst_thresh);
+  return 0;
+}
+
+void FidBatch::Reset(int num_probes, int len, double dt)
+{
+  num_probes_ = num_probes;
+  num_tiles_ = (num_probes + kTile - 1) / kTile;
+  len_ = len;
+  dt_ = dt;
+
+  const int num_cols = num_tiles_ * kTile;
+
+  block_.resize((size_t)num_cols * len_);
+
+  // The padding of the last tile is analyzed too, keep it quiet.
+  if (num_cols > num_probes_) {
+    float *x = tile(num_tiles_ - 1);
+
+    for (int s = 0; s < len_; ++s) {
+      for (int j = num_probes_ % kTile; j < kTile; ++j) {
+        x[s * kTile + j] = 0.0f;
+      }
+    }
+  }
+
+  for (auto v : {&amp, &snr, &fid_len, &freq_zc, &ferr_zc, &freq_ph, &ferr_ph,
+                 &base_, &start_, &end_, &omega_}) {
+    v->assign(num_cols, 0.0);
+  }
+
+  health.assign(num_cols, 0);
+}
+
+template <typename T>
+void FidBatch::LoadTrace(int p, const T *wf)
+{
+  float *x = tile(p / kTile) + p % kTile;
+
+  for (int s = 0; s < len_; ++s) {
+    x[s * kTile] = wf[s];
+  }
+}
+
+void FidBatch::Load(int p, const double *wf)
+{
+  LoadTrace(p, wf);
+}
+
+void FidBatch::Load(int p, const unsigned short *wf)
+{
+  LoadTrace(p, wf);
+}
+
+void FidBatch::Analyze()
+{
+  for (int t = 0; t < num_tiles_; ++t) {
+    Levels(t);
+    ZeroCrossings(t);
+  }
+
+  // One quarter-period delay for the batch, the per-probe coefficients
+  // absorb the spread of frequencies.
+  std::vector<double> omega;
+
+  for (int p = 0; p < num_probes_; ++p) {
+    omega_[p] = 2.0 * kPi * freq_zc[p] * dt_;
+    if (omega_[p] > 0.0) omega.push_back(omega_[p]);
+  }
+
+  if (!omega.empty()) {
+
+    std::nth_element(omega.begin(), omega.begin() + omega.size() / 2,
+                     omega.end());
+
+    int delay = std::lround(0.5 * kPi / omega[omega.size() / 2]);
+    delay = std::max(1, std::min(delay, len_ / 8));
+
+    for (int t = 0; t < num_tiles_; ++t) {
+      Phase(t, delay);
+    }
+  }
+
+  for (int p = 0; p < num_probes_; ++p) {
+
+    bool good = (freq_zc[p] > 0.0) && std::isfinite(freq_zc[p]);
+    health[p] = good ? 100 : 0;
+  }
+}
+
+void FidBatch::GetResult(int p, bool use_phase, fid_result_t &res) const
+{
+  res = fid_result_t();
+  res.method = use_phase ? (ushort)fid::Method::PH : (ushort)fid::Method::ZC;
+  res.health = health[p];
+
+  if (health[p] == 0) return;
+
+  res.fid_amp = amp[p];
+  res.fid_snr = snr[p];
+  res.fid_len = fid_len[p];
+  res.freq = use_phase ? freq_ph[p] : freq_zc[p];
+  res.ferr = use_phase ? ferr_ph[p] : ferr_zc[p];
+  res.freq_zc = freq_zc[p];
+  res.ferr_zc = ferr_zc[p];
+}
+
+void FidBatch::Levels(int t)
+{
+  const float *x = tile(t);
+  const int p0 = t * kTile;
+  const int e = params_.edge_ignore;
+  const int s_noise = std::max(e, len_ - e - params_.zc_width);
+
+  double sum[kTile], hi[kTile], lo[kTile], sq[kTile];
+  double thresh[kTile], first[kTile], last[kTile];
+
+  for (int j = 0; j < kTile; ++j) {
+    sum[j] = 0.0;
+    hi[j] = -1.0e30;
+    lo[j] = 1.0e30;
+    sq[j] = 0.0;
+  }
+
+  // The baseline is the mean of the whole trace, the extremes skip
+  // the edges.
+  for (int s = 0; s < len_; ++s) {
+    for (int j = 0; j < kTile; ++j) {
+      sum[j] += x[s * kTile + j];
+    }
+  }
+
+  for (int s = e; s < len_ - e; ++s) {
+    for (int j = 0; j < kTile; ++j) {
+      double v = x[s * kTile + j];
+      hi[j] = (v > hi[j]) ? v : hi[j];
+      lo[j] = (v < lo[j]) ? v : lo[j];
+    }
+  }
+
+  double *base = &base_[p0];
+
+  for (int j = 0; j < kTile; ++j) {
+    base[j] = sum[j] / len_;
+    amp[p0 + j] = std::max(hi[j] - base[j], base[j] - lo[j]);
+    thresh[j] = params_.start_thresh * amp[p0 + j];
+    first[j] = -1.0;
+    last[j] = -1.0;
+  }
+
+  // The FID runs from the first to the last sample above start_thresh,
+  // the noise is the rms at the tail.
+  for (int s = e; s < len_ - e; ++s) {
+
+    const double sd = s;
+    const double tail = (s >= s_noise) ? 1.0 : 0.0;
+
+    for (int j = 0; j < kTile; ++j) {
+      double y = x[s * kTile + j] - base[j];
+      double above = (std::fabs(y) > thresh[j]) ? 1.0 : 0.0;
+      double fresh = (first[j] < 0.0) ? above : 0.0;
+
+      first[j] += fresh * (sd - first[j]);
+      last[j] += above * (sd - last[j]);
+      sq[j] += tail * y * y;
+    }
+  }
+
+  const int w_noise = std::max(1, len_ - e - s_noise);
+
+  for (int j = 0; j < kTile; ++j) {
+    double noise = std::sqrt(sq[j] / w_noise);
+
+    snr[p0 + j] = (noise > 0.0) ? amp[p0 + j] / noise : 0.0;
+    start_[p0 + j] = first[j];
+    end_[p0 + j] = last[j];
+    fid_len[p0 + j] = (last[j] > first[j]) ? (last[j] - first[j]) * dt_ : 0.0;
+  }
+}
+
+bool FidBatch::FidRange(int t, int &s_first, int &s_last) const
+{
+  const int p0 = t * kTile;
+
+  s_first = len_;
+  s_last = -1;
+
+  for (int j = 0; j < kTile; ++j) {
+    if (start_[p0 + j] < 0.0) continue;
+
+    s_first = std::min(s_first, (int)start_[p0 + j]);
+    s_last = std::max(s_last, (int)end_[p0 + j]);
+  }
+
+  return s_last > s_first;
+}
+
+void FidBatch::ZeroCrossings(int t)
+{
+  const float *x = tile(t);
+  const int p0 = t * kTile;
+  const int e = params_.edge_ignore;
+  const double *base = &base_[p0];
+  const double *start = &start_[p0];
+  const double *end = &end_[p0];
+
+  double hyst[kTile], state[kTile], t_raw[kTile];
+  double count[kTile], t_first[kTile], t_last[kTile];
+  double sum[kTile], sum2[kTile];
+
+  for (int j = 0; j < kTile; ++j) {
+    hyst[j] = params_.hyst_thresh * amp[p0 + j];
+    state[j] = 0.0;
+    t_raw[j] = 0.0;
+    count[j] = 0.0;
+    t_first[j] = 0.0;
+    t_last[j] = 0.0;
+    sum[j] = 0.0;
+    sum2[j] = 0.0;
+  }
+
+  int s_first, s_last;
+
+  if (!FidRange(t, s_first, s_last)) {
+    s_first = len_;
+    s_last = 0;
+  }
+
+  // A crossing counts once the trace has swung past the hysteresis
+  // band on the other side, and is timed where the sign changed last.
+  // Only the span of the tile's FIDs is swept.
+  for (int s = std::max(e, s_first) + 1; s <= s_last; ++s) {
+
+    const double sd = s;
+
+    for (int j = 0; j < kTile; ++j) {
+      double y = x[s * kTile + j] - base[j];
+      double y_prev = x[(s - 1) * kTile + j] - base[j];
+      double d = y_prev - y;
+
+      bool sign_change = (y_prev * y <= 0.0) & (d != 0.0);
+      double change = sign_change ? 1.0 : 0.0;
+      double t_cross = (sd - 1.0) + y_prev / (sign_change ? d : 1.0);
+      t_raw[j] += change * (t_cross - t_raw[j]);
+
+      double in_fid = ((sd > start[j]) & (sd <= end[j])) ? 1.0 : 0.0;
+      double up = ((y > hyst[j]) & (state[j] <= 0.0)) ? in_fid : 0.0;
+      double down = ((y < -hyst[j]) & (state[j] >= 0.0)) ? in_fid : 0.0;
+      double cross = (state[j] != 0.0) ? up + down : 0.0;
+      double later = (count[j] > 0.0) ? cross : 0.0;
+      double half = t_raw[j] - t_last[j];
+
+      sum[j] += later * half;
+      sum2[j] += later * half * half;
+      t_first[j] += (cross - later) * (t_raw[j] - t_first[j]);
+      t_last[j] += cross * half;
+      count[j] += cross;
+      state[j] += (up + down) * ((up - down) - state[j]);
+    }
+  }
+
+  for (int j = 0; j < kTile; ++j) {
+
+    double n = count[j] - 1.0;
+
+    if ((n < 1.0) || (t_last[j] <= t_first[j])) {
+      freq_zc[p0 + j] = 0.0;
+      ferr_zc[p0 + j] = 0.0;
+      continue;
+    }
+
+    double f = n / (2.0 * (t_last[j] - t_first[j]) * dt_);
+    double mean = sum[j] / n;
+    double var = std::max(0.0, sum2[j] / n - mean * mean);
+
+    freq_zc[p0 + j] = f;
+    ferr_zc[p0 + j] = f * std::sqrt(var / n) / mean;
+  }
+}
+
+void FidBatch::Phase(int t, int delay)
+{
+  const float *x = tile(t);
+  const int p0 = t * kTile;
+  const int e = params_.edge_ignore;
+  const int s0 = e + delay + 1;
+  const double *base = &base_[p0];
+  const double *start = &start_[p0];
+  const double *end = &end_[p0];
+
+  double c[kTile], inv_s[kTile], phi[kTile];
+  double s_w[kTile], s_u[kTile], s_uu[kTile];
+  double s_p[kTile], s_up[kTile], s_pp[kTile];
+
+  // With y = cos(theta), the trace delay samples earlier gives
+  // sin(theta) = (y_delay - cos(omega delay) y) / sin(omega delay).
+  for (int j = 0; j < kTile; ++j) {
+    double w = omega_[p0 + j] * delay;
+    double sn = std::sin(w);
+
+    c[j] = std::cos(w);
+    inv_s[j] = (std::fabs(sn) > 0.2) ? 1.0 / sn : 0.0;
+    phi[j] = 0.0;
+    s_w[j] = s_u[j] = s_uu[j] = 0.0;
+    s_p[j] = s_up[j] = s_pp[j] = 0.0;
+  }
+
+  // The phase advances by the angle between successive samples of the
+  // analytic signal, then a line is fit to it over the FID.  Where the
+  // phase starts doesn't change the slope, so the sweep starts at the
+  // first FID of the tile.
+  int s_first, s_last;
+
+  if (!FidRange(t, s_first, s_last)) {
+    s_first = len_;
+    s_last = 0;
+  }
+
+  for (int s = std::max(s0, s_first + delay + 1); s <= s_last; ++s) {
+    for (int j = 0; j < kTile; ++j) {
+      double y = x[s * kTile + j] - base[j];
+      double y_prev = x[(s - 1) * kTile + j] - base[j];
+      double q = (x[(s - delay) * kTile + j] - base[j] - c[j] * y) * inv_s[j];
+      double q_prev = (x[(s - 1 - delay) * kTile + j] - base[j] -
+                       c[j] * y_prev) * inv_s[j];
+
+      phi[j] += batch_atan2(q * y_prev - y * q_prev, y * y_prev + q * q_prev);
+
+      double w = ((s - delay > start[j]) & (s <= end[j]) &
+                  (inv_s[j] != 0.0)) ? 1.0 : 0.0;
+      double u = s - s0;
+
+      s_w[j] += w;
+      s_u[j] += w * u;
+      s_uu[j] += w * u * u;
+      s_p[j] += w * phi[j];
+      s_up[j] += w * u * phi[j];
+      s_pp[j] += w * phi[j] * phi[j];
+    }
+  }
+
+  for (int j = 0; j < kTile; ++j) {
+
+    if (s_w[j] < 3.0) {
+      freq_ph[p0 + j] = 0.0;
+      ferr_ph[p0 + j] = 0.0;
+      continue;
+    }
+
+    double uu = s_uu[j] - s_u[j] * s_u[j] / s_w[j];
+    double up = s_up[j] - s_u[j] * s_p[j] / s_w[j];
+    double pp = s_pp[j] - s_p[j] * s_p[j] / s_w[j];
+    double slope = up / uu;
+    double var = std::max(0.0, (pp - slope * up) / (s_w[j] - 2.0));
+
+    freq_ph[p0 + j] = slope / (2.0 * kPi * dt_);
+    ferr_ph[p0 + j] = std::sqrt(var / uu) / (2.0 * kPi * dt_);
+  }
+}
+
+} // ::g2field
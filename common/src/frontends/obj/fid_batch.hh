@@ -0,0 +1,120 @@
+#ifndef FIELD_DAQ_FRONTENDS_OBJ_FID_BATCH_HH_
+#define FIELD_DAQ_FRONTENDS_OBJ_FID_BATCH_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   fid_batch.hh
+
+  about:  Analyzes the FIDs of a whole event at once.  The traces sit in
+          one struct-of-arrays block, cut into tiles of kTileProbes
+          probes that are sample-major with the probes contiguous, so
+          every step is a fixed-width loop across a tile's probes that
+          the compiler vectorizes.  A tile is finished before the next,
+          and all buffers are kept between events.  The steps follow
+          fid::FastFid: the baseline, the amplitude and the noise at
+          the tail, the FID range from start_thresh, and the frequency
+          from the zero crossings with hyst_thresh hysteresis.  The
+          phase frequency is then fit to the phase of the quadrature
+          signal built from the trace and its copy a quarter period
+          earlier.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//--- project includes ------------------------------------------------------//
+#include "fid_worker_pool.hh"
+
+namespace g2field {
+
+// The analysis parameters, named as in the "params" of fid::load_params.
+struct fid_batch_params_t {
+  int edge_ignore;       // samples ignored at both ends
+  int zc_width;          // noise window before the trailing edge
+  double start_thresh;   // FID range, fraction of the amplitude
+  double hyst_thresh;    // zero crossing hysteresis, fraction of the amplitude
+};
+
+class FidBatch {
+
+ public:
+
+  // Probes per tile, a cache line of floats per sample.
+  static const int kTileProbes = 16;
+
+  FidBatch();
+
+  // Reads the "fid.params" of a fid::load_params file, missing keys
+  // keep their defaults.  Returns non-zero if the file can't be read.
+  int LoadParams(const std::string &file);
+  void SetParams(const fid_batch_params_t &params) { params_ = params; };
+
+  // Sizes the block for num_probes traces of len samples dt apart.
+  void Reset(int num_probes, int len, double dt);
+
+  // Copies a trace of len samples in as probe p.
+  void Load(int p, const double *wf);
+  void Load(int p, const unsigned short *wf);
+
+  // Analyzes every loaded probe.
+  void Analyze();
+
+  // The result of probe p, the phase frequency in freq if use_phase
+  // else the zero crossing frequency.
+  void GetResult(int p, bool use_phase, fid_result_t &res) const;
+
+  inline int num_probes() const { return num_probes_; };
+  inline int len() const { return len_; };
+
+  // Per-probe results of the last Analyze.
+  std::vector<double> amp;
+  std::vector<double> snr;
+  std::vector<double> fid_len;
+  std::vector<double> freq_zc;
+  std::vector<double> ferr_zc;
+  std::vector<double> freq_ph;
+  std::vector<double> ferr_ph;
+  std::vector<uint16_t> health;
+
+ private:
+
+  fid_batch_params_t params_;
+  int num_probes_;
+  int num_tiles_;
+  int len_;
+  double dt_;
+
+  // Sample s of probe p is at ((p / kTileProbes) * len_ + s) *
+  // kTileProbes + p % kTileProbes.
+  std::vector<float> block_;
+
+  // Per-probe working state.
+  std::vector<double> base_;
+  std::vector<double> start_;
+  std::vector<double> end_;
+  std::vector<double> omega_;
+
+  inline float *tile(int t) {
+    return &block_[(size_t)t * len_ * kTileProbes];
+  };
+
+  template <typename T>
+  void LoadTrace(int p, const T *wf);
+
+  // The samples spanned by the FIDs of tile t, false if it has none.
+  bool FidRange(int t, int &s_first, int &s_last) const;
+
+  // The steps of Analyze, each over one tile.
+  void Levels(int t);
+  void ZeroCrossings(int t);
+  void Phase(int t, int delay);
+};
+
+} // ::g2field
+
+#endif
@@ -0,0 +1,365 @@
+#include "fid_worker_pool.hh"
+
+//--- std includes ----------------------------------------------------------//
+#include <chrono>
+#include <cstring>
+#include <cmath>
+
+//--- other includes --------------------------------------------------------//
+#include "fid.h"
+
+//--- project includes ------------------------------------------------------//
+#include "trace_decimation.hh"
+
+namespace g2field {
+
+namespace {
+
+const uint32_t kJobMagic = 0x46584a42;    // "FXJB"
+const uint32_t kResultMagic = 0x46585253; // "FXRS"
+
+// A job is the header followed by num_samples floats.
+struct fid_job_header_t {
+  uint32_t magic;
+  uint32_t probe;
+  uint64_t batch;
+  uint32_t use_fast_fids_class;
+  uint32_t num_samples;
+  double dt;
+};
+
+struct fid_result_msg_t {
+  uint32_t magic;
+  uint32_t probe;
+  uint64_t batch;
+  fid_result_t result;
+};
+
+void init_socket(zmq::socket_t &socket)
+{
+  int linger = 0;
+  socket.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+}
+
+} // ::(anonymous)
+
+void analyze_fid(const std::vector<double> &wf, const std::vector<double> &tm,
+                 bool use_fast_fids_class, fid_result_t &res)
+{
+  res = fid_result_t();
+
+  if (use_fast_fids_class) {
+
+    fid::FastFid myfid(wf, tm);
+    res.method = (ushort)fid::Method::ZC;
+    res.health = myfid.health();
+
+    // Make sure we got an FID signal
+    if (myfid.isgood() && std::isfinite(myfid.CalcFreq())) {
+
+      res.fid_amp = myfid.amp();
+      res.fid_snr = myfid.snr();
+      res.fid_len = myfid.fid_time();
+      res.freq = myfid.CalcFreq();
+      res.ferr = myfid.freq_err();
+      res.freq_zc = res.freq;
+      res.ferr_zc = res.ferr;
+    }
+
+  } else {
+
+    fid::Fid myfid(wf, tm);
+    res.method = (ushort)fid::Method::PH;
+    res.health = myfid.health();
+
+    // Make sure we got an FID signal
+    if (myfid.isgood()) {
+
+      res.fid_amp = myfid.amp();
+      res.fid_snr = myfid.snr();
+      res.fid_len = myfid.fid_time();
+      res.freq = myfid.CalcPhaseFreq();
+      res.ferr = myfid.freq_err();
+      res.freq_zc = myfid.CalcZeroCountFreq();
+      res.ferr_zc = myfid.freq_err();
+
+    } else {
+
+      myfid.DiagnosticInfo();
+    }
+  }
+}
+
+void store_fid_result(const fid_result_t &res, nmr_vector &event, int idx)
+{
+  event.fid_amp[idx] = res.fid_amp;
+  event.fid_snr[idx] = res.fid_snr;
+  event.fid_len[idx] = res.fid_len;
+  event.freq[idx] = res.freq;
+  event.ferr[idx] = res.ferr;
+  event.freq_zc[idx] = res.freq_zc;
+  event.ferr_zc[idx] = res.ferr_zc;
+  event.method[idx] = res.method;
+  event.health[idx] = res.health;
+}
+
+FidWorkerPool::FidWorkerPool() :
+  batch_(0), num_pending_(0), context_(1)
+{
+  stats_ = fid_worker_stats_t();
+}
+
+FidWorkerPool::~FidWorkerPool()
+{
+  Close();
+}
+
+int FidWorkerPool::Bind(const std::string &job_address,
+                        const std::string &result_address)
+{
+  Close();
+
+  try {
+
+    job_socket_.reset(new zmq::socket_t(context_, ZMQ_PUSH));
+    init_socket(*job_socket_);
+    job_socket_->bind(job_address.c_str());
+
+    result_socket_.reset(new zmq::socket_t(context_, ZMQ_PULL));
+    init_socket(*result_socket_);
+    result_socket_->bind(result_address.c_str());
+
+  } catch (zmq::error_t &err) {
+
+    job_socket_.reset();
+    result_socket_.reset();
+    return -1;
+  }
+
+  return 0;
+}
+
+void FidWorkerPool::Close()
+{
+  job_socket_.reset();
+  result_socket_.reset();
+}
+
+bool FidWorkerPool::Submit(int idx, const std::vector<double> &wf, double dt,
+                           bool use_fast_fids_class)
+{
+  if (!job_socket_) return false;
+
+  fid_job_header_t h;
+  h.magic = kJobMagic;
+  h.probe = idx;
+  h.batch = batch_;
+  h.use_fast_fids_class = use_fast_fids_class;
+  h.num_samples = wf.size();
+  h.dt = dt;
+
+  // Singles keep the ADC resolution at half the bytes on the wire.
+  zmq::message_t msg(sizeof(h) + wf.size() * sizeof(float));
+  memcpy(msg.data(), &h, sizeof(h));
+
+  float *samples = reinterpret_cast<float *>(
+    static_cast<char *>(msg.data()) + sizeof(h));
+
+  for (int i = 0; i < (int)wf.size(); ++i) {
+    samples[i] = wf[i];
+  }
+
+  bool sent = false;
+
+  try {
+
+    // Without a connected worker a PUSH send would block.
+    sent = job_socket_->send(msg, ZMQ_DONTWAIT);
+
+  } catch (zmq::error_t &err) {
+
+    sent = false;
+  }
+
+  if (!sent) {
+    ++stats_.unsent;
+    return false;
+  }
+
+  if ((int)pending_.size() <= idx) pending_.resize(idx + 1, 0);
+
+  if (!pending_[idx]) {
+    pending_[idx] = 1;
+    outstanding_.push_back(idx);
+    ++num_pending_;
+  }
+
+  ++stats_.sent;
+  return true;
+}
+
+void FidWorkerPool::Collect(nmr_vector &event, int deadline_ms,
+                            std::vector<int> &missing)
+{
+  using namespace std::chrono;
+
+  auto t_end = steady_clock::now() + milliseconds(deadline_ms);
+  const int num_probes = event.freq.size();
+
+  while ((num_pending_ > 0) && result_socket_) {
+
+    int wait_ms = duration_cast<milliseconds>(t_end -
+                                              steady_clock::now()).count();
+    if (wait_ms <= 0) break;
+
+    result_socket_->setsockopt(ZMQ_RCVTIMEO, &wait_ms, sizeof(wait_ms));
+
+    zmq::message_t msg;
+
+    try {
+
+      if (!result_socket_->recv(&msg)) break;
+
+    } catch (zmq::error_t &err) {
+
+      if (err.num() != EINTR) break;
+      continue;
+    }
+
+    fid_result_msg_t res;
+
+    if (msg.size() != sizeof(res)) continue;
+    memcpy(&res, msg.data(), sizeof(res));
+
+    if (res.magic != kResultMagic) continue;
+
+    int idx = res.probe;
+
+    if ((res.batch != batch_) || (idx >= (int)pending_.size()) ||
+        !pending_[idx]) {
+      ++stats_.late;
+      continue;
+    }
+
+    if (idx < num_probes) {
+      store_fid_result(res.result, event, idx);
+    }
+
+    pending_[idx] = 0;
+    --num_pending_;
+    ++stats_.received;
+  }
+
+  // Whatever did not make it is the caller's now.
+  missing.resize(0);
+
+  for (int idx : outstanding_) {
+
+    if (pending_[idx]) {
+      missing.push_back(idx);
+      pending_[idx] = 0;
+      ++stats_.timed_out;
+    }
+  }
+
+  outstanding_.resize(0);
+  num_pending_ = 0;
+  ++batch_;
+}
+
+FidWorker::FidWorker() : num_served_(0), context_(1)
+{
+}
+
+FidWorker::~FidWorker()
+{
+  Close();
+}
+
+int FidWorker::Connect(const std::string &job_address,
+                       const std::string &result_address)
+{
+  Close();
+
+  try {
+
+    job_socket_.reset(new zmq::socket_t(context_, ZMQ_PULL));
+    init_socket(*job_socket_);
+    job_socket_->connect(job_address.c_str());
+
+    result_socket_.reset(new zmq::socket_t(context_, ZMQ_PUSH));
+    init_socket(*result_socket_);
+    result_socket_->connect(result_address.c_str());
+
+  } catch (zmq::error_t &err) {
+
+    job_socket_.reset();
+    result_socket_.reset();
+    return -1;
+  }
+
+  return 0;
+}
+
+void FidWorker::Close()
+{
+  job_socket_.reset();
+  result_socket_.reset();
+}
+
+bool FidWorker::Serve(int timeout_ms)
+{
+  if (!job_socket_) return false;
+
+  zmq::message_t msg;
+  job_socket_->setsockopt(ZMQ_RCVTIMEO, &timeout_ms, sizeof(timeout_ms));
+
+  try {
+
+    if (!job_socket_->recv(&msg)) return false;
+
+  } catch (zmq::error_t &err) {
+
+    return false;
+  }
+
+  fid_job_header_t h;
+
+  if (msg.size() < sizeof(h)) return false;
+  memcpy(&h, msg.data(), sizeof(h));
+
+  if ((h.magic != kJobMagic) ||
+      (msg.size() != sizeof(h) + h.num_samples * sizeof(float))) {
+    return false;
+  }
+
+  const float *samples = reinterpret_cast<const float *>(
+    static_cast<const char *>(msg.data()) + sizeof(h));
+
+  wf_.assign(samples, samples + h.num_samples);
+
+  fid_result_msg_t res;
+  res.magic = kResultMagic;
+  res.probe = h.probe;
+  res.batch = h.batch;
+
+  analyze_fid(wf_, time_axis(h.dt, h.num_samples), h.use_fast_fids_class,
+              res.result);
+
+  zmq::message_t reply(sizeof(res));
+  memcpy(reply.data(), &res, sizeof(res));
+
+  try {
+
+    result_socket_->send(reply);
+
+  } catch (zmq::error_t &err) {
+
+    return false;
+  }
+
+  ++num_served_;
+  return true;
+}
+
+} // ::g2field
@@ -0,0 +1,133 @@
+#ifndef FIELD_DAQ_FRONTENDS_OBJ_FID_WORKER_POOL_HH_
+#define FIELD_DAQ_FRONTENDS_OBJ_FID_WORKER_POOL_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   fid_worker_pool.hh
+
+  about:  Ships the FID analysis to worker processes over ZMQ, on this
+          host or on others.  The sequencer binds a PUSH socket for the
+          decimated traces and a PULL socket for the results, and any
+          number of fid_worker processes connect to both, so the pool
+          grows by starting more of them.  Each sequence is one batch,
+          collected against a deadline; the probes a worker did not
+          answer in time are left to the local analysis.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+//--- other includes --------------------------------------------------------//
+#include <zmq.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "g2field/core/field_structs.hh"
+
+namespace g2field {
+
+// What the analysis of one FID puts into the event.
+struct fid_result_t {
+  double fid_amp;
+  double fid_snr;
+  double fid_len;
+  double freq;
+  double ferr;
+  double freq_zc;
+  double ferr_zc;
+  uint16_t method;
+  uint16_t health;
+};
+
+// Per-run accounting of the remote analysis.
+struct fid_worker_stats_t {
+  uint64_t sent;       // probes handed to the workers
+  uint64_t received;   // results merged in time
+  uint64_t late;       // results for a batch already collected
+  uint64_t timed_out;  // probes without a result at the deadline
+  uint64_t unsent;     // probes no worker was there to take
+};
+
+// Analyzes the decimated trace wf on the time axis tm, with the fast
+// zero-crossing class or the full fit.
+void analyze_fid(const std::vector<double> &wf, const std::vector<double> &tm,
+                 bool use_fast_fids_class, fid_result_t &res);
+
+// Writes the result of probe idx into the event.
+void store_fid_result(const fid_result_t &res, nmr_vector &event, int idx);
+
+class FidWorkerPool {
+
+ public:
+
+  FidWorkerPool();
+  ~FidWorkerPool();
+
+  // Binds the job and result sockets for the workers to connect to.
+  int Bind(const std::string &job_address, const std::string &result_address);
+
+  void Close();
+
+  // Sends probe idx's decimated trace, sampled every dt, to a worker.
+  // False if none took it, so the caller must analyze it itself.
+  bool Submit(int idx, const std::vector<double> &wf, double dt,
+              bool use_fast_fids_class);
+
+  // Merges the results of this batch into event until all are in or
+  // deadline_ms passed, then starts the next batch.  The probes still
+  // outstanding are left in missing.
+  void Collect(nmr_vector &event, int deadline_ms, std::vector<int> &missing);
+
+  fid_worker_stats_t GetStats() const { return stats_; };
+  void ResetStats() { stats_ = fid_worker_stats_t(); };
+
+ private:
+
+  uint64_t batch_;
+  std::vector<int> outstanding_;
+  std::vector<char> pending_;  // by probe
+  int num_pending_;
+  fid_worker_stats_t stats_;
+
+  zmq::context_t context_;
+  std::unique_ptr<zmq::socket_t> job_socket_;
+  std::unique_ptr<zmq::socket_t> result_socket_;
+};
+
+class FidWorker {
+
+ public:
+
+  FidWorker();
+  ~FidWorker();
+
+  // Connects to a sequencer's job and result sockets.
+  int Connect(const std::string &job_address,
+              const std::string &result_address);
+
+  void Close();
+
+  // Analyzes the next job, waiting up to timeout_ms for one.  False if
+  // none came.
+  bool Serve(int timeout_ms);
+
+  inline uint64_t num_served() const { return num_served_; };
+
+ private:
+
+  uint64_t num_served_;
+  std::vector<double> wf_;
+
+  zmq::context_t context_;
+  std::unique_ptr<zmq::socket_t> job_socket_;
+  std::unique_ptr<zmq::socket_t> result_socket_;
+};
+
+} // ::g2field
+
+#endif
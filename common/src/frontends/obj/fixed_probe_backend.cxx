@@ -0,0 +1,201 @@
+#include "fixed_probe_backend.hh"
+#include "sim_fixed_probe_backend.hh"
+
+//--- std includes ----------------------------------------------------------//
+#include <chrono>
+
+namespace g2field {
+
+namespace {
+const hw::board_id kBoardIds[] = {hw::BOARD_A, hw::BOARD_B,
+                                  hw::BOARD_C, hw::BOARD_D};
+const int kNumBoards = 4;
+
+inline int64_t steady_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(
+    steady_clock::now().time_since_epoch()).count();
+}
+
+// Retries the failed triggers of a group that was just fired.
+int RetryTriggerGroup(FixedProbeBackend *backend,
+                      std::vector<trigger_fire_t> &group, int max_retries)
+{
+  int num_failed = 0;
+
+  for (auto &trg : group) {
+
+    for (int n = 0; (trg.rc > 0) && (n < max_retries); ++n) {
+
+      if (trg.trg_mask < 0) {
+        trg.rc = backend->FireTriggers(trg.trg_idx);
+      } else {
+        trg.rc = backend->FireTriggers(trg.trg_idx, trg.trg_mask);
+      }
+
+      trg.fire_ns = steady_ns();
+    }
+
+    if (trg.rc > 0) ++num_failed;
+  }
+
+  return num_failed;
+}
+}
+
+FixedProbeBackend *FixedProbeBackend::Create(const boost::property_tree::ptree &conf)
+{
+  std::string backend = conf.get<std::string>("backend", "vme");
+
+  if (backend == std::string("vme")) {
+    return new VmeFixedProbeBackend();
+
+  } else if (backend == std::string("sim")) {
+
+    auto sim_conf = conf.get_child_optional("sim");
+
+    if (sim_conf) {
+      return new SimFixedProbeBackend(*sim_conf);
+    } else {
+      return new SimFixedProbeBackend(boost::property_tree::ptree());
+    }
+  }
+
+  return nullptr;
+}
+
+int FixedProbeBackend::FireTriggerGroup(std::vector<trigger_fire_t> &group,
+                                        int max_retries)
+{
+  for (auto &trg : group) {
+
+    if (trg.trg_mask < 0) {
+      trg.rc = FireTriggers(trg.trg_idx);
+    } else {
+      trg.rc = FireTriggers(trg.trg_idx, trg.trg_mask);
+    }
+
+    trg.fire_ns = steady_ns();
+  }
+
+  return RetryTriggerGroup(this, group, max_retries);
+}
+
+VmeFixedProbeBackend::VmeFixedProbeBackend()
+{
+}
+
+VmeFixedProbeBackend::~VmeFixedProbeBackend()
+{
+  FreeDevices();
+}
+
+int VmeFixedProbeBackend::AddDigitizer(const std::string &model,
+                                       const std::string &name,
+                                       const std::string &conf_file)
+{
+  if (model == std::string("sis_3302")) {
+    workers_.PushBack(new hw::Sis3302(name, conf_file, NMR_FID_LENGTH_ONLINE));
+
+  } else if (model == std::string("sis_3316")) {
+    workers_.PushBack(new hw::Sis3316(name, conf_file, NMR_FID_LENGTH_ONLINE));
+
+  } else {
+
+    return -1;
+  }
+
+  return 0;
+}
+
+int VmeFixedProbeBackend::AddTrigger(int board, int port, int trg_mask)
+{
+  if ((board < 0) || (board >= kNumBoards)) {
+    return -1;
+  }
+
+  auto trg = new hw::DioTriggerBoard(0x0, kBoardIds[board], port, false);
+  trg->SetTriggerMask(trg_mask);
+  dio_triggers_.push_back(trg);
+  trg_masks_.push_back(trg_mask);
+  staged_masks_.push_back(trg_mask);
+
+  return 0;
+}
+
+int VmeFixedProbeBackend::AddMux(int board, const std::string &mux_name,
+                                 int port, const std::string &wfd_name,
+                                 int wfd_chan)
+{
+  if ((board < 0) || (board >= kNumBoards)) {
+    return -1;
+  }
+
+  // The controllers are created with the first mux of a run.
+  if (mux_boards_.empty()) {
+    for (int i = 0; i < kNumBoards; ++i) {
+      mux_boards_.push_back(new hw::DioMuxController(0x0, kBoardIds[i], true));
+    }
+  }
+
+  return mux_boards_[board]->AddMux(mux_name, port, false);
+}
+
+void VmeFixedProbeBackend::FreeDevices()
+{
+  workers_.FreeList();
+
+  for (auto &val : mux_boards_) {
+    delete val;
+  }
+
+  for (auto &val : dio_triggers_) {
+    delete val;
+  }
+
+  mux_boards_.resize(0);
+  dio_triggers_.resize(0);
+  trg_masks_.resize(0);
+  staged_masks_.resize(0);
+}
+
+int VmeFixedProbeBackend::SetMux(int board, const std::string &mux_name, int ch)
+{
+  return mux_boards_[board]->SetMux(mux_name, ch);
+}
+
+int VmeFixedProbeBackend::FireTriggers(int trg_idx)
+{
+  return dio_triggers_[trg_idx]->FireTriggers();
+}
+
+int VmeFixedProbeBackend::FireTriggers(int trg_idx, int trg_mask)
+{
+  // The board may keep the mask, restage before the next group.
+  staged_masks_[trg_idx] = -1;
+  return dio_triggers_[trg_idx]->FireTriggers(trg_mask);
+}
+
+int VmeFixedProbeBackend::FireTriggerGroup(std::vector<trigger_fire_t> &group,
+                                           int max_retries)
+{
+  for (auto &trg : group) {
+
+    int mask = (trg.trg_mask < 0) ? trg_masks_[trg.trg_idx] : trg.trg_mask;
+
+    if (staged_masks_[trg.trg_idx] != mask) {
+      dio_triggers_[trg.trg_idx]->SetTriggerMask(mask);
+      staged_masks_[trg.trg_idx] = mask;
+    }
+  }
+
+  for (auto &trg : group) {
+    trg.rc = dio_triggers_[trg.trg_idx]->FireTriggers();
+    trg.fire_ns = steady_ns();
+  }
+
+  return RetryTriggerGroup(this, group, max_retries);
+}
+
+} // ::g2field
@@ -0,0 +1,167 @@
+#ifndef FIELD_DAQ_FRONTENDS_OBJ_FIXED_PROBE_BACKEND_HH_
+#define FIELD_DAQ_FRONTENDS_OBJ_FIXED_PROBE_BACKEND_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   fixed_probe_backend.hh
+
+  about:  The device layer under the FixedProbeSequencer.  It owns the
+          digitizers, multiplexers and pulser triggers, so the sequencer
+          can run against the VME crate or a simulation alike.  The
+          backend is chosen by the "backend" key of the sequencer config.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "g2field/event_manager_base.hh"
+#include "g2field/dio_mux_controller.hh"
+#include "g2field/dio_trigger_board.hh"
+#include "g2field/sis3302.hh"
+#include "g2field/sis3316.hh"
+#include "g2field/core/field_constants.hh"
+
+namespace g2field {
+
+// The readout of one digitizer for one trigger.
+typedef hw::event_data_t::value_type wfd_event_t;
+
+// One trigger of a coalesced group, a negative mask fires the trigger's
+// configured mask.  rc and fire_ns (steady clock) are filled on firing.
+struct trigger_fire_t {
+  int trg_idx;
+  int trg_mask;
+  int rc;
+  int64_t fire_ns;
+};
+
+class FixedProbeBackend {
+
+ public:
+
+  virtual ~FixedProbeBackend() {};
+
+  // Returns the backend named by conf's "backend" key, "vme" by default,
+  // or nullptr for an unknown name.  The caller owns the result.
+  static FixedProbeBackend *Create(const boost::property_tree::ptree &conf);
+
+  virtual std::string name() const = 0;
+
+  // Device setup, boards are indexed 0-3 for DIO boards A-D.
+  virtual int AddDigitizer(const std::string &model,
+                           const std::string &name,
+                           const std::string &conf_file) = 0;
+
+  virtual int AddTrigger(int board, int port, int trg_mask) = 0;
+
+  virtual int AddMux(int board, const std::string &mux_name, int port,
+                     const std::string &wfd_name, int wfd_chan) = 0;
+
+  // Releases all devices, called at the end of a run.
+  virtual void FreeDevices() = 0;
+
+  // Multiplexers and pulser triggers.
+  virtual int SetMux(int board, const std::string &mux_name, int ch) = 0;
+  virtual int num_triggers() const = 0;
+  virtual int FireTriggers(int trg_idx) = 0;
+  virtual int FireTriggers(int trg_idx, int trg_mask) = 0;
+
+  // Fires a group of triggers back to back and only then retries the
+  // failures, so one slow board does not delay the others.  Returns the
+  // number of triggers still failing.
+  virtual int FireTriggerGroup(std::vector<trigger_fire_t> &group,
+                               int max_retries);
+
+  // Digitizers, mirroring hw::WorkerList.
+  virtual void StartRun() = 0;
+  virtual void StopRun() = 0;
+  virtual void StartWorkers() = 0;
+  virtual void StopWorkers() = 0;
+  virtual bool AnyWorkersHaveEvent() = 0;
+  virtual bool AllWorkersHaveEvent() = 0;
+  virtual bool AnyWorkersHaveMultiEvent() = 0;
+  virtual void FlushEventData() = 0;
+  virtual void GetEventData(hw::event_data_t &data) = 0;
+  virtual int GenerateTrigger(int wfd_idx) = 0;
+};
+
+// The multiplexers of one DIO board, as seen by the sequence routing.
+class FixedProbeMuxBoard {
+
+ public:
+
+  FixedProbeMuxBoard(FixedProbeBackend *backend, int board) :
+    backend_(backend), board_(board) {};
+
+  inline int SetMux(const std::string &mux_name, int ch) {
+    return backend_->SetMux(board_, mux_name, ch);
+  };
+
+ private:
+
+  FixedProbeBackend *backend_;
+  int board_;
+};
+
+// The production backend, the sis digitizers and DIO boards in the crate.
+class VmeFixedProbeBackend : public FixedProbeBackend {
+
+ public:
+
+  VmeFixedProbeBackend();
+  ~VmeFixedProbeBackend();
+
+  std::string name() const { return std::string("vme"); };
+
+  int AddDigitizer(const std::string &model,
+                   const std::string &name,
+                   const std::string &conf_file);
+
+  int AddTrigger(int board, int port, int trg_mask);
+
+  int AddMux(int board, const std::string &mux_name, int port,
+             const std::string &wfd_name, int wfd_chan);
+
+  void FreeDevices();
+
+  int SetMux(int board, const std::string &mux_name, int ch);
+  int num_triggers() const { return dio_triggers_.size(); };
+  int FireTriggers(int trg_idx);
+  int FireTriggers(int trg_idx, int trg_mask);
+
+  // Writes any changed masks before the burst, which is then one
+  // register write per board.
+  int FireTriggerGroup(std::vector<trigger_fire_t> &group, int max_retries);
+
+  void StartRun() { workers_.StartRun(); };
+  void StopRun() { workers_.StopRun(); };
+  void StartWorkers() { workers_.StartWorkers(); };
+  void StopWorkers() { workers_.StopWorkers(); };
+  bool AnyWorkersHaveEvent() { return workers_.AnyWorkersHaveEvent(); };
+  bool AllWorkersHaveEvent() { return workers_.AllWorkersHaveEvent(); };
+  bool AnyWorkersHaveMultiEvent() { return workers_.AnyWorkersHaveMultiEvent(); };
+  void FlushEventData() { workers_.FlushEventData(); };
+  void GetEventData(hw::event_data_t &data) { workers_.GetEventData(data); };
+  int GenerateTrigger(int wfd_idx) { return workers_[wfd_idx]->GenerateTrigger(); };
+
+ private:
+
+  hw::WorkerList workers_;
+  std::vector<hw::DioTriggerBoard *> dio_triggers_;
+  std::vector<int> trg_masks_;     // as configured
+  std::vector<int> staged_masks_;  // as last written, -1 if unknown
+  std::vector<hw::DioMuxController *> mux_boards_;
+};
+
+} // ::g2field
+
+#endif
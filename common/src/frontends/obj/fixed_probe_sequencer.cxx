@@ -1,5 +1,13 @@
 #include "fixed_probe_sequencer.hh"
 
+//--- std includes ----------------------------------------------------------//
+#include <cstdio>
+#include <algorithm>
+#include <sstream>
+
+//--- other includes --------------------------------------------------------//
+#include "midas.h"
+
 namespace g2field {
 
 FixedProbeSequencer::FixedProbeSequencer(std::string conf_file, int num_probes) :
@@ -13,33 +21,43 @@ FixedProbeSequencer::FixedProbeSequencer(std::string conf_file, int num_probes)
 
 FixedProbeSequencer::~FixedProbeSequencer()
 {
-  for (auto &val : mux_boards_) {
-     delete val;
-  }
-
-  for (auto &val : dio_triggers_) {
-     delete val;
-  }
 }
 
 int FixedProbeSequencer::Init()
 {
   go_time_ = false;
   thread_live_ = false;
+  parked_ = false;
 
   sequence_in_progress_ = false;
-  builder_has_finished_ = false;
-  mux_round_configured_ = false;
   analyze_fids_online_ = false;
   use_fast_fids_class_ = false;
-  got_software_trg_ = false;
-  got_start_trg_ = false;
+  stream_rounds_ = false;
+  fid_worker_deadline_ms_ = 500;
+  priority_interval_ = 0;
+  prune_after_ = 0;
+  prune_revisit_ = 0;
+  schedule_dirty_ = false;
+  schedule_revisit_ = false;
+  full_rounds_ = 0;
+  plan_sequence_ = false;
+  round_fault_ = false;
+  skip_round_ = false;
+  sequence_count_ = 0;
+
+  builder_has_finished_.Clear();
+  mux_round_configured_.Clear();
+  got_software_trg_.Clear();
+  got_start_trg_.Clear();
+  got_round_data_.Clear();
+  data_ready_.Clear();
 
   // Change the logfile if there is one in the config.
   boost::property_tree::ptree conf;
   boost::property_tree::read_json(conf_file_, conf);
   SetLogfile(conf.get<std::string>("output.logfile", logfile_));
   SetVerbosity(conf.get<int>("output.verbosity", logging_verbosity_));
+  return 0;
 }
 
 int FixedProbeSequencer::BeginOfRun()
@@ -56,24 +74,19 @@ int FixedProbeSequencer::BeginOfRun()
 
   // First set the config-dir if there is one.
   hw::conf_dir = conf.get<std::string>("config_dir", hw::conf_dir);
-  fid_analysis_ = conf.get<std::string>("config.fid_analysis", "");
-  analyze_fids_online_ = conf.get<bool>("analyze_fids_online", false);
-  use_fast_fids_class_ = conf.get<bool>("use_fast_fids_class", false);
-
-  generate_software_triggers_ = 
-    conf.get<bool>("generate_software_triggers", false);
-
-  if (fid_analysis_ != std::string("")) {
-
-    if ((fid_analysis_[0] != '/') && (fid_analysis_[0] != '\\')) {
-      fid::load_params(hw::conf_dir + fid_analysis_);
+  LoadFidParams(conf);
 
-    } else {
+  // Bring up the device layer, the VME crate unless configured otherwise.
+  backend_.reset(FixedProbeBackend::Create(conf));
 
-      fid::load_params(fid_analysis_);
-    }
+  if (!backend_) {
+    LogError("unknown backend: %s",
+             conf.get<std::string>("backend", "").c_str());
+    return -1;
   }
 
+  LogMessage("using the %s backend", backend_->name().c_str());
+
   int sis_idx = 0;
   for (auto &v : conf.get_child("devices.sis_3302")) {
 
@@ -87,9 +100,7 @@ int FixedProbeSequencer::BeginOfRun()
     sis_idx_map_[name] = sis_idx++;
 
     LogDebug("loading hw: %s, %s", name.c_str(), dev_conf_file.c_str());
-    workers_.PushBack(new hw::Sis3302(name, 
-  				      dev_conf_file, 
-  				      NMR_FID_LENGTH_ONLINE));
+    backend_->AddDigitizer("sis_3302", name, dev_conf_file);
   }
 
   for (auto &v : conf.get_child("devices.sis_3316")) {
@@ -104,99 +115,58 @@ int FixedProbeSequencer::BeginOfRun()
     sis_idx_map_[name] = sis_idx++;
 
     LogDebug("loading hw: %s, %s", name.c_str(), dev_conf_file.c_str());
-    workers_.PushBack(new hw::Sis3316(name, 
-   				      dev_conf_file, 
-   				      NMR_FID_LENGTH_ONLINE));
+    backend_->AddDigitizer("sis_3316", name, dev_conf_file);
   }
 
   // Set up the NMR pulser triggers
-  dio_triggers_.resize(0);
-
   for (auto &v : conf.get_child("devices.dio_triggers")) {
     
     char bid = v.second.get<char>("dio_board_id");
     int port = v.second.get<int>("dio_port_num");
     int trg_mask = v.second.get<int>("dio_trg_mask");
+    int board = 3;
 
     switch (bid) {
       case 'a':
 	LogDebug("setting NMR pulser trigger on dio board A, port %i", port);
-	dio_triggers_.push_back(new hw::DioTriggerBoard(0x0, hw::BOARD_A, port, false));
+	board = 0;
 	break;
 	
       case 'b':
 	LogDebug("setting NMR pulser trigger on dio board B, port %i", port);
-	dio_triggers_.push_back(new hw::DioTriggerBoard(0x0, hw::BOARD_B, port, false));
+	board = 1;
 	break;
       
       case 'c':
 	LogDebug("setting NMR pulser trigger on dio board C, port %i", port);
-	dio_triggers_.push_back(new hw::DioTriggerBoard(0x0, hw::BOARD_C, port, false));
+	board = 2;
 	break;
 
       default:
 	LogDebug("setting NMR pulser trigger on dio board D, port %i", port);
-	dio_triggers_.push_back(new hw::DioTriggerBoard(0x0, hw::BOARD_D, port, false));
+	board = 3;
 	break;
     }
 
-    // Set the trigger mask.
-    (*(dio_triggers_.end() - 1))->SetTriggerMask(trg_mask);
+    // Add the trigger with its mask.
+    backend_->AddTrigger(board, port, trg_mask);
   }
 
-  min_event_time_ = conf.get<int>("min_event_time", 1000);
-  max_event_time_ = conf.get<int>("max_event_time", 10000);
-  mux_switch_time_ = conf.get<int>("mux_switch_time", 15000);
-
-  mux_sequence_ = conf.get<std::string>("config.mux_sequence");
-
-  if (mux_sequence_[0] != '/') {
-    mux_sequence_ = hw::conf_dir + 
-      conf.get<std::string>("config.mux_sequence");
-  }
+  LoadTunables(conf);
+  LoadQueues(conf);
+  LoadSequence(conf);
 
-  mux_connections_ = conf.get<std::string>("config.mux_connections");
+  mux_handles_.clear();
+  mux_boards_.resize(0);
 
-  if (mux_connections_[0] != '/') {
-    mux_connections_ = hw::conf_dir + 
-      conf.get<std::string>("config.mux_connections");
+  for (int i = 0; i < 4; ++i) {
+    mux_handles_.push_back(FixedProbeMuxBoard(backend_.get(), i));
   }
 
-  // Load trigger sequence
-  LogMessage("loading trigger sequence from %s", mux_sequence_.c_str());
-  boost::property_tree::read_json(mux_sequence_, conf);
-
-  for (auto &mux : conf) {
-
-    int count = 0;
-    // std::cout << "load mux: " << mux.first << ", " << std::endl;
-    // boost::property_tree::write_json(std::cout, mux.second);
-
-    for (auto &chan : mux.second) {
-
-      // If we are adding a new mux, resize.
-      if (trg_seq_.size() <= count) {
-	trg_seq_.resize(count + 1);
-      }
-
-      // Map the multiplexer configuration.
-      int ch = std::stoi(chan.first.substr(3)); // skip 'ch_'
-      std::pair<std::string, int> trg(mux.first, ch);
-      trg_seq_[count++].push_back(trg);
-
-      // Map the data type and array index.
-      int idx = std::stoi(chan.second.data());
-      std::pair<std::string, int> loc(chan.first, idx);
-      data_out_[trg] = loc;
-    }
+  for (auto &board : mux_handles_) {
+    mux_boards_.push_back(&board);
   }
 
-  mux_boards_.resize(0);
-  mux_boards_.push_back(new hw::DioMuxController(0x0, hw::BOARD_A, true));
-  mux_boards_.push_back(new hw::DioMuxController(0x0, hw::BOARD_B, true));
-  mux_boards_.push_back(new hw::DioMuxController(0x0, hw::BOARD_C, true));
-  mux_boards_.push_back(new hw::DioMuxController(0x0, hw::BOARD_D, true));
-
   std::map<char, int> bid_map;
   bid_map['a'] = 0;
   bid_map['b'] = 1;
@@ -204,22 +174,47 @@ int FixedProbeSequencer::BeginOfRun()
   bid_map['d'] = 3;
 
   // Load the data channel/mux maps
-  boost::property_tree::read_json(mux_connections_, conf);
-  for (auto &mux : conf) {
+  boost::property_tree::ptree mux_conf;
+  boost::property_tree::read_json(mux_connections_, mux_conf);
+
+  for (auto &mux : mux_conf) {
     char bid = mux.second.get<char>("dio_board_id");
     std::string mux_name(mux.first);
     int port = mux.second.get<int>("dio_port_num");
 
-    mux_idx_map_[mux_name] = bid_map[bid];
-    mux_boards_[mux_idx_map_[mux_name]]->AddMux(mux_name, port, false);
-
     std::string wfd_name(mux.second.get<std::string>("wfd_name"));
     int wfd_chan(mux.second.get<int>("wfd_chan"));
     std::pair<std::string, int> data_map(wfd_name, wfd_chan);
 
+    mux_idx_map_[mux_name] = bid_map[bid];
+    backend_->AddMux(bid_map[bid], mux_name, port, wfd_name, wfd_chan);
+
     data_in_[mux.first] = data_map;
   }
 
+  PlanSequence();
+  CompileRouting();
+
+  // Digitizers driven directly in software trigger mode.
+  wfd_3316_idx_ = sis_idx_map_.count("sis_3316_0") ? sis_idx_map_["sis_3316_0"] : 0;
+  wfd_3302_idx_ = sis_idx_map_.count("sis_3302_0") ? sis_idx_map_["sis_3302_0"] : 0;
+
+  // Time axis of the spike-skipped traces used by the FID analysis.
+  fid_tm_ = &time_axis(NMR_SAMPLE_PERIOD * 2, NMR_FID_LENGTH_ONLINE / 2);
+
+  StartAnalysisPool();
+  StartFidWorkers();
+
+  // Remember what was applied, for Reconfigure to diff against.
+  TakeSnapshot(conf, applied_);
+
+  timing_.Reset();
+  round_fire_ns_ = 0;
+  sequence_count_ = 0;
+
+  // Nothing to build yet, so the builder must not queue an empty event.
+  builder_has_finished_.Set();
+
   // Start threads
   thread_live_ = true;
   run_thread_ = std::thread(&FixedProbeSequencer::RunLoop, this);
@@ -229,339 +224,1556 @@ int FixedProbeSequencer::BeginOfRun()
 
   go_time_ = true;
   LogMessage("Starting workers");
-  workers_.StartRun();
+  backend_->StartRun();
 
   usleep(5000);
 
   // Pop stale events
-  while (workers_.AnyWorkersHaveEvent()) {
-    workers_.FlushEventData();
+  while (backend_->AnyWorkersHaveEvent()) {
+    backend_->FlushEventData();
   }
 
   LogDebug("configuration loaded");
+  return 0;
 }
 
-int FixedProbeSequencer::EndOfRun()
+int FixedProbeSequencer::Reconfigure(std::string conf_file)
 {
-  int count = 0;
-  do {
-    usleep(1000);
-  } while (sequence_in_progress_ && (count++ < 200));
+  // Nothing running yet, so there is nothing to keep.
+  if (!backend_ || !thread_live_) {
+    conf_file_ = conf_file;
+    Init();
+    return BeginOfRun();
+  }
 
-  go_time_ = false;
-  thread_live_ = false;
+  auto t0 = std::chrono::steady_clock::now();
 
-  workers_.StopRun();
+  boost::property_tree::ptree conf;
+  boost::property_tree::read_json(conf_file, conf);
 
-  LogDebug("EndOfRun: joining threads");
-  if (run_thread_.joinable()) {
-    run_thread_.join();
-  }
+  conf_snapshot_t snap;
+  TakeSnapshot(conf, snap);
 
-  if (trigger_thread_.joinable()) {
-    trigger_thread_.join();
+  // New devices, wiring or digitizer settings need the full teardown.
+  if ((snap.layout != applied_.layout) ||
+      (snap.digitizers != applied_.digitizers)) {
+    LogMessage("Reconfigure: hardware layout changed, restarting");
+
+    EndOfRun();
+    conf_file_ = conf_file;
+    Init();
+    return BeginOfRun();
   }
 
-  if (builder_thread_.joinable()) {
-    builder_thread_.join();
+  LogMessage("Reconfigure: applying %s", conf_file.c_str());
+
+  // Normally parked at the end of the last run already.
+  ParkRun();
+  conf_file_ = conf_file;
+
+  if (snap.fid_params != applied_.fid_params) {
+    LogMessage("Reconfigure: reloading FID parameters");
+    LoadFidParams(conf);
   }
 
-  if (starter_thread_.joinable()) {
-    starter_thread_.join();
+  int num_fid_threads = num_fid_threads_;
+  auto fid_job_address = fid_job_address_;
+  auto fid_result_address = fid_result_address_;
+
+  LoadTunables(conf);
+
+  if (snap.sequence != applied_.sequence) {
+    LogMessage("Reconfigure: reloading the mux sequence");
+    LoadSequence(conf);
   }
 
-  workers_.FreeList();
+  // Cheap, and picks up planning, pipelining and priority changes too.
+  PlanSequence();
+  CompileRouting();
 
-  mux_idx_map_.clear();
-  sis_idx_map_.clear();
-  trg_seq_.resize(0);
+  if (snap.queues != applied_.queues) {
+    LogMessage("Reconfigure: resizing the event queues");
+    LoadQueues(conf);
 
-  queue_mutex_.lock();
-  data_out_.clear();
+  } else {
 
-  while (!data_queue_.empty()) {
-    data_queue_.pop();
+    data_ring_.Clear();
+    data_ring_.ResetStats();
+    run_queue_.Clear();
+    run_queue_.ResetStats();
   }
 
-  while (!run_queue_.empty()) {
-    run_queue_.pop();
+  if (num_fid_threads_ != num_fid_threads) {
+    StartAnalysisPool();
   }
-  queue_mutex_.unlock();
 
-  return 0;
-}
+  if ((fid_job_address_ != fid_job_address) ||
+      (fid_result_address_ != fid_result_address)) {
+    StartFidWorkers();
 
-int FixedProbeSequencer::ResizeEventData(hw::event_data_t &data)
-{
-  return 0;
-}
+  } else if (fid_workers_) {
 
-void FixedProbeSequencer::RunLoop()
-{
-  while (thread_live_) {
+    fid_workers_->ResetStats();
+  }
 
-    while (go_time_ && !generate_software_triggers_) {
+  applied_ = snap;
 
-      if (workers_.AnyWorkersHaveEvent()) {
+  // A fresh run from here on.
+  has_event_ = false;
+  timing_.Reset();
+  round_fire_ns_ = 0;
+  sequence_count_ = 0;
 
-        LogDebug("RunLoop: got potential event");
+  got_software_trg_.Clear();
+  got_start_trg_.Clear();
+  mux_round_configured_.Clear();
+  data_ready_.Clear();
+  got_round_data_.Clear();
+  builder_has_finished_.Set();
 
-        // Wait to be sure the others have events too.
-	int count = 0;
+  go_time_ = true;
+  parked_ = false;
+  backend_->StartRun();
 
-	while (count++ * 500 < min_event_time_) {
-	  usleep(500);
-	}
-	
-	LogDebug("RunLoop: slept minimum");
+  usleep(5000);
 
-	while (!workers_.AllWorkersHaveEvent() &&
-	       (count++ * 500 < max_event_time_)) {
-	  usleep(500);
-	  LogDump("RunLoop: sleep check");
-	}
-	
-	LogDebug("RunLoop: slept max");
+  while (backend_->AnyWorkersHaveEvent()) {
+    backend_->FlushEventData();
+  }
 
-        if (!workers_.AllWorkersHaveEvent()) {
+  LogMessage("Reconfigure: done in %.1f ms", 1e-3 *
+             std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - t0).count());
 
-          LogWarning("event was not synchronized among all workers, dropping");
-          workers_.FlushEventData();
-          continue;
+  return 0;
+}
 
-        } else if (workers_.AnyWorkersHaveMultiEvent()) {
+void FixedProbeSequencer::LoadFidParams(const boost::property_tree::ptree &conf)
+{
+  fid_analysis_ = conf.get<std::string>("config.fid_analysis", "");
 
-          LogWarning("two events detected among some workers, dropping");
-          workers_.FlushEventData();
-          continue;
-        }
+  if (fid_analysis_ != std::string("")) {
 
-        hw::event_data_t bundle;
-        workers_.GetEventData(bundle);
+    if ((fid_analysis_[0] != '/') && (fid_analysis_[0] != '\\')) {
+      fid::load_params(hw::conf_dir + fid_analysis_);
 
-	LogDebug("RunLoop: copying data bundle");
+    } else {
 
-        queue_mutex_.lock();
-        if (data_queue_.size() <= kMaxQueueSize) {
-          data_queue_.push(bundle);
+      fid::load_params(fid_analysis_);
+    }
+  }
+}
 
-          LogDebug("RunLoop: Got data. Data queue now: %i",
-                   data_queue_.size());
-        }
+void FixedProbeSequencer::LoadTunables(const boost::property_tree::ptree &conf)
+{
+  analyze_fids_online_ = conf.get<bool>("analyze_fids_online", false);
+  use_fast_fids_class_ = conf.get<bool>("use_fast_fids_class", false);
 
-	
+  generate_software_triggers_ = 
+    conf.get<bool>("generate_software_triggers", false);
 
-        queue_mutex_.unlock();
-      }
-      
-      ThreadSleepLong();
-    }
+  stream_rounds_ = conf.get<bool>("stream_rounds", false);
+  priority_interval_ = conf.get<int>("priority_interval", 0);
 
-    ThreadSleepLong();
+  // The sub-sequence is only seen through the streamed rounds.
+  if ((priority_interval_ > 0) && !stream_rounds_) {
+    LogWarning("priority_interval needs stream_rounds, ignoring it");
+    priority_interval_ = 0;
   }
-}
 
-void FixedProbeSequencer::TriggerLoop()
-{
-  while (thread_live_) {
+  // Probes from the config override the ones set by SetPriorityProbes.
+  auto probes = conf.get_optional<std::string>("priority_probes");
 
-    while (go_time_) {
+  if (probes) {
+    std::istringstream ss(*probes);
+    std::string probe;
 
-      if (got_start_trg_) {
+    priority_probes_.resize(0);
+    while (std::getline(ss, probe, ',')) {
+      if (!probe.empty()) priority_probes_.push_back(std::stoi(probe));
+    }
+  }
 
-	sequence_in_progress_ = true;
-	builder_has_finished_ = false;
-	mux_round_configured_ = false;
+  round_timeout_us_ = conf.get<int>("round_timeout_us", 1000000);
+  round_retries_ = conf.get<int>("round_retries", 2);
+  trigger_retries_ = conf.get<int>("trigger_retries", 5);
+  coalesce_triggers_ = conf.get<bool>("coalesce_triggers", true);
+  round_fault_ = false;
+  skip_round_ = false;
 
-	LogMessage("TriggerLoop: received trigger, sequencing multiplexers");
+  {
+    std::lock_guard<std::mutex> lock(fault_mutex_);
+    faults_ = round_fault_stats_t();
+  }
 
-	for (auto &round : trg_seq_) { // {mux_conf_0...mux_conf_n}
-	  if (!go_time_) break;
+  shots_per_round_ = conf.get<int>("shots_per_round", 1);
 
-	  got_round_data_ = false;
-	  mux_round_configured_ = false;
+  if ((shots_per_round_ < 1) ||
+      (shots_per_round_ > TraceAccumulator::kMaxShots)) {
+    LogWarning("shots_per_round = %i out of range, using 1", shots_per_round_);
+    shots_per_round_ = 1;
+  }
 
-	  for (auto &conf : round) { // {mux_name, set_channel}
-	    if (!go_time_) break;
+  // Sized as the probes are first averaged.
+  fid_avg_.assign(num_probes_, std::vector<float>());
+
+  plan_sequence_ = conf.get<bool>("plan_sequence", false);
+  round_overhead_us_ = conf.get<int>("round_overhead_us", 20000);
+
+  // Zero turns the pruning off.  Every run starts with all probes in.
+  prune_after_ = conf.get<int>("prune_after", 0);
+  prune_revisit_ = conf.get<int>("prune_revisit", 10);
+  prune_health_min_ = conf.get<double>("prune_health_min", 10.0);
+
+  fail_count_.assign(num_probes_, 0);
+  demoted_.assign(num_probes_, 0);
+  measured_.assign(num_probes_, 0);
+  schedule_dirty_ = false;
+  rounds_skipped_ = 0;
+  demotions_ = 0;
+  recoveries_ = 0;
+
+  num_fid_threads_ = conf.get<int>("fid_analysis_threads", 0);
+  fid_job_address_ = conf.get<std::string>("fid_workers.job_address", "");
+  fid_result_address_ = conf.get<std::string>("fid_workers.result_address", "");
+  fid_worker_deadline_ms_ = conf.get<int>("fid_workers.deadline_ms", 500);
+  max_event_time_ = conf.get<int>("max_event_time", 10000);
+  gather_poll_time_ = conf.get<int>("gather_poll_time", 50);
+  mux_switch_time_ = conf.get<int>("mux_switch_time", 15000);
 
-	    LogDebug(std::string("TriggerLoop: setting ") +
-		     conf.first + std::string(" to ") +
-		     std::to_string(conf.second));
+  // GPS time comes from the shared clock model, never from a fork here.
+  GpsClock::Instance().Start(conf.get<std::string>("gps_clock.cmd",
+                                                   "/usr/bin/mbgfasttstamp"),
+                             conf.get<int>("gps_clock.period_ms", 1000),
+                             conf.get<int>("gps_clock.window", 16));
+  pipeline_mux_switching_ = conf.get<bool>("pipeline_mux_switching", false);
+}
 
-	    auto mux_board = mux_boards_[mux_idx_map_[conf.first]];
-	    mux_board->SetMux(conf.first, conf.second);
-	  }
+void FixedProbeSequencer::LoadQueues(const boost::property_tree::ptree &conf)
+{
+  // Preallocate the queues, data slots are primed by the first event.
+  data_queue_size_ = conf.get<int>("data_queue_size", kMaxQueueSize);
+  run_queue_size_ = conf.get<int>("run_queue_size", 4);
+
+  auto data_policy = parse_queue_policy(
+    conf.get<std::string>("data_queue_policy", "drop_newest"),
+    QueuePolicy::kDropNewest);
+
+  // The builder files the bundles of a sequence by arrival order, so
+  // dropping an older one would shift every later round onto the wrong
+  // probes.  Only the newest can be dropped or the readout blocked.
+  if (data_policy == QueuePolicy::kDropOldest) {
+    LogWarning("data_queue_policy drop_oldest would mislabel rounds, "
+               "using drop_newest");
+    data_policy = QueuePolicy::kDropNewest;
+  }
 
-      	  LogDebug("TriggerLoop: muxes are configured for this round");
-          usleep(mux_switch_time_);
+  auto run_policy = parse_queue_policy(
+    conf.get<std::string>("run_queue_policy", "drop_newest"),
+    QueuePolicy::kDropNewest);
 
-	  if (generate_software_triggers_) {
+  LogMessage("data queue: %i slots, %s; run queue: %i slots, %s",
+             data_queue_size_, queue_policy_name(data_policy),
+             run_queue_size_, queue_policy_name(run_policy));
 
-	    // Pause workers.
-	    workers_.StopWorkers();
-	    hw::wait_ns(hw::short_sleep * 2);
-	    
-	    // Fire triggers and get waveforms on 3316.
-	    int idx = sis_idx_map_["sis_3316_0"];
-	    auto wfd_3316 = workers_[idx];
-	    
-	    idx = sis_idx_map_["sis_3302_0"];
-	    auto wfd_3302 = workers_[idx];
+  {
+    nmr_vector proto;
+    proto.Resize(num_probes_);
 
-	    // Trigger the 3316 and relevant pulser modules.
-	    while (wfd_3316->GenerateTrigger() != 0) usleep(10000);
-	    dio_triggers_[1]->FireTriggers(0xff);
-	    dio_triggers_[2]->FireTriggers(0xff);
+    data_ring_.Reset(data_queue_size_, hw::event_data_t(), data_policy);
+    run_queue_.Reset(run_queue_size_, proto, run_policy);
+    builder_event_ = proto;
 
-	    // Trigger the 3302 and pulse the relevant NMR pulsers.
-	    while (wfd_3302->GenerateTrigger() != 0) usleep(10000);
-	    hw::wait_ns(0.5e6);
-	    dio_triggers_[3]->FireTriggers(0x0f);
+    // One buffer for the readout to hold, one spare.
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    while (event_store_.size() < 2) {
+      event_store_.push_back(std::unique_ptr<nmr_vector>(new nmr_vector(proto)));
+      event_pool_.push_back(event_store_.back().get());
+    }
+  }
+}
 
-	    workers_.StartWorkers();
-	    hw::wait_ns(100e6);
-	  
-	    while (!workers_.AllWorkersHaveEvent()) usleep(500);
+void FixedProbeSequencer::LoadSequence(const boost::property_tree::ptree &conf)
+{
+  mux_sequence_ = conf.get<std::string>("config.mux_sequence");
 
-	    hw::event_data_t bundle;
-	    workers_.GetEventData(bundle);
-	    hw::wait_ns(hw::short_sleep * 2);
-	    
-	    queue_mutex_.lock();
-	    if (data_queue_.size() <= kMaxQueueSize) {
-	      data_queue_.push(bundle);
-	      
-	      LogDebug("RunLoop: Got data. Data queue now: %i",
-		       data_queue_.size());
-	    }
-	    queue_mutex_.unlock();
-	    
-	  } else {
-	    
-	    LogDebug("Generated DIO triggers");
-	    int trg_count = 0;
-	    
-	    for (auto &trg : dio_triggers_) {
+  if (mux_sequence_[0] != '/') {
+    mux_sequence_ = hw::conf_dir + 
+      conf.get<std::string>("config.mux_sequence");
+  }
+
+  mux_connections_ = conf.get<std::string>("config.mux_connections");
+
+  if (mux_connections_[0] != '/') {
+    mux_connections_ = hw::conf_dir + 
+      conf.get<std::string>("config.mux_connections");
+  }
 
-	      int rc = trg->FireTriggers();
+  // Load trigger sequence
+  LogMessage("loading trigger sequence from %s", mux_sequence_.c_str());
 
-	      LogDebug("Trigger %i fired", trg_count);
+  boost::property_tree::ptree seq_conf;
+  boost::property_tree::read_json(mux_sequence_, seq_conf);
 
-	      while (rc > 0) {
-		LogError("Trigger %i failed with rc = %i", trg_count, rc);
-	       	rc = trg->FireTriggers();
-	       	LogMessage("Trigger %i re-fired", trg_count);
-	      }
-	      ++trg_count;
-	    }
-	  }
-	  
-	  LogDebug("TriggerLoop: muxes configured, triggers fired");
-	  mux_round_configured_ = true;
-	  
-	  uint count = 0;
+  configured_seq_.resize(0);
+  data_out_.clear();
 
-	  while (!got_round_data_ && go_time_) {
-	    
-	    // If one second passes, flush and re-trigger.
-	    if (count++ * hw::short_sleep > 1e6) {
+  for (auto &mux : seq_conf) {
 
-	      workers_.FlushEventData();
+    int count = 0;
+    // std::cout << "load mux: " << mux.first << ", " << std::endl;
+    // boost::property_tree::write_json(std::cout, mux.second);
 
-	      for (auto &trg : dio_triggers_) {
-		trg->FireTriggers();
-	      }
+    for (auto &chan : mux.second) {
 
-	      count = 0;
-	    }
-	    
-	    ThreadSleepShort();
-	  };
-	  
-	} // on to the next round
+      // If we are adding a new mux, resize.
+      if (configured_seq_.size() <= count) {
+	configured_seq_.resize(count + 1);
+      }
 
-	sequence_in_progress_ = false;
-	got_start_trg_ = false;
+      // Map the multiplexer configuration.
+      int ch = std::stoi(chan.first.substr(3)); // skip 'ch_'
+      std::pair<std::string, int> trg(mux.first, ch);
+      configured_seq_[count++].push_back(trg);
 
-	LogDebug("TriggerLoop: waiting for builder to finish");
-	
-	while (!builder_has_finished_ && go_time_) {
-	  ThreadSleepShort();
-	};
-	
-	LogDebug("TriggerLoop: builder finished packing event");
-	ThreadSleepShort();
-	
-      } // done with trigger sequence
+      // Map the data type and array index.
+      int idx = std::stoi(chan.second.data());
+      std::pair<std::string, int> loc(chan.first, idx);
+      data_out_[trg] = loc;
     }
-
-    ThreadSleepLong();
   }
 }
 
-void FixedProbeSequencer::BuilderLoop()
+void FixedProbeSequencer::PlanSequence()
 {
-  using namespace std::chrono;
+  planner_.SetTopology(data_in_);
+  auto plan = planner_.Plan(configured_seq_);
+
+  int num_transitions = planner_.CountTransitions(configured_seq_);
+  int num_conflicts = planner_.CountConflicts(configured_seq_);
+  double t_conf = SequencePlanner::PredictDuration(
+    configured_seq_.size(), mux_switch_time_,
+    shots_per_round_ * round_overhead_us_);
+  double t_plan = SequencePlanner::PredictDuration(
+    plan.rounds.size(), mux_switch_time_,
+    shots_per_round_ * round_overhead_us_);
+
+  LogMessage("sequence planner: configured %i rounds, %i transitions, "
+             "%.0f ms; planned %i rounds, %i transitions, %.0f ms",
+             (int)configured_seq_.size(), num_transitions, 1e-3 * t_conf,
+             (int)plan.rounds.size(), plan.transitions, 1e-3 * t_plan);
+
+  if (num_conflicts > 0) {
+    LogWarning("sequence planner: %i channels of the configured sequence "
+               "share a mux or digitizer channel within a round",
+               num_conflicts);
+  }
 
-  LogDebug("BuilderLoop: launched");
+  // Only take the plan if it is an improvement.
+  bool better = (num_conflicts > 0) ||
+    (plan.rounds.size() < configured_seq_.size()) ||
+    ((plan.rounds.size() == configured_seq_.size()) &&
+     (plan.transitions < num_transitions));
 
-  std::vector<double> tm(NMR_FID_LENGTH_ONLINE / 2, 0.0);
-  std::vector<double> wf(NMR_FID_LENGTH_ONLINE / 2, 0.0);
-  std::vector<int> indices;
+  if (plan_sequence_ && better) {
+    LogMessage("sequence planner: running the planned sequence");
+    trg_seq_ = plan.rounds;
 
-  for (int i = 0; i < NMR_FID_LENGTH_ONLINE / 2; ++i) {
-    tm[i] = i * NMR_SAMPLE_PERIOD * 2;
+  } else {
+
+    trg_seq_ = configured_seq_;
   }
+}
 
-  while (thread_live_) {
+bool FixedProbeSequencer::BuildSchedule(bool revisit)
+{
+  auto last_schedule = schedule_;
+  auto last_flags = round_flags_;
 
-    while (go_time_) {
+  schedule_.resize(0);
+  round_flags_.resize(0);
 
-      static nmr_vector bundle;
-      if (bundle.clock_sys_ns.size() < num_probes_) bundle.Resize(num_probes_);
+  int num_sub_rounds = InterleavePriority(trg_seq_, schedule_, round_flags_);
+  full_rounds_ = schedule_.size();
 
-      static hw::event_data_t data;
-      int seq_index = 0;
+  int num_demoted = std::count(demoted_.begin(), demoted_.end(), 1);
 
-      if (sequence_in_progress_) {
-        LogMessage("BuilderLoop: beginning a new event");
-      }
+  if (!revisit && (num_demoted > 0)) {
+    PackActiveProbes(num_demoted);
+  }
 
-      while (sequence_in_progress_ && go_time_) {
+  if ((schedule_ == last_schedule) && (round_flags_ == last_flags)) {
+    return false;
+  }
 
-        if (mux_round_configured_) {
+  if (num_sub_rounds > 0) {
+    LogMessage("priority sub-sequence: %i probes in %i rounds, "
+               "every %i rounds, %i rounds per sequence",
+               (int)priority_probes_.size(), num_sub_rounds,
+               priority_interval_, (int)schedule_.size());
+  }
 
-          queue_mutex_.lock();
+  return true;
+}
 
-          if (data_queue_.empty()) {
+void FixedProbeSequencer::PackActiveProbes(int num_demoted)
+{
+  // Plan the channels that are left into as few rounds as possible.
+  std::vector<std::vector<std::pair<std::string, int>>> active;
 
-            queue_mutex_.unlock();
+  for (auto &round : trg_seq_) {
 
-          } else {
+    active.push_back(std::vector<std::pair<std::string, int>>());
 
-            // Get the time as close to readout as we can.
-            auto gps_clock = parse_mbg_string_ns();
+    for (auto &trg : round) {
 
-            // Grab the data itself.
-            data = data_queue_.front();
-            data_queue_.pop();
-            queue_mutex_.unlock();
+      auto out_it = data_out_.find(trg);
+      int idx = (out_it != data_out_.end()) ? out_it->second.second : -1;
 
-            LogDebug("BuilderLoop: copying data");
+      if ((idx >= 0) && (idx < num_probes_) && demoted_[idx]) continue;
 
-            for (auto &pair : trg_seq_[seq_index]) {
+      active.back().push_back(trg);
+    }
+  }
+
+  auto packed = planner_.Plan(active).rounds;
+
+  // Nothing left to measure, keep running everything.
+  if (packed.empty()) return;
+
+  schedule_.resize(0);
+  round_flags_.resize(0);
+  InterleavePriority(packed, schedule_, round_flags_);
+
+  LogMessage("pruning: %i probes demoted, %i of %i rounds per sequence",
+             num_demoted, (int)schedule_.size(), full_rounds_);
+}
+
+int FixedProbeSequencer::InterleavePriority(
+  const std::vector<std::vector<std::pair<std::string, int>>> &base,
+  std::vector<std::vector<std::pair<std::string, int>>> &schedule,
+  std::vector<uint32_t> &flags)
+{
+  // The feedback channels of each round, in sequence order.
+  std::set<int> priority(priority_probes_.begin(), priority_probes_.end());
+  std::vector<std::vector<std::pair<std::string, int>>> sub_seq;
+
+  if (priority_interval_ > 0) {
+    for (auto &round : base) {
+
+      std::vector<std::pair<std::string, int>> chans;
+
+      for (auto &trg : round) {
+        auto it = data_out_.find(trg);
+
+        if ((it != data_out_.end()) && priority.count(it->second.second)) {
+          chans.push_back(trg);
+        }
+      }
+
+      if (!chans.empty()) sub_seq.push_back(chans);
+    }
+  }
+
+  // Run the sub-sequence after every priority_interval_ full rounds.
+  for (int r = 0; r < (int)base.size(); ++r) {
+
+    schedule.push_back(base[r]);
+    flags.push_back(0);
+
+    if (sub_seq.empty() || ((r + 1) % priority_interval_ != 0) ||
+        (r + 1 == (int)base.size())) continue;
+
+    for (auto &round : sub_seq) {
+      schedule.push_back(round);
+      flags.push_back(fixed_round_t::kPriority);
+    }
+
+    flags.back() |= fixed_round_t::kSubsequenceEnd;
+  }
+
+  return sub_seq.size();
+}
+
+void FixedProbeSequencer::CompileRouting(bool revisit)
+{
+  bool changed = BuildSchedule(revisit);
+  schedule_revisit_ = revisit;
+
+  // Resolve the schedule into flat per-round routes.
+  int num_unresolved = routing_.Compile(schedule_, mux_boards_, mux_idx_map_,
+                                        sis_idx_map_, data_in_, data_out_);
+
+  if (num_unresolved > 0) {
+    LogWarning("%i mux channels in the sequence could not be routed",
+               num_unresolved);
+  }
+
+  if (changed) {
+    LogMessage("compiled %i routes in %i rounds",
+               routing_.num_routes(), routing_.num_rounds());
+  }
+
+  if (pipeline_mux_switching_) {
+    int num_prestaged = routing_.ComputePrestage();
+
+    if (changed) {
+      LogMessage("pipelined mux switching: %i of %i routes pre-staged",
+                 num_prestaged, routing_.num_routes());
+    }
+  }
+}
+
+void FixedProbeSequencer::StartAnalysisPool()
+{
+  analysis_pool_.reset();
+
+  // Spin up the analysis workers, zero keeps analysis in BuilderLoop.
+  if (num_fid_threads_ > 0) {
+    auto job = [this](int idx, std::vector<double> &wf) {
+      AnalyzeFid(builder_event_, idx, wf);
+    };
+
+    LogMessage("launching %i FID analysis threads", num_fid_threads_);
+    analysis_pool_.reset(new FidAnalysisPool(num_fid_threads_,
+                                             NMR_FID_LENGTH_ONLINE / 2,
+                                             job));
+  }
+}
+
+void FixedProbeSequencer::StartFidWorkers()
+{
+  fid_workers_.reset();
+
+  if (fid_job_address_.empty()) {
+    return;
+  }
+
+  fid_workers_.reset(new FidWorkerPool());
+
+  if (fid_workers_->Bind(fid_job_address_, fid_result_address_) != 0) {
+    LogError("could not bind the FID worker sockets %s and %s",
+             fid_job_address_.c_str(), fid_result_address_.c_str());
+    fid_workers_.reset();
+    return;
+  }
+
+  LogMessage("FID workers: jobs on %s, results on %s, %i ms deadline",
+             fid_job_address_.c_str(), fid_result_address_.c_str(),
+             fid_worker_deadline_ms_);
+}
+
+void FixedProbeSequencer::TakeSnapshot(const boost::property_tree::ptree &conf,
+                                       conf_snapshot_t &snap)
+{
+  std::string conf_dir = conf.get<std::string>("config_dir", hw::conf_dir);
+
+  // Relative paths are under conf_dir.
+  auto resolve = [&conf_dir](std::string path) {
+    if (!path.empty() && (path[0] != '/')) path = conf_dir + path;
+    return path;
+  };
+
+  // Normalized json of a file.
+  auto contents = [&resolve](std::string path) {
+    boost::property_tree::ptree pt;
+    std::ostringstream ss;
+
+    if (path.empty()) return std::string("");
+    path = resolve(path);
+
+    boost::property_tree::read_json(path, pt);
+    boost::property_tree::write_json(ss, pt);
+    return ss.str();
+  };
+
+  boost::property_tree::ptree layout;
+  layout.put("backend", conf.get<std::string>("backend", "vme"));
+  layout.put("config_dir", conf_dir);
+
+  if (conf.get_child_optional("sim")) {
+    layout.put_child("sim", conf.get_child("sim"));
+  }
+
+  layout.put_child("dio_triggers", conf.get_child("devices.dio_triggers"));
+  snap.digitizers.clear();
+
+  for (auto &model : {"sis_3302", "sis_3316"}) {
+    for (auto &v : conf.get_child(std::string("devices.") + model)) {
+      layout.put(std::string("digitizers.") + v.first, model);
+      snap.digitizers[v.first] = contents(v.second.data());
+    }
+  }
+
+  std::ostringstream ss;
+  boost::property_tree::write_json(ss, layout);
+  snap.layout = ss.str() +
+    contents(conf.get<std::string>("config.mux_connections"));
+
+  snap.sequence = contents(conf.get<std::string>("config.mux_sequence"));
+  snap.fid_params = contents(conf.get<std::string>("config.fid_analysis", ""));
+
+  snap.queues = conf.get<std::string>("data_queue_size", "") + "/" +
+    conf.get<std::string>("data_queue_policy", "") + "/" +
+    conf.get<std::string>("run_queue_size", "") + "/" +
+    conf.get<std::string>("run_queue_policy", "");
+}
+
+int FixedProbeSequencer::ParkRun()
+{
+  if (parked_) return 0;
+
+  // Let a sequence in flight finish, then park the threads.
+  int count = 0;
+  while ((sequence_in_progress_ || !builder_has_finished_.IsSet()) &&
+         (count++ < 2000)) {
+    usleep(1000);
+  }
+
+  go_time_ = false;
+  InterruptSignals();
+  data_ring_.Interrupt();
+  run_queue_.Interrupt();
+  usleep(10 * hw::long_sleep);
+
+  backend_->StopRun();
+  parked_ = true;
+
+  // Close out the run before the counters restart.
+  LogRunSummary();
+
+  return 0;
+}
+
+int FixedProbeSequencer::EndOfRun()
+{
+  int count = 0;
+  do {
+    usleep(1000);
+  } while (sequence_in_progress_ && (count++ < 200));
+
+  go_time_ = false;
+  thread_live_ = false;
+  InterruptSignals();
+  data_ring_.Interrupt();
+  run_queue_.Interrupt();
+
+  // A parked run has stopped and been summarized already.
+  bool was_parked = parked_;
+
+  if (!was_parked) {
+    backend_->StopRun();
+  }
+
+  LogDebug("EndOfRun: joining threads");
+  if (run_thread_.joinable()) {
+    run_thread_.join();
+  }
+
+  if (trigger_thread_.joinable()) {
+    trigger_thread_.join();
+  }
+
+  if (builder_thread_.joinable()) {
+    builder_thread_.join();
+  }
+
+  if (starter_thread_.joinable()) {
+    starter_thread_.join();
+  }
+
+  backend_->FreeDevices();
+  analysis_pool_.reset();
+
+  mux_idx_map_.clear();
+  sis_idx_map_.clear();
+
+  configured_seq_.resize(0);
+  trg_seq_.resize(0);
+  routing_.Clear();
+
+  data_out_.clear();
+
+  // The threads are joined, so it is safe to reset both ends.
+  data_ring_.Clear();
+  run_queue_.Clear();
+  has_event_ = false;
+
+  if (!was_parked) {
+    LogRunSummary();
+  }
+
+  fid_workers_.reset();
+  parked_ = false;
+
+  return 0;
+}
+
+void FixedProbeSequencer::LogRunSummary()
+{
+  LogHandoffLatency();
+  LogTiming();
+  LogQueueStats();
+  LogFaultStats();
+  LogPlan();
+  LogPruning();
+
+  auto fit = GpsClock::Instance().GetFit();
+  LogMessage("gps clock: locked = %i, %lu samples, %lu failures, "
+             "drift = %.3f ppm, residual = %.1f us", fit.locked,
+             fit.num_samples, fit.num_failures, fit.drift_ppm,
+             1e-3 * fit.residual_ns);
+
+  if (fid_workers_) {
+    auto w = fid_workers_->GetStats();
+    LogMessage("fid workers: %lu sent, %lu received, %lu late, "
+               "%lu timed out, %lu unsent", w.sent, w.received, w.late,
+               w.timed_out, w.unsent);
+  }
+}
+
+fid_worker_stats_t FixedProbeSequencer::GetFidWorkerStats() const
+{
+  if (fid_workers_) {
+    return fid_workers_->GetStats();
+  }
+
+  return fid_worker_stats_t();
+}
+
+round_fault_stats_t FixedProbeSequencer::GetFaultStats()
+{
+  std::lock_guard<std::mutex> lock(fault_mutex_);
+  return faults_;
+}
+
+int FixedProbeSequencer::PublishFaultStats(const std::string &odb_dir)
+{
+  HNDLE hDB;
+  char str[256];
+
+  cm_get_experiment_database(&hDB, NULL);
+
+  auto f = GetFaultStats();
+  const char *key = odb_dir.c_str();
+
+  std::vector<std::pair<const char *, uint64_t>> counts = {
+    {"rounds", f.rounds},
+    {"retries", f.retries},
+    {"abandoned", f.abandoned},
+    {"trigger_failures", f.trigger_failures},
+    {"desyncs", f.desyncs},
+    {"probes_missing", f.probes_missing}
+  };
+
+  for (auto &c : counts) {
+    DWORD val = c.second;
+    snprintf(str, sizeof(str), "%s/%s", key, c.first);
+    db_set_value(hDB, 0, str, &val, sizeof(val), 1, TID_DWORD);
+  }
+
+  // Per-round arrays, so a flaky channel shows up by round.
+  if (!f.round_retries.empty()) {
+    std::vector<DWORD> retries(f.round_retries.begin(), f.round_retries.end());
+    std::vector<DWORD> abandoned(f.round_abandoned.begin(),
+                                 f.round_abandoned.end());
+
+    snprintf(str, sizeof(str), "%s/round_retries", key);
+    db_set_value(hDB, 0, str, retries.data(), sizeof(DWORD) * retries.size(),
+                 retries.size(), TID_DWORD);
+
+    snprintf(str, sizeof(str), "%s/round_abandoned", key);
+    db_set_value(hDB, 0, str, abandoned.data(),
+                 sizeof(DWORD) * abandoned.size(), abandoned.size(),
+                 TID_DWORD);
+  }
+
+  return SUCCESS;
+}
+
+void FixedProbeSequencer::LogFaultStats()
+{
+  auto f = GetFaultStats();
+
+  LogMessage("faults: %lu rounds, %lu retries, %lu abandoned, "
+             "%lu trigger failures, %lu desyncs, %lu probes missing",
+             f.rounds, f.retries, f.abandoned, f.trigger_failures,
+             f.desyncs, f.probes_missing);
+
+  for (int r = 0; r < (int)f.round_retries.size(); ++r) {
+    if ((f.round_retries[r] > 0) || (f.round_abandoned[r] > 0)) {
+      LogMessage("faults: round %i, %lu retries, %lu abandoned", r,
+                 f.round_retries[r], f.round_abandoned[r]);
+    }
+  }
+}
+
+pruning_summary_t FixedProbeSequencer::GetPruning() const
+{
+  pruning_summary_t summary;
+
+  summary.num_demoted = std::count(demoted_.begin(), demoted_.end(), 1);
+  summary.demotions = demotions_;
+  summary.recoveries = recoveries_;
+  summary.sequences = sequence_count_;
+  summary.rounds_skipped = rounds_skipped_;
+  summary.round_us = 0.0;
+
+  for (auto &s : timing_.Summary()) {
+    if (s.stage == SequencerTiming::StageName(SequencerTiming::kRound)) {
+      summary.round_us = s.mean_us;
+    }
+  }
+
+  summary.saved_ms = 1.0e-3 * summary.rounds_skipped * summary.round_us;
+
+  return summary;
+}
+
+void FixedProbeSequencer::LogPlan()
+{
+  double measured_us = 0.0;
+
+  for (auto &s : timing_.Summary()) {
+    if (s.stage == SequencerTiming::StageName(SequencerTiming::kSequence)) {
+      measured_us = s.mean_us;
+    }
+  }
+
+  LogMessage("sequence: %i rounds, predicted %.0f ms, measured %.0f ms",
+             full_rounds_, 1e-3 * SequencePlanner::PredictDuration(
+               full_rounds_, mux_switch_time_,
+               shots_per_round_ * round_overhead_us_),
+             1e-3 * measured_us);
+}
+
+void FixedProbeSequencer::LogPruning()
+{
+  if (prune_after_ <= 0) return;
+
+  auto p = GetPruning();
+  double per_seq = (p.sequences > 0) ? p.saved_ms / p.sequences : 0.0;
+
+  LogMessage("pruning: %i probes demoted, %lu demotions, %lu recoveries, "
+             "%lu rounds skipped, %.1f ms saved (%.1f ms per sequence)",
+             p.num_demoted, p.demotions, p.recoveries, p.rounds_skipped,
+             p.saved_ms, per_seq);
+}
+
+int FixedProbeSequencer::PublishTiming(const std::string &odb_dir)
+{
+  return timing_.PublishToOdb(odb_dir);
+}
+
+std::map<std::string, queue_stats_t> FixedProbeSequencer::GetQueueStats()
+{
+  std::map<std::string, queue_stats_t> stats;
+
+  stats["data"] = data_ring_.GetStats();
+  stats["run"] = run_queue_.GetStats();
+
+  return stats;
+}
+
+int FixedProbeSequencer::PublishQueueStats(const std::string &odb_dir)
+{
+  HNDLE hDB;
+  char str[256];
+
+  cm_get_experiment_database(&hDB, NULL);
+
+  for (auto &q : GetQueueStats()) {
+    const char *key = odb_dir.c_str();
+    const char *name = q.first.c_str();
+    const queue_stats_t &s = q.second;
+    DWORD val;
+
+    val = s.capacity;
+    snprintf(str, sizeof(str), "%s/%s/capacity", key, name);
+    db_set_value(hDB, 0, str, &val, sizeof(val), 1, TID_DWORD);
+
+    val = s.size;
+    snprintf(str, sizeof(str), "%s/%s/size", key, name);
+    db_set_value(hDB, 0, str, &val, sizeof(val), 1, TID_DWORD);
+
+    val = s.enqueued;
+    snprintf(str, sizeof(str), "%s/%s/enqueued", key, name);
+    db_set_value(hDB, 0, str, &val, sizeof(val), 1, TID_DWORD);
+
+    val = s.dropped;
+    snprintf(str, sizeof(str), "%s/%s/dropped", key, name);
+    db_set_value(hDB, 0, str, &val, sizeof(val), 1, TID_DWORD);
+
+    val = s.high_water;
+    snprintf(str, sizeof(str), "%s/%s/high_water", key, name);
+    db_set_value(hDB, 0, str, &val, sizeof(val), 1, TID_DWORD);
+
+    val = s.blocked;
+    snprintf(str, sizeof(str), "%s/%s/blocked", key, name);
+    db_set_value(hDB, 0, str, &val, sizeof(val), 1, TID_DWORD);
+
+    snprintf(str, sizeof(str), "%s/%s/blocked_us", key, name);
+    db_set_value(hDB, 0, str, &s.blocked_us, sizeof(s.blocked_us), 1,
+                 TID_DOUBLE);
+  }
+
+  return SUCCESS;
+}
+
+void FixedProbeSequencer::LogQueueStats()
+{
+  for (auto &q : GetQueueStats()) {
+    LogMessage("queue %s: %lu enqueued, %lu dropped, high water %lu of %lu, "
+               "%lu blocked for %.0f us", q.first.c_str(),
+               q.second.enqueued, q.second.dropped, q.second.high_water,
+               q.second.capacity, q.second.blocked, q.second.blocked_us);
+  }
+}
+
+void FixedProbeSequencer::LogTiming()
+{
+  for (auto &s : timing_.Summary()) {
+    LogMessage("timing %s: n = %lu, p50 = %.0f us, p90 = %.0f us, "
+               "p99 = %.0f us, max = %.0f us", s.stage.c_str(), s.count,
+               s.p50_us, s.p90_us, s.p99_us, s.max_us);
+  }
+}
+
+std::map<std::string, signal_latency_t>
+FixedProbeSequencer::GetHandoffLatency(bool reset)
+{
+  std::map<std::string, signal_latency_t> latency;
+
+  latency["start_trigger"] = got_start_trg_.GetLatency(reset);
+  latency["round_configured"] = mux_round_configured_.GetLatency(reset);
+  latency["data_ready"] = data_ready_.GetLatency(reset);
+  latency["round_data"] = got_round_data_.GetLatency(reset);
+  latency["builder_finished"] = builder_has_finished_.GetLatency(reset);
+
+  return latency;
+}
+
+void FixedProbeSequencer::InterruptSignals()
+{
+  got_software_trg_.Interrupt();
+  got_start_trg_.Interrupt();
+  mux_round_configured_.Interrupt();
+  data_ready_.Interrupt();
+  got_round_data_.Interrupt();
+  builder_has_finished_.Interrupt();
+}
+
+void FixedProbeSequencer::LogHandoffLatency()
+{
+  for (auto &stage : GetHandoffLatency(true)) {
+    LogMessage("hand-off %s: %lu wakeups, mean = %.1f us, max = %.1f us",
+               stage.first.c_str(),
+               stage.second.count,
+               stage.second.mean_us,
+               stage.second.max_us);
+  }
+}
+
+FixedProbeSequencer::event_handle_t FixedProbeSequencer::TakeEvent(int64_t timeout_us)
+{
+  nmr_vector *event = nullptr;
+
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+
+    if (event_pool_.empty()) {
+      LogWarning("TakeEvent: all buffers in use, growing pool to %i",
+                 event_store_.size() + 1);
+
+      event_store_.push_back(std::unique_ptr<nmr_vector>(new nmr_vector()));
+      event_store_.back()->Resize(num_probes_);
+      event_pool_.push_back(event_store_.back().get());
+    }
+
+    event = event_pool_.back();
+    event_pool_.pop_back();
+  }
+
+  auto release = [this](nmr_vector *p) { ReleaseEvent(p); };
+
+  // Swap the queued event out, the queue slot keeps our old buffer.
+  if (!run_queue_.PopFor(*event, timeout_us)) {
+    ReleaseEvent(event);
+    return event_handle_t(nullptr, release);
+  }
+
+  if (run_queue_.empty()) {
+    has_event_ = false;
+  }
+
+  return event_handle_t(event, release);
+}
+
+void FixedProbeSequencer::SetPriorityProbes(const std::vector<int> &probes)
+{
+  priority_probes_ = probes;
+}
+
+void FixedProbeSequencer::SetRoundCallback(round_callback_t callback)
+{
+  std::lock_guard<std::mutex> lock(round_mutex_);
+  round_callback_ = callback;
+}
+
+std::vector<int> FixedProbeSequencer::GetProbeIndices() const
+{
+  std::set<int> probes;
+
+  for (auto &round : trg_seq_) {
+    for (auto &trg : round) {
+
+      auto it = data_out_.find(trg);
+
+      if ((it != data_out_.end()) && (it->second.second >= 0) &&
+          (it->second.second < num_probes_)) {
+        probes.insert(it->second.second);
+      }
+    }
+  }
+
+  return std::vector<int>(probes.begin(), probes.end());
+}
+
+void FixedProbeSequencer::PublishRound(const nmr_vector &bundle, int round,
+                                       const std::vector<int> &indices)
+{
+  std::lock_guard<std::mutex> lock(round_mutex_);
+
+  if (!round_callback_) return;
+
+  // The round's results have to be in before they go out.
+  if (analysis_pool_) {
+    analysis_pool_->WaitIdle();
+  }
+
+  round_record_.sequence = sequence_count_;
+  round_record_.round = round;
+  round_record_.num_rounds = routing_.num_rounds();
+  round_record_.flags = round_flags_[round];
+  round_record_.probes.resize(indices.size());
+
+  for (int i = 0; i < (int)indices.size(); ++i) {
+    int idx = indices[i];
+    auto &p = round_record_.probes[i];
+
+    p.probe = idx;
+    p.health = bundle.health[idx];
+    p.clock_gps_ns = bundle.clock_gps_ns[idx];
+    p.freq = bundle.freq[idx];
+    p.ferr = bundle.ferr[idx];
+    p.freq_zc = bundle.freq_zc[idx];
+    p.ferr_zc = bundle.ferr_zc[idx];
+    p.fid_amp = bundle.fid_amp[idx];
+    p.fid_snr = bundle.fid_snr[idx];
+    p.fid_len = bundle.fid_len[idx];
+  }
+
+  round_callback_(round_record_);
+}
+
+void FixedProbeSequencer::ReleaseEvent(nmr_vector *event)
+{
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  event_pool_.push_back(event);
+}
+
+int FixedProbeSequencer::ResizeEventData(hw::event_data_t &data)
+{
+  return 0;
+}
+
+void FixedProbeSequencer::RunLoop()
+{
+  bool primed = false;
+  hw::event_data_t bundle;
+
+  while (thread_live_) {
+
+    while (go_time_ && !generate_software_triggers_) {
+
+      if (backend_->AnyWorkersHaveEvent()) {
+
+        LogDebug("RunLoop: got potential event");
+        int64_t t_fire = round_fire_ns_;
+
+        if (t_fire > 0) {
+          timing_.Record(SequencerTiming::kFirstWorkerData, t_fire);
+        }
+
+        // Gather until every worker reports.  Past the deadline the
+        // stragglers are late fragments, the early data is kept and
+        // the trigger loop's watchdog handles a worker that never shows.
+        int64_t t_first = SequencerTiming::Now();
+        int64_t deadline = t_first + 1000 * (int64_t)max_event_time_;
+        bool late = false;
+
+        while (!backend_->AllWorkersHaveEvent() && go_time_) {
+
+          if (!late && (SequencerTiming::Now() > deadline)) {
+            LogWarning("RunLoop: gather deadline passed, waiting for late fragments");
+            late = true;
+          }
+
+          // A flush by the watchdog or a misaligned worker ends it.
+          if (!backend_->AnyWorkersHaveEvent() ||
+              backend_->AnyWorkersHaveMultiEvent()) break;
+
+          usleep(gather_poll_time_);
+        }
+
+        if (backend_->AnyWorkersHaveMultiEvent()) {
+
+          LogWarning("two events detected among some workers, dropping");
+          backend_->FlushEventData();
+
+          // Have the trigger loop retry the round now.
+          {
+            std::lock_guard<std::mutex> lock(fault_mutex_);
+            ++faults_.desyncs;
+          }
+
+          round_fault_ = true;
+          continue;
+
+        } else if (!backend_->AllWorkersHaveEvent()) {
+
+          // Stopped, or the watchdog flushed the partial event.
+          continue;
+        }
+
+        int64_t t_all = SequencerTiming::Now();
+        timing_.Record(SequencerTiming::kWorkerSkew, t_first, t_all);
+
+        if (late) {
+          timing_.Record(SequencerTiming::kLateFragment, deadline, t_all);
+        }
+
+        if (t_fire > 0) {
+          timing_.Record(SequencerTiming::kAllWorkersData, t_fire);
+        }
+
+        backend_->GetEventData(bundle);
+
+	LogDebug("RunLoop: moving data bundle");
+
+        // Size the free slots like a real event once, then recycle.
+        if (!primed) {
+          data_ring_.Prime(bundle);
+          primed = true;
+        }
+
+        if (data_ring_.Push(bundle)) {
+          LogDebug("RunLoop: Got data. Data queue now: %i",
+                   data_ring_.size());
+          data_ready_.Set();
+
+        } else {
+
+          LogWarning("RunLoop: data queue full, dropped a bundle");
+        }
+      }
+
+      // Poll fast only while a fired round's fragments are due.
+      if (round_fire_ns_ > 0) {
+        usleep(gather_poll_time_);
+      } else {
+        ThreadSleepLong();
+      }
+    }
+
+    ThreadSleepLong();
+  }
+}
+
+void FixedProbeSequencer::TriggerLoop()
+{
+  using namespace std::chrono;
+
+  hw::event_data_t bundle;
+
+  while (thread_live_) {
+
+    while (go_time_) {
+
+      if (got_start_trg_.WaitFor(hw::long_sleep)) {
+
+	sequence_in_progress_ = true;
+	builder_has_finished_.Clear();
+	mux_round_configured_.Clear();
+
+	// Repack after demotions, or bring the demoted probes back in for
+	// a revisit.  The builder is idle until the first round is set.
+	if (prune_after_ > 0) {
+	  bool revisit = (prune_revisit_ > 0) &&
+	    ((sequence_count_ + 1) % prune_revisit_ == 0);
+
+	  if (schedule_dirty_ ||
+	      ((revisit != schedule_revisit_) && (demotions_ > recoveries_))) {
+	    schedule_dirty_ = false;
+	    CompileRouting(revisit);
+	  }
+	}
+
+	LogMessage("TriggerLoop: received trigger, sequencing multiplexers");
+
+	// When the pre-staged muxes of the next round began settling.
+	auto prestage_time = steady_clock::now();
+	int64_t t_seq = SequencerTiming::Now();
+
+	for (int round = 0; round < routing_.num_rounds(); ++round) {
+	  if (!go_time_) break;
+
+	  got_round_data_.Clear();
+	  mux_round_configured_.Clear();
+	  round_fire_ns_ = 0;
+	  round_fault_ = false;
+
+	  int64_t t0 = SequencerTiming::Now();
+
+	  for (auto it = routing_.begin(round); it != routing_.end(round); ++it) {
+	    if (!go_time_) break;
+
+	    // Already switched while the last round was read out.
+	    if (pipeline_mux_switching_ && it->prestage) continue;
+
+	    LogDebug("TriggerLoop: setting %s to %i",
+		     it->mux_name->c_str(), it->mux_chan);
+
+	    it->board->SetMux(*it->mux_name, it->mux_chan);
+	  }
+
+      	  LogDebug("TriggerLoop: muxes are configured for this round");
+	  int64_t t1 = SequencerTiming::Now();
+	  timing_.Record(SequencerTiming::kMuxConfigure, t0, t1);
+
+	  if (pipeline_mux_switching_ && routing_.fully_prestaged(round)) {
+
+	    // Only wait out the part of the settling not yet elapsed.
+	    auto settled = duration_cast<microseconds>(steady_clock::now() -
+						       prestage_time).count();
+
+	    if (settled < mux_switch_time_) {
+	      usleep(mux_switch_time_ - settled);
+	    }
+
+	  } else {
+
+	    usleep(mux_switch_time_);
+	  }
+
+	  int64_t t2 = SequencerTiming::Now();
+	  timing_.Record(SequencerTiming::kMuxSettle, t1, t2);
+
+	  // Every shot of the round fires on the same mux setting, the
+	  // builder sums their traces.
+	  int retries = 0;
+	  bool abandoned = false;
+
+	  for (int shot = 0; (shot < shots_per_round_) && !abandoned; ++shot) {
+	    if (!go_time_) break;
+
+	    if (shot > 0) {
+	      got_round_data_.Clear();
+	      mux_round_configured_.Clear();
+	      round_fire_ns_ = 0;
+	      round_fault_ = false;
+	      t2 = SequencerTiming::Now();
+	    }
+
+	    if (generate_software_triggers_) {
+
+	      // Pause workers.
+	      backend_->StopWorkers();
+	      hw::wait_ns(hw::short_sleep * 2);
+	    
+	      // Fire triggers and get waveforms on 3316.
+	      // Trigger the 3316 and relevant pulser modules.
+	      int n = 0;
+	      while ((backend_->GenerateTrigger(wfd_3316_idx_) != 0) &&
+		     (n++ < trigger_retries_)) usleep(10000);
+
+	      if (coalesce_triggers_) {
+
+		std::vector<trigger_fire_t> group = {{1, 0xff, 0, 0},
+						     {2, 0xff, 0, 0}};
+		backend_->FireTriggerGroup(group, trigger_retries_);
+		RecordTriggerSkew(group);
+
+	      } else {
+
+		backend_->FireTriggers(1, 0xff);
+		int64_t t_trg = SequencerTiming::Now();
+		backend_->FireTriggers(2, 0xff);
+		timing_.Record(SequencerTiming::kTriggerSkew, t_trg);
+	      }
+
+	      // Trigger the 3302 and pulse the relevant NMR pulsers.
+	      n = 0;
+	      while ((backend_->GenerateTrigger(wfd_3302_idx_) != 0) &&
+		     (n++ < trigger_retries_)) usleep(10000);
+	      hw::wait_ns(0.5e6);
+	      backend_->FireTriggers(3, 0x0f);
+
+	      round_fire_ns_ = SequencerTiming::Now();
+	      timing_.Record(SequencerTiming::kTriggerFire, t2, round_fire_ns_);
+
+	      backend_->StartWorkers();
+	      hw::wait_ns(100e6);
+
+	      // A worker that never reports is left to the round retries.
+	      auto t_fire = steady_clock::now();
+	      while (!backend_->AllWorkersHaveEvent() && go_time_ &&
+		     (steady_clock::now() - t_fire <
+		      microseconds(round_timeout_us_))) usleep(500);
+
+	      timing_.Record(SequencerTiming::kAllWorkersData, round_fire_ns_);
+
+	      if (!backend_->AllWorkersHaveEvent()) {
+
+		LogWarning("TriggerLoop: round %i has no data", round);
+
+	      } else {
+
+		backend_->GetEventData(bundle);
+		hw::wait_ns(hw::short_sleep * 2);
+
+		if (data_ring_.Push(bundle)) {
+		  LogDebug("TriggerLoop: Got data. Data queue now: %i",
+			   data_ring_.size());
+		  data_ready_.Set();
+
+		} else {
+
+		  LogWarning("TriggerLoop: data queue full, dropped a bundle");
+		}
+	      }
+	    
+	    } else {
+	    
+	      LogDebug("Generated DIO triggers");
+	      FireDioTriggers();
+
+	      round_fire_ns_ = SequencerTiming::Now();
+	      timing_.Record(SequencerTiming::kTriggerFire, t2, round_fire_ns_);
+	    }
+	  
+	    LogDebug("TriggerLoop: muxes configured, triggers fired");
+	    mux_round_configured_.Set();
+
+	    // Switch the idle muxes of the next round during readout.
+	    if (pipeline_mux_switching_ && (shot == 0) &&
+		(round + 1 < routing_.num_rounds())) {
+
+	      for (auto it = routing_.begin(round + 1);
+		   it != routing_.end(round + 1); ++it) {
+
+		if (it->prestage) {
+		  it->board->SetMux(*it->mux_name, it->mux_chan);
+		}
+	      }
+
+	      prestage_time = steady_clock::now();
+	    }
+	  
+	    auto t_wait = steady_clock::now();
+
+	    while (!got_round_data_.WaitFor(hw::long_sleep) && go_time_) {
+
+	      // Wait out the timeout, unless the workers already desynced.
+	      if (abandoned || (!round_fault_ &&
+		  (steady_clock::now() - t_wait < microseconds(round_timeout_us_)))) {
+		continue;
+	      }
+
+	      round_fault_ = false;
+	      backend_->FlushEventData();
+
+	      // Out of retries, the builder marks the probes missing.
+	      if (retries >= round_retries_) {
+
+		LogWarning("TriggerLoop: round %i abandoned after %i retries",
+			   round, retries);
+
+		CountRoundFault(round, true);
+		abandoned = true;
+		skip_round_ = true;
+		data_ready_.Set();
+		continue;
+	      }
+
+	      // Retry only this round.
+	      LogWarning("TriggerLoop: round %i has no data, re-firing", round);
+	      CountRoundFault(round, false);
+	      ++retries;
+
+	      FireDioTriggers();
+	      round_fire_ns_ = SequencerTiming::Now();
+	      t_wait = steady_clock::now();
+	    };
+	  } // next shot
+
+	  {
+	    std::lock_guard<std::mutex> lock(fault_mutex_);
+	    ++faults_.rounds;
+	  }
+
+	  timing_.Record(SequencerTiming::kRound, t0);
+	  
+	} // on to the next round
+
+	sequence_in_progress_ = false;
+	got_start_trg_.Clear();
+
+	// Wake the builder so it sees the end of the sequence.
+	mux_round_configured_.Interrupt();
+
+	LogDebug("TriggerLoop: waiting for builder to finish");
+	
+	while (!builder_has_finished_.WaitFor(hw::long_sleep) && go_time_);
+	
+	LogDebug("TriggerLoop: builder finished packing event");
+	round_fire_ns_ = 0;
+	timing_.Record(SequencerTiming::kSequence, t_seq);
+
+	if ((int)schedule_.size() < full_rounds_) {
+	  rounds_skipped_ += full_rounds_ - schedule_.size();
+	}
+	
+      } // done with trigger sequence
+    }
+
+    ThreadSleepLong();
+  }
+}
+
+void FixedProbeSequencer::BuilderLoop()
+{
+  using namespace std::chrono;
+
+  LogDebug("BuilderLoop: launched");
+
+  std::vector<double> wf(NMR_FID_LENGTH_ONLINE / 2, 0.0);
+  std::vector<int> indices;
+
+  while (thread_live_) {
+
+    while (go_time_) {
+
+      nmr_vector &bundle = builder_event_;
+      static hw::event_data_t data;
+      int seq_index = 0;
+      int shot = 0;
+
+      if (sequence_in_progress_) {
+        LogMessage("BuilderLoop: beginning a new event");
+        std::fill(measured_.begin(), measured_.end(), 0);
+      }
+
+      while (sequence_in_progress_ && go_time_) {
+
+        // Block until the round is configured and data has arrived.
+        if (mux_round_configured_.WaitFor(hw::long_sleep) &&
+            data_ready_.WaitFor(hw::long_sleep)) {
+
+          // Clear first, so a push racing with the check re-raises it.
+          data_ready_.Clear();
+
+          // An abandoned round, anything queued for it is stale.
+          if (skip_round_) {
+
+            while (data_ring_.Pop(data));
+
+            MarkRoundMissing(bundle, seq_index, indices);
+            shot = 0;
+
+            if (stream_rounds_) {
+              PublishRound(bundle, seq_index, indices);
+            }
+
+            indices.resize(0);
+            skip_round_ = false;
+
+            seq_index++;
+            mux_round_configured_.Clear();
+            got_round_data_.Set();
+            continue;
+          }
+
+          // Grab the data itself, swapping our used bundle back in.
+          if (data_ring_.Pop(data)) {
+
+            if (!data_ring_.empty()) {
+              data_ready_.Set();
+            }
+
+            // Get the time as close to readout as we can.
+            auto gps_clock = GpsClock::Instance().now_gps_ns();
+            int64_t t_copy = SequencerTiming::Now();
+
+            LogDebug("BuilderLoop: copying data");
+
+            bool last_shot = (shot + 1 >= shots_per_round_);
+            int slot = 0;
+
+            // A probe measured again this sequence, by the priority
+            // sub-sequence, reuses its slot, so the analysis still
+            // reading it has to finish first.
+            if (shot == 0) {
+
+              bool reused = false;
+
+              for (auto it = routing_.begin(seq_index);
+                   it != routing_.end(seq_index); ++it) {
+                reused = reused || measured_[it->out_idx];
+              }
+
+              if (reused) {
+                FinishAnalysis(bundle, wf);
+              }
+            }
+
+            for (auto it = routing_.begin(seq_index);
+                 it != routing_.end(seq_index); ++it, ++slot) {
 
               // Get the right data out of the input.
-              auto sis_name = data_in_[pair.first].first;
-              int sis_idx = sis_idx_map_[sis_name];
-              int trace_idx = data_in_[pair.first].second;
+              int sis_idx = it->wfd_idx;
+              int trace_idx = it->trace_idx;
+              int idx = it->out_idx;
+
+              const auto &trace = data[sis_idx].trace[trace_idx];
+              auto size = trace.size();
+
+              // Sum the shots, the first one stamps the round.
+              if (shots_per_round_ > 1) {
+
+                if (shot == 0) {
+                  shot_sums_.Start(slot, &trace[0], size);
+                } else {
+                  shot_sums_.Add(slot, &trace[0], size);
+                }
 
-              int idx = 0;
-              ULong64_t clock = 0;
+                if (last_shot) {
+                  auto &avg = fid_avg_[idx];
+                  int n = std::min<int>(size / 2, NMR_FID_LENGTH_ONLINE / 2);
+
+                  avg.resize(NMR_FID_LENGTH_ONLINE / 2, 0.0f);
+                  shot_sums_.AverageOdd(slot, &avg[0], n, shots_per_round_);
+                  shot_sums_.Average(slot, &bundle.trace[idx][0], size,
+                                     shots_per_round_);
+                  indices.push_back(idx);
+                  measured_[idx] = 1;
+                }
+
+                if (shot > 0) continue;
+              }
 
               // Store index and clock.
-              clock = data[sis_idx].dev_clock[trace_idx];
-              idx = data_out_[pair].second;
+              ULong64_t clock = data[sis_idx].dev_clock[trace_idx];
               bundle.clock_gps_ns[idx] = gps_clock;
               bundle.device_clock[idx] = clock;
 
@@ -576,24 +1788,37 @@ void FixedProbeSequencer::BuilderLoop()
 		bundle.device_gain_vpp[idx] = 10.0;
 	      }
 
+              if (shots_per_round_ > 1) continue;
+
               // Get FID data.
               auto arr_ptr = &bundle.trace[idx][0];
-              auto trace = data[sis_idx].trace[trace_idx];
-              auto size = data[sis_idx].trace[trace_idx].size();
 
-              LogDebug("BuilderLoop: round %i, copying %s, ch %i -> %i, %i samples",
-                       seq_index, sis_name.c_str(), trace_idx, idx, size);
+              LogDebug("BuilderLoop: round %i, copying wfd %i, ch %i -> %i, %i samples",
+                       seq_index, sis_idx, trace_idx, idx, size);
 
               std::copy(&trace[0], &trace[0] + size, arr_ptr);
               
               // Save the index for analysis after copying
               indices.push_back(idx);
+              measured_[idx] = 1;
+            }
+
+            timing_.Record(SequencerTiming::kCopy, t_copy);
+
+            // Have the trigger loop fire the next shot of the round.
+            if (!last_shot) {
+              ++shot;
+              mux_round_configured_.Clear();
+              got_round_data_.Set();
+              continue;
             }
 
+            shot = 0;
+
             // Let the data collection begin for next round.
             seq_index++;
-            got_round_data_ = true;
-            mux_round_configured_ = false;
+            mux_round_configured_.Clear();
+            got_round_data_.Set();
 
             // Analyze the FIDs from this round.
             for (auto &idx : indices) {
@@ -601,132 +1826,353 @@ void FixedProbeSequencer::BuilderLoop()
               // Get the timestamp
               bundle.clock_sys_ns[idx] = hw::systime_us() * 1000;
 
-              if (analyze_fids_online_) {
-
-                LogDebug("BuilderLoop: analyzing FID %i", idx);
-
-		// Skip spikes in 3302
-		for (uint i = 0; i < NMR_FID_LENGTH_ONLINE/2; ++i) {
-		  wf[i] = bundle.trace[idx][2 * i + 1];
-		}
-
-                // std::copy(&bundle.trace[idx][0],
-                //           &bundle.trace[idx][NMR_FID_LENGTH_ONLINE],
-                //           wf.begin());
-
-                // Extract the FID frequency and some diagnostic params.
-                if (use_fast_fids_class_) {
-
-                  fid::FastFid myfid(wf, tm);
-
-                  // Make sure we got an FID signal
-                  if (myfid.isgood() && std::isfinite(myfid.CalcFreq())) {
-		    
-		    // if (idx == 0) {
-		    //   std::cout << "probe000: freq = " << myfid.freq() << std::endl;
-		    // }
-
-                    bundle.fid_amp[idx] = myfid.amp();
-                    bundle.fid_snr[idx] = myfid.snr();
-                    bundle.fid_len[idx] = myfid.fid_time();
-                    bundle.freq[idx] = myfid.CalcFreq();
-                    bundle.ferr[idx] = myfid.freq_err();
-                    bundle.freq_zc[idx] = myfid.CalcFreq();
-                    bundle.ferr_zc[idx] = myfid.freq_err();
-                    bundle.method[idx] = (ushort)fid::Method::ZC;
-                    bundle.health[idx] = myfid.health();
-
-                  } else {
-
-                    // myfid.DiagnosticInfo();
-                    bundle.fid_snr[idx] = 0.0;
-                    bundle.fid_len[idx] = 0.0;
-                    bundle.freq[idx] = 0.0;
-                    bundle.ferr[idx] = 0.0;
-                    bundle.freq_zc[idx] = 0.0;
-                    bundle.ferr_zc[idx] = 0.0;
-                    bundle.method[idx] = (ushort)fid::Method::ZC;
-                    bundle.health[idx] = myfid.health();
-                  }
-
-                } else {
-
-                  fid::Fid myfid(wf, tm);
-
-                  // Make sure we got an FID signal
-                  if (myfid.isgood()) {
-
-                    bundle.fid_amp[idx] = myfid.amp();
-                    bundle.fid_snr[idx] = myfid.snr();
-                    bundle.fid_len[idx] = myfid.fid_time();
-                    bundle.freq[idx] = myfid.CalcPhaseFreq();
-                    bundle.ferr[idx] = myfid.freq_err();
-                    bundle.freq_zc[idx] = myfid.CalcZeroCountFreq();
-                    bundle.ferr_zc[idx] = myfid.freq_err();
-                    bundle.method[idx] = (ushort)fid::Method::PH;
-                    bundle.health[idx] = myfid.health();
-
-                  } else {
-
-                    myfid.DiagnosticInfo();
-                    bundle.fid_amp[idx] = 0.0;
-                    bundle.fid_snr[idx] = 0.0;
-                    bundle.fid_len[idx] = 0.0;
-                    bundle.freq[idx] = 0.0;
-                    bundle.ferr[idx] = 0.0;
-                    bundle.freq_zc[idx] = 0.0;
-                    bundle.ferr_zc[idx] = 0.0;
-                    bundle.method[idx] = (ushort)fid::Method::PH;
-                    bundle.health[idx] = myfid.health();
-                  }
-                }
+              // Hand off to the workers or the pool, or analyze inline.
+              if (fid_workers_ && analyze_fids_online_) {
+                DispatchFid(bundle, idx, wf);
               } else {
-
-                LogDebug("BuilderLoop: skipping analysis");
-
-                bundle.fid_amp[idx] = 0.0;
-                bundle.fid_snr[idx] = 0.0;
-                bundle.fid_len[idx] = 0.0;
-                bundle.freq[idx] = 0.0;
-                bundle.ferr[idx] = 0.0;
-                bundle.freq_zc[idx] = 0.0;
-                bundle.ferr_zc[idx] = 0.0;
-                bundle.method[idx] = (ushort)fid::Method::PH;
-                bundle.health[idx] = 0;
+                AnalyzeLocally(bundle, idx, wf);
               }
             } // next pair
 
+            if (stream_rounds_) {
+
+              // A streamed round goes out final, so the workers' results
+              // are collected round by round instead of per sequence.
+              if (fid_workers_ && analyze_fids_online_) {
+                CollectFids(bundle, wf);
+              }
+
+              PublishRound(bundle, seq_index - 1, indices);
+            }
+
             indices.resize(0);
 	  }
         } // next round
-
-	ThreadSleepShort();
       }
 
       // Sequence finished.
-      if (!sequence_in_progress_ && !builder_has_finished_) {
+      if (!sequence_in_progress_ && !builder_has_finished_.IsSet()) {
+
+        // Join the analysis of the last rounds before queueing.
+        FinishAnalysis(bundle, wf);
+
+        if ((prune_after_ > 0) && analyze_fids_online_ &&
+            UpdateProbeHealth(bundle)) {
+          schedule_dirty_ = true;
+        }
 
         // Get the system time.
         LogMessage("new event assembled, pushing to run_queue_");
 
-        queue_mutex_.lock();
-        run_queue_.push(bundle);
+        // Swap the event in, and take a recycled buffer back.
+        if (run_queue_.Push(bundle)) {
+          has_event_ = true;
 
-        LogDebug("BuilderLoop: Size of run_queue_ = %i", run_queue_.size());
+        } else {
 
-        has_event_ = true;
+          LogWarning("BuilderLoop: run_queue_ full, dropped an event");
+        }
+
+        LogDebug("BuilderLoop: Size of run_queue_ = %i", run_queue_.size());
         seq_index = 0;
-        builder_has_finished_ = true;
-        queue_mutex_.unlock();
+        ++sequence_count_;
+
+        builder_has_finished_.Set();
       }
 
-      ThreadSleepLong();
+      // Idle until the trigger loop configures the first round.
+      mux_round_configured_.WaitFor(hw::long_sleep);
     } // go_time_
 
     ThreadSleepLong();
   } // thread_live_
 }
 
+void FixedProbeSequencer::RecordTriggerSkew(const std::vector<trigger_fire_t> &group)
+{
+  if (group.empty()) return;
+
+  int64_t t_first = group[0].fire_ns;
+  int64_t t_last = group[0].fire_ns;
+
+  for (auto &trg : group) {
+    t_first = std::min(t_first, trg.fire_ns);
+    t_last = std::max(t_last, trg.fire_ns);
+  }
+
+  timing_.Record(SequencerTiming::kTriggerSkew, t_first, t_last);
+}
+
+int FixedProbeSequencer::FireDioTriggers()
+{
+  int num_failed = 0;
+
+  if (coalesce_triggers_) {
+
+    if ((int)trigger_group_.size() != backend_->num_triggers()) {
+      trigger_group_.resize(backend_->num_triggers());
+
+      for (int trg = 0; trg < (int)trigger_group_.size(); ++trg) {
+        trigger_group_[trg].trg_idx = trg;
+        trigger_group_[trg].trg_mask = -1;
+      }
+    }
+
+    num_failed = backend_->FireTriggerGroup(trigger_group_, trigger_retries_);
+    RecordTriggerSkew(trigger_group_);
+
+    for (auto &trg : trigger_group_) {
+      if (trg.rc > 0) {
+        LogError("Trigger %i still failing after %i retries", trg.trg_idx,
+                 trigger_retries_);
+      }
+    }
+
+  } else {
+
+    // One board after the other, each retried before the next.
+    int64_t t_first = 0;
+    int64_t t_last = 0;
+
+    for (int trg = 0; trg < backend_->num_triggers(); ++trg) {
+
+      int rc = backend_->FireTriggers(trg);
+      LogDebug("Trigger %i fired", trg);
+
+      for (int n = 0; (rc > 0) && (n < trigger_retries_); ++n) {
+        LogError("Trigger %i failed with rc = %i", trg, rc);
+        rc = backend_->FireTriggers(trg);
+        LogMessage("Trigger %i re-fired", trg);
+      }
+
+      t_last = SequencerTiming::Now();
+      if (trg == 0) t_first = t_last;
+
+      if (rc > 0) {
+        LogError("Trigger %i still failing after %i retries", trg,
+                 trigger_retries_);
+        ++num_failed;
+      }
+    }
+
+    timing_.Record(SequencerTiming::kTriggerSkew, t_first, t_last);
+  }
+
+  if (num_failed > 0) {
+    std::lock_guard<std::mutex> lock(fault_mutex_);
+    faults_.trigger_failures += num_failed;
+  }
+
+  return num_failed;
+}
+
+void FixedProbeSequencer::CountRoundFault(int round, bool abandoned)
+{
+  std::lock_guard<std::mutex> lock(fault_mutex_);
+
+  if ((int)faults_.round_retries.size() <= round) {
+    faults_.round_retries.resize(round + 1, 0);
+    faults_.round_abandoned.resize(round + 1, 0);
+  }
+
+  if (abandoned) {
+    ++faults_.abandoned;
+    ++faults_.round_abandoned[round];
+
+  } else {
+
+    ++faults_.retries;
+    ++faults_.round_retries[round];
+  }
+}
+
+void FixedProbeSequencer::MarkRoundMissing(nmr_vector &bundle, int round,
+                                           std::vector<int> &indices)
+{
+  auto t_sys = hw::systime_us() * 1000;
+
+  for (auto it = routing_.begin(round); it != routing_.end(round); ++it) {
+
+    int idx = it->out_idx;
+
+    bundle.clock_sys_ns[idx] = t_sys;
+    bundle.clock_gps_ns[idx] = 0;
+    bundle.device_clock[idx] = 0;
+    bundle.fid_amp[idx] = 0.0;
+    bundle.fid_snr[idx] = 0.0;
+    bundle.fid_len[idx] = 0.0;
+    bundle.freq[idx] = 0.0;
+    bundle.ferr[idx] = 0.0;
+    bundle.freq_zc[idx] = 0.0;
+    bundle.ferr_zc[idx] = 0.0;
+    bundle.method[idx] = kMethodMissing;
+    bundle.health[idx] = 0;
+
+    // Counts as a failed measurement for the pruning.
+    measured_[idx] = 1;
+    indices.push_back(idx);
+  }
+
+  std::lock_guard<std::mutex> lock(fault_mutex_);
+  faults_.probes_missing += indices.size();
+}
+
+bool FixedProbeSequencer::UpdateProbeHealth(nmr_vector &bundle)
+{
+  bool changed = false;
+  auto t_sys = hw::systime_us() * 1000;
+
+  for (int idx = 0; idx < num_probes_; ++idx) {
+
+    // A demoted probe that sat out this sequence has no measurement.
+    if (!measured_[idx]) {
+
+      if (demoted_[idx]) {
+        bundle.clock_sys_ns[idx] = t_sys;
+        bundle.clock_gps_ns[idx] = 0;
+        bundle.device_clock[idx] = 0;
+        bundle.fid_amp[idx] = 0.0;
+        bundle.fid_snr[idx] = 0.0;
+        bundle.fid_len[idx] = 0.0;
+        bundle.freq[idx] = 0.0;
+        bundle.ferr[idx] = 0.0;
+        bundle.freq_zc[idx] = 0.0;
+        bundle.ferr_zc[idx] = 0.0;
+        bundle.method[idx] = kMethodPruned;
+        bundle.health[idx] = 0;
+        std::fill(&bundle.trace[idx][0],
+                  &bundle.trace[idx][0] + NMR_FID_LENGTH_ONLINE, 0);
+      }
+
+      continue;
+    }
+
+    // A failed isgood() leaves the frequency zeroed.
+    bool good = (bundle.health[idx] > prune_health_min_) &&
+      (bundle.freq[idx] != 0.0);
+
+    if (good) {
+
+      fail_count_[idx] = 0;
+
+      if (demoted_[idx]) {
+        LogMessage("pruning: probe %i recovered", idx);
+        demoted_[idx] = 0;
+        ++recoveries_;
+        changed = true;
+      }
+
+    } else if (!demoted_[idx] && (++fail_count_[idx] >= prune_after_)) {
+
+      LogMessage("pruning: probe %i failed %i sequences, demoted",
+                 idx, fail_count_[idx]);
+      demoted_[idx] = 1;
+      ++demotions_;
+      changed = true;
+    }
+  }
+
+  return changed;
+}
+
+void FixedProbeSequencer::LoadFid(const nmr_vector &bundle, int idx,
+                                  std::vector<double> &wf) const
+{
+  if (shots_per_round_ > 1) {
+    std::copy(fid_avg_[idx].begin(), fid_avg_[idx].end(), wf.begin());
+  } else {
+    decimation::odd_samples(&bundle.trace[idx][0], &wf[0],
+                            NMR_FID_LENGTH_ONLINE / 2);
+  }
+}
+
+void FixedProbeSequencer::AnalyzeFid(nmr_vector &bundle, int idx,
+                                     std::vector<double> &wf)
+{
+  if (analyze_fids_online_) {
+
+    LogDebug("AnalyzeFid: analyzing FID %i", idx);
+    int64_t t0 = SequencerTiming::Now();
+
+    LoadFid(bundle, idx, wf);
+
+    // Extract the FID frequency and some diagnostic params.
+    fid_result_t res;
+    analyze_fid(wf, *fid_tm_, use_fast_fids_class_, res);
+    store_fid_result(res, bundle, idx);
+
+    timing_.Record(SequencerTiming::kFidAnalysis, t0);
+
+  } else {
+
+    LogDebug("AnalyzeFid: skipping analysis");
+
+    bundle.fid_amp[idx] = 0.0;
+    bundle.fid_snr[idx] = 0.0;
+    bundle.fid_len[idx] = 0.0;
+    bundle.freq[idx] = 0.0;
+    bundle.ferr[idx] = 0.0;
+    bundle.freq_zc[idx] = 0.0;
+    bundle.ferr_zc[idx] = 0.0;
+    bundle.method[idx] = (ushort)fid::Method::PH;
+    bundle.health[idx] = 0;
+  }
+}
+
+void FixedProbeSequencer::AnalyzeLocally(nmr_vector &bundle, int idx,
+                                         std::vector<double> &wf)
+{
+  if (analysis_pool_) {
+    analysis_pool_->Submit(idx);
+  } else {
+    AnalyzeFid(bundle, idx, wf);
+  }
+}
+
+void FixedProbeSequencer::DispatchFid(nmr_vector &bundle, int idx,
+                                      std::vector<double> &wf)
+{
+  LoadFid(bundle, idx, wf);
+
+  if (!fid_workers_->Submit(idx, wf, NMR_SAMPLE_PERIOD * 2,
+                            use_fast_fids_class_)) {
+    AnalyzeLocally(bundle, idx, wf);
+  }
+}
+
+void FixedProbeSequencer::CollectFids(nmr_vector &bundle,
+                                      std::vector<double> &wf)
+{
+  int64_t t0 = SequencerTiming::Now();
+
+  fid_workers_->Collect(bundle, fid_worker_deadline_ms_, fid_missing_);
+  timing_.Record(SequencerTiming::kFidCollect, t0);
+
+  if (fid_missing_.empty()) {
+    return;
+  }
+
+  LogWarning("CollectFids: %i probes past the deadline, analyzing locally",
+             (int)fid_missing_.size());
+
+  for (int idx : fid_missing_) {
+    AnalyzeLocally(bundle, idx, wf);
+  }
+}
+
+void FixedProbeSequencer::FinishAnalysis(nmr_vector &bundle,
+                                         std::vector<double> &wf)
+{
+  // The workers' stragglers may land on the analysis threads.
+  if (fid_workers_) {
+    CollectFids(bundle, wf);
+  }
+
+  if (analysis_pool_) {
+    analysis_pool_->WaitIdle();
+  }
+}
+
 void FixedProbeSequencer::StarterLoop()
 {
   bool rc = false;
@@ -738,13 +2184,10 @@ void FixedProbeSequencer::StarterLoop()
 
     while (go_time_ && thread_live_) {
 
-      if (got_software_trg_){
-	got_start_trg_ = true;
-	got_software_trg_ = false;
+      if (got_software_trg_.WaitAndClear(hw::long_sleep)) {
+	got_start_trg_.Set();
 	LogDebug("StarterLoop: Got software trigger");
       }
-
-      ThreadSleepLong();
     }
 
     ThreadSleepLong();
@@ -17,8 +17,11 @@
 //--- std includes ----------------------------------------------------------//
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include <cassert>
+#include <memory>
+#include <functional>
 
 //--- other includes --------------------------------------------------------//
 #include <boost/property_tree/ptree.hpp>
@@ -27,21 +30,95 @@
 
 //--- project includes -------------------------------------------------------/
 #include "g2field/event_manager_base.hh"
-#include "g2field/dio_mux_controller.hh"
-#include "g2field/dio_trigger_board.hh"
-#include "g2field/sis3302.hh"
-#include "g2field/sis3316.hh"
 #include "g2field/core/field_constants.hh"
 #include "g2field/core/field_structs.hh"
 #include "frontend_utils.hh"
+#include "thread_signal.hh"
+#include "event_queue.hh"
+#include "fid_analysis_pool.hh"
+#include "fid_worker_pool.hh"
+#include "sequence_routing.hh"
+#include "sequence_planner.hh"
+#include "sequencer_timing.hh"
+#include "fixed_probe_backend.hh"
+#include "trace_decimation.hh"
+#include "trace_accumulator.hh"
+#include "gps_clock.hh"
 
 
 namespace g2field {
 
+// One probe of a streamed round, laid out flat for a MIDAS bank.
+struct fixed_round_probe_t {
+  uint32_t probe;        // index into the full event
+  uint32_t health;
+  uint64_t clock_gps_ns;
+  double freq;
+  double ferr;
+  double freq_zc;
+  double ferr_zc;
+  double fid_amp;
+  double fid_snr;
+  double fid_len;
+};
+
+// The probes measured in one round, published before the event is built.
+struct fixed_round_t {
+  enum : uint32_t {
+    kPriority = 0x1,       // part of the priority sub-sequence
+    kSubsequenceEnd = 0x2  // last round of the priority sub-sequence
+  };
+
+  uint64_t sequence;     // sequences completed this run
+  uint32_t round;
+  uint32_t num_rounds;
+  uint32_t flags;
+  std::vector<fixed_round_probe_t> probes;
+};
+
+// Written to method, with health 0, for probes the sequencer has no
+// measurement of.  Analyzed probes carry a fid::Method value.
+enum : ushort {
+  kMethodMissing = 0x100,  // the round was abandoned after its retries
+  kMethodPruned = 0x101    // demoted, the probe sat out this sequence
+};
+
+// Per-run fault accounting of the mux rounds.
+struct round_fault_stats_t {
+  uint64_t rounds;            // rounds run
+  uint64_t retries;           // re-fires of a round that had no data
+  uint64_t abandoned;         // rounds given up after their retries
+  uint64_t trigger_failures;  // triggers still failing after their retries
+  uint64_t desyncs;           // bundles dropped for misaligned workers
+  uint64_t probes_missing;    // probes marked kMethodMissing
+  std::vector<uint64_t> round_retries;    // retries by round index
+  std::vector<uint64_t> round_abandoned;  // abandoned by round index
+};
+
+// What the adaptive pruning of failing probes did this run.
+struct pruning_summary_t {
+  int num_demoted;          // probes on the slow revisit cadence now
+  uint64_t demotions;
+  uint64_t recoveries;
+  uint64_t sequences;
+  uint64_t rounds_skipped;  // rounds not run because of pruning
+  double round_us;          // mean time of one round
+  double saved_ms;          // rounds_skipped * round_us
+};
+
 class FixedProbeSequencer: public hw::EventManagerBase {
 
 public:
 
+  // A pooled event buffer, returned to the sequencer when released.
+  // Handles must be released before the sequencer is deleted.
+  typedef std::unique_ptr<nmr_vector, std::function<void(nmr_vector *)>>
+    event_handle_t;
+
+  // Receives each round when "stream_rounds" is on.  It is called from
+  // the builder thread, so it must be quick and must not block.
+  typedef std::function<void(const fixed_round_t &)> round_callback_t;
+
   //ctor
   FixedProbeSequencer(std::string conf_file, int num_probes);
 
@@ -57,78 +134,253 @@ public:
   // Rejoins threads and stops data collection.
   int EndOfRun();
 
+  // Stops data collection between runs: the in-flight sequence finishes,
+  // the digitizers stop and the run summary is logged.  The threads and
+  // devices stay up for the next Reconfigure.
+  int ParkRun();
+
+  // Starts a new run with the config in conf_file, keeping the devices
+  // and threads.  Only the parts that changed are reloaded: the mux
+  // sequence, the FID parameters, queues and tunables.  Changes to the
+  // devices, digitizer configs or mux wiring fall back to a full
+  // EndOfRun and BeginOfRun.  Parks the run first if still going.
+  int Reconfigure(std::string conf_file);
+
   int ResizeEventData(hw::event_data_t &data);
 
   // Issue a software trigger to take another sequence.
   inline int IssueTrigger() {
-    got_software_trg_ = true;
+    got_software_trg_.Set();
+    return 0;
   }
 
   // Returns the oldest stored event.
   inline const nmr_vector GetCurrentEvent() {
-    std::lock_guard<std::mutex> lock(queue_mutex_);
+    nmr_vector tmp;
 
-    if (!run_queue_.empty()) {
-
-      return run_queue_.front();
-
-    } else {
-
-      nmr_vector tmp;
+    if (!run_queue_.CopyFront(tmp)) {
       tmp.Resize(num_probes_);
-      return tmp;
     }
+
+    return tmp;
   };
 
+  // Takes the oldest event without copying it, null if there is none
+  // within timeout_us.
+  event_handle_t TakeEvent(int64_t timeout_us=0);
+
+  // Sets the probes (event indices) of the priority sub-sequence, which
+  // is interleaved every "priority_interval" rounds of the full sequence.
+  // Takes effect at the next BeginOfRun or Reconfigure.
+  void SetPriorityProbes(const std::vector<int> &probes);
+
+  // Sets the consumer of streamed rounds, an empty callback removes it.
+  void SetRoundCallback(round_callback_t callback);
+
+  // Returns the event indices of the probes this sequencer measures,
+  // i.e., its share of the event when run as a shard.
+  std::vector<int> GetProbeIndices() const;
+
   // Removes the oldest event from the front of the queue.
   inline void PopCurrentEvent() {
-    std::lock_guard<std::mutex> lock(queue_mutex_);
+    run_queue_.Discard();
 
-    if (!run_queue_.empty()) {
-      run_queue_.pop();
-    }
     if (run_queue_.empty()) {
       has_event_ = false;
     }
   };
 
+  // Writes the per-stage timing percentiles to the ODB.
+  int PublishTiming(const std::string &odb_dir);
+
+  // Writes the queue counters of this run to the ODB.
+  int PublishQueueStats(const std::string &odb_dir);
+
+  // Returns the counters of the "data" (RunLoop -> BuilderLoop) and
+  // "run" (BuilderLoop -> readout) queues for this run.
+  std::map<std::string, queue_stats_t> GetQueueStats();
+
+  // Writes the round fault counters of this run to the ODB.
+  int PublishFaultStats(const std::string &odb_dir);
+
+  // Returns the retries, abandoned rounds and missing probes this run.
+  round_fault_stats_t GetFaultStats();
+
+  // Returns the counters of the remote FID analysis this run, zero
+  // without fid_workers.
+  fid_worker_stats_t GetFidWorkerStats() const;
+
+  // Returns the demotions, recoveries and sequence time saved by the
+  // adaptive pruning this run.
+  pruning_summary_t GetPruning() const;
+
+  // Returns the per-stage timing percentiles.
+  inline std::vector<timing_summary_t> GetTiming() const {
+    return timing_.Summary();
+  };
+
+  // Returns the hand-off latency between the sequencer threads.
+  std::map<std::string, signal_latency_t> GetHandoffLatency(bool reset=false);
+
 private:
 
   const std::string name_ = "FixedProbeSequencer";
 
-  int min_event_time_;
-  int max_event_time_;
+  int max_event_time_;   // gather deadline after the first worker [us]
+  int gather_poll_time_; // readiness polling interval [us]
   int num_probes_;
-  std::atomic<bool> got_software_trg_;
-  std::atomic<bool> got_start_trg_;
-  std::atomic<bool> got_round_data_;
   std::atomic<bool> generate_software_triggers_;
-  std::atomic<bool> builder_has_finished_;
   std::atomic<bool> sequence_in_progress_;
-  std::atomic<bool> mux_round_configured_;
   std::atomic<bool> analyze_fids_online_;
   std::atomic<bool> use_fast_fids_class_;
+  std::atomic<bool> stream_rounds_;
   std::string mux_sequence_;
   std::string mux_connections_;
   std::string fid_analysis_;
 
+  // The applied config, normalized so Reconfigure can diff it.
+  struct conf_snapshot_t {
+    std::string layout;   // backend, devices and mux wiring
+    std::map<std::string, std::string> digitizers;
+    std::string sequence;
+    std::string fid_params;
+    std::string queues;
+  };
+
+  conf_snapshot_t applied_;
+  std::atomic<bool> parked_;
+
+  // Hand-off signals between the threads.
+  ThreadSignal got_software_trg_;     // IssueTrigger -> StarterLoop
+  ThreadSignal got_start_trg_;        // StarterLoop  -> TriggerLoop
+  ThreadSignal mux_round_configured_; // TriggerLoop  -> BuilderLoop
+  ThreadSignal data_ready_;           // RunLoop      -> BuilderLoop
+  ThreadSignal got_round_data_;       // BuilderLoop  -> TriggerLoop
+  ThreadSignal builder_has_finished_; // BuilderLoop  -> TriggerLoop
+
   int nmr_trg_mask_;
   int mux_switch_time_;
-  std::vector<hw::DioTriggerBoard *> dio_triggers_;
-  std::vector<hw::DioMuxController *> mux_boards_;
+  bool pipeline_mux_switching_;
+
+  // The digitizers, muxes and triggers, real or simulated.
+  std::unique_ptr<FixedProbeBackend> backend_;
+  std::vector<FixedProbeMuxBoard> mux_handles_;
+  std::vector<FixedProbeMuxBoard *> mux_boards_;
   std::map<std::string, int> mux_idx_map_;
   std::map<std::string, int> sis_idx_map_;
   std::map<std::string, std::pair<std::string, int>> data_in_;
   std::map<std::pair<std::string, int>, std::pair<std::string, int>> data_out_;
+  std::vector<std::vector<std::pair<std::string, int>>> configured_seq_;
   std::vector<std::vector<std::pair<std::string, int>>> trg_seq_;
 
-  std::queue<nmr_vector> run_queue_;
-  std::mutex queue_mutex_;
+  // Replans the configured sequence from the wiring, trg_seq_ is the
+  // plan with "plan_sequence" on, else the sequence as configured.
+  SequencePlanner planner_;
+  bool plan_sequence_;
+  int round_overhead_us_;  // predicted time of a shot besides settling
+
+  // trg_seq_ with the priority sub-sequence interleaved, as run.
+  std::vector<int> priority_probes_;
+  int priority_interval_;
+  std::vector<std::vector<std::pair<std::string, int>>> schedule_;
+  std::vector<uint32_t> round_flags_;
+
+  // Adaptive pruning: probes failing "prune_after" sequences in a row
+  // are only measured every "prune_revisit" sequences, and the others
+  // are packed into fewer rounds until they recover.
+  int prune_after_;
+  int prune_revisit_;
+  double prune_health_min_;
+  std::vector<int> fail_count_;
+  std::vector<char> demoted_;
+  std::vector<char> measured_;
+  std::atomic<bool> schedule_dirty_;
+  bool schedule_revisit_;   // the compiled schedule has the demoted probes
+  int full_rounds_;         // rounds per sequence without pruning
+  std::atomic<uint64_t> rounds_skipped_;
+  std::atomic<uint64_t> demotions_;
+  std::atomic<uint64_t> recoveries_;
+
+  // schedule_ resolved at BeginOfRun, used by the hot loops.
+  SequenceRouting<FixedProbeMuxBoard> routing_;
+  int wfd_3316_idx_;
+  int wfd_3302_idx_;
+
+  // Bounded queues: RunLoop -> BuilderLoop -> readout.  Losses in the
+  // first are on the VME side, losses in the second on the MIDAS side.
+  int data_queue_size_;
+  int run_queue_size_;
+  EventQueue<hw::event_data_t> data_ring_;
+  EventQueue<nmr_vector> run_queue_;
+  nmr_vector builder_event_;
+
+  // Buffers lent out by TakeEvent, event_store_ owns all of them.
+  std::mutex pool_mutex_;
+  std::vector<std::unique_ptr<nmr_vector>> event_store_;
+  std::vector<nmr_vector *> event_pool_;
+
+  // Per-round streaming, the record is reused to avoid allocations.
+  std::mutex round_mutex_;
+  round_callback_t round_callback_;
+  fixed_round_t round_record_;
+  uint64_t sequence_count_;
+
+  // Round fault recovery: a round without data is flushed and re-fired
+  // after round_timeout_us_, or at once if the workers desynchronized,
+  // and abandoned with its probes missing after round_retries_.
+  int round_timeout_us_;
+  int round_retries_;
+  int trigger_retries_;
+  bool coalesce_triggers_;  // fire the DIO boards as one group
+  std::vector<trigger_fire_t> trigger_group_;
+  std::atomic<bool> round_fault_;  // RunLoop -> TriggerLoop, retry now
+  std::atomic<bool> skip_round_;   // TriggerLoop -> BuilderLoop
+  std::mutex fault_mutex_;
+  round_fault_stats_t faults_;
+
+  // Each round fires shots_per_round_ triggers on the same mux setting,
+  // the builder sums the traces and analyzes their average.  The event
+  // stores it rounded, the analysis reads the unrounded FID samples.
+  int shots_per_round_;
+  TraceAccumulator shot_sums_;
+  std::vector<std::vector<float>> fid_avg_;
+
+  // Per-stage timing of each round.
+  SequencerTiming timing_;
+  std::atomic<int64_t> round_fire_ns_;
+
+  // Optional worker threads for the FID analysis.
+  int num_fid_threads_;
+  const std::vector<double> *fid_tm_;
+  std::unique_ptr<FidAnalysisPool> analysis_pool_;
+
+  // With fid_workers.job_address set, worker processes analyze the FIDs
+  // and the builder collects them within fid_worker_deadline_ms_, after
+  // each round with stream_rounds on, else at the end of the sequence.
+  std::string fid_job_address_;
+  std::string fid_result_address_;
+  int fid_worker_deadline_ms_;
+  std::unique_ptr<FidWorkerPool> fid_workers_;
+  std::vector<int> fid_missing_;
   std::thread trigger_thread_;
   std::thread builder_thread_;
   std::thread starter_thread_;
 
-  // Collects from data workers, i.e., direct from the waveform digitizers.
+  // The pieces of BeginOfRun that Reconfigure can redo on their own.
+  void LoadFidParams(const boost::property_tree::ptree &conf);
+  void LoadTunables(const boost::property_tree::ptree &conf);
+  void LoadQueues(const boost::property_tree::ptree &conf);
+  void LoadSequence(const boost::property_tree::ptree &conf);
+  void PlanSequence();
+  bool BuildSchedule(bool revisit);
+  void CompileRouting(bool revisit=true);
+  void StartAnalysisPool();
+  void StartFidWorkers();
+  void TakeSnapshot(const boost::property_tree::ptree &conf,
+                    conf_snapshot_t &snap);
+
+  // Collects from data workers, i.e., direct from the waveform digitizers,
+  // as soon as all of them have reported.
   void RunLoop();
 
   // Listens for sequence start signals.
@@ -139,9 +391,92 @@ private:
   // capture.
   void TriggerLoop();
 
+  // Fires every DIO trigger, retrying each up to trigger_retries_.
+  // With coalesce_triggers_ the boards go out back to back and the
+  // retries follow.  Returns the number still failing.
+  int FireDioTriggers();
+
+  // Records the spread of a group's fire times as the trigger skew.
+  void RecordTriggerSkew(const std::vector<trigger_fire_t> &group);
+
+  // Counts a retry or an abandoned round in the fault stats.
+  void CountRoundFault(int round, bool abandoned);
+
+  // Marks the probes of an abandoned round missing in the event.
+  void MarkRoundMissing(nmr_vector &bundle, int round,
+                        std::vector<int> &indices);
+
+  // Puts a buffer handed out by TakeEvent back in the pool.
+  void ReleaseEvent(nmr_vector *event);
+
   // Builds the event by selecting the proper data from each round.
   void BuilderLoop();
 
+  // Fills wf with the FID samples of a probe, the averaged ones when
+  // rounds take several shots.
+  void LoadFid(const nmr_vector &bundle, int idx,
+               std::vector<double> &wf) const;
+
+  // Extracts the frequency of one probe's FID into the event, using wf
+  // as scratch space.  Safe to call concurrently for different probes.
+  void AnalyzeFid(nmr_vector &bundle, int idx, std::vector<double> &wf);
+
+  // Analyzes a probe on the analysis threads, or inline without them.
+  void AnalyzeLocally(nmr_vector &bundle, int idx, std::vector<double> &wf);
+
+  // Sends a probe to the FID workers, analyzing it locally if none
+  // takes it.
+  void DispatchFid(nmr_vector &bundle, int idx, std::vector<double> &wf);
+
+  // Merges the workers' results of the sequence, analyzing the probes
+  // they missed the deadline for locally.
+  void CollectFids(nmr_vector &bundle, std::vector<double> &wf);
+
+  // Waits for every analysis handed off so far, remote and local.
+  void FinishAnalysis(nmr_vector &bundle, std::vector<double> &wf);
+
+  // Hands the probes of a finished round to the round callback.
+  void PublishRound(const nmr_vector &bundle, int round,
+                    const std::vector<int> &indices);
+
+  // Repacks schedule_ without the demoted probes.
+  void PackActiveProbes(int num_demoted);
+
+  // Appends base to schedule with the priority sub-sequence interleaved.
+  // Returns the number of rounds in the sub-sequence.
+  int InterleavePriority(
+    const std::vector<std::vector<std::pair<std::string, int>>> &base,
+    std::vector<std::vector<std::pair<std::string, int>>> &schedule,
+    std::vector<uint32_t> &flags);
+
+  // Counts the failures of the probes measured in the finished event,
+  // demoting and recovering probes.  Returns true if any changed.
+  bool UpdateProbeHealth(nmr_vector &bundle);
+
+  // Wakes every thread blocked on a signal, used when stopping.
+  void InterruptSignals();
+
+  // Writes the hand-off latency summary to the log.
+  void LogHandoffLatency();
+
+  // Writes the stage timing summary to the log.
+  void LogTiming();
+
+  // Writes the queue counters to the log.
+  void LogQueueStats();
+
+  // Writes the round fault counters to the log.
+  void LogFaultStats();
+
+  // Writes the pruning summary to the log.
+  void LogPruning();
+
+  // Writes the predicted and measured sequence time to the log.
+  void LogPlan();
+
+  // Writes all of the above and the GPS clock fit, at the end of a run.
+  void LogRunSummary();
+
   // Thread sleep functions.
   inline void ThreadSleepLong() {
     auto dt = std::chrono::microseconds(hw::long_sleep);
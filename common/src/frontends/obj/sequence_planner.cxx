@@ -0,0 +1,125 @@
+#include "sequence_planner.hh"
+
+//--- std includes ----------------------------------------------------------//
+#include <algorithm>
+#include <set>
+
+namespace g2field {
+
+void SequencePlanner::SetTopology(const std::map<std::string, mux_conf_t> &data_in)
+{
+  data_in_ = data_in;
+}
+
+SequencePlanner::mux_conf_t SequencePlanner::InputOf(const std::string &mux) const
+{
+  auto it = data_in_.find(mux);
+
+  if (it == data_in_.end()) {
+    return mux_conf_t(mux, -1);
+  }
+
+  return it->second;
+}
+
+sequence_plan_t SequencePlanner::Plan(const sequence_t &seq) const
+{
+  // The channels of each mux, and the muxes of each digitizer channel,
+  // both in order of first appearance.
+  std::map<std::string, std::vector<mux_conf_t>> mux_chans;
+  std::map<mux_conf_t, std::vector<std::string>> input_muxes;
+  std::vector<mux_conf_t> inputs;
+
+  for (auto &round : seq) {
+    for (auto &trg : round) {
+
+      auto &chans = mux_chans[trg.first];
+
+      if (chans.empty()) {
+        auto input = InputOf(trg.first);
+        auto &muxes = input_muxes[input];
+
+        if (muxes.empty()) inputs.push_back(input);
+        muxes.push_back(trg.first);
+      }
+
+      chans.push_back(trg);
+    }
+  }
+
+  // Serialize each digitizer channel, one mux after the other.
+  std::vector<std::vector<mux_conf_t>> lanes;
+  sequence_plan_t plan;
+  plan.lower_bound = 0;
+
+  for (auto &input : inputs) {
+
+    std::vector<mux_conf_t> lane;
+
+    for (auto &mux : input_muxes[input]) {
+      auto &chans = mux_chans[mux];
+      lane.insert(lane.end(), chans.begin(), chans.end());
+    }
+
+    plan.lower_bound = std::max(plan.lower_bound, (int)lane.size());
+    lanes.push_back(lane);
+  }
+
+  // Round r takes the r-th channel of every digitizer channel.
+  plan.rounds.resize(plan.lower_bound);
+
+  for (auto &lane : lanes) {
+    for (int r = 0; r < (int)lane.size(); ++r) {
+      plan.rounds[r].push_back(lane[r]);
+    }
+  }
+
+  plan.transitions = CountTransitions(plan.rounds);
+
+  return plan;
+}
+
+int SequencePlanner::CountTransitions(const sequence_t &seq) const
+{
+  int transitions = 0;
+  std::map<mux_conf_t, std::string> last_mux;
+
+  for (auto &round : seq) {
+    for (auto &trg : round) {
+
+      auto input = InputOf(trg.first);
+      auto it = last_mux.find(input);
+
+      if ((it != last_mux.end()) && (it->second != trg.first)) {
+        ++transitions;
+      }
+
+      last_mux[input] = trg.first;
+    }
+  }
+
+  return transitions;
+}
+
+int SequencePlanner::CountConflicts(const sequence_t &seq) const
+{
+  int conflicts = 0;
+
+  for (auto &round : seq) {
+
+    std::set<std::string> muxes;
+    std::set<mux_conf_t> inputs;
+
+    for (auto &trg : round) {
+
+      if (!muxes.insert(trg.first).second ||
+          !inputs.insert(InputOf(trg.first)).second) {
+        ++conflicts;
+      }
+    }
+  }
+
+  return conflicts;
+}
+
+} // ::g2field
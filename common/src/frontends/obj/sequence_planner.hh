@@ -0,0 +1,72 @@
+#ifndef FIELD_DAQ_FRONTENDS_OBJ_SEQUENCE_PLANNER_HH_
+#define FIELD_DAQ_FRONTENDS_OBJ_SEQUENCE_PLANNER_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   sequence_planner.hh
+
+  about:  Plans the rounds of a mux trigger sequence from the wiring.
+          Two channels conflict if they are on the same mux or feed
+          the same digitizer channel.  Every mux feeds one digitizer
+          channel, so the conflict graph is a set of cliques, one per
+          digitizer channel, and colouring it is exact: the busiest
+          digitizer channel sets the number of rounds.  Each digitizer
+          channel runs its muxes back to back, so its input moves to
+          another mux as rarely as possible.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <map>
+#include <vector>
+#include <utility>
+
+namespace g2field {
+
+struct sequence_plan_t {
+  std::vector<std::vector<std::pair<std::string, int>>> rounds;
+  int lower_bound;  // rounds needed by the busiest digitizer channel
+  int transitions;  // times a digitizer input moves to another mux
+};
+
+class SequencePlanner {
+
+public:
+
+  typedef std::pair<std::string, int> mux_conf_t;
+  typedef std::vector<std::vector<mux_conf_t>> sequence_t;
+
+  // Sets the digitizer (name, channel) each mux feeds.  Muxes missing
+  // from the map are treated as having a digitizer channel of their own.
+  void SetTopology(const std::map<std::string, mux_conf_t> &data_in);
+
+  // Plans the channels of seq into the fewest rounds.  Channels keep
+  // their order on each mux and each digitizer channel.
+  sequence_plan_t Plan(const sequence_t &seq) const;
+
+  // Counts the rounds in which a digitizer input moves to another mux.
+  int CountTransitions(const sequence_t &seq) const;
+
+  // Counts the channels that share a mux or a digitizer channel with an
+  // earlier channel of the same round, i.e., cannot be read as planned.
+  int CountConflicts(const sequence_t &seq) const;
+
+  // Predicted time of a sequence from a fixed cost per round.
+  static inline double PredictDuration(int num_rounds, double settle_us,
+                                       double overhead_us) {
+    return num_rounds * (settle_us + overhead_us);
+  };
+
+private:
+
+  std::map<std::string, mux_conf_t> data_in_;
+
+  mux_conf_t InputOf(const std::string &mux) const;
+};
+
+} // ::g2field
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef FIELD_DAQ_FRONTENDS_OBJ_SEQUENCE_ROUTING_HH_
+#define FIELD_DAQ_FRONTENDS_OBJ_SEQUENCE_ROUTING_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   sequence_routing.hh
+
+  about:  Compiles a multiplexer trigger sequence into one flat array of
+          routes, so the sequencer's hot loops walk contiguous memory
+          instead of doing string and pair keyed map lookups for every
+          channel of every round.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <map>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <set>
+
+namespace g2field {
+
+// Everything needed to switch one mux and move its trace into the event.
+template <class MuxBoard>
+struct mux_route_t {
+  MuxBoard *board;             // board that drives the mux
+  const std::string *mux_name; // points into the compiled name table
+  int mux_chan;                // channel to select on the mux
+  int wfd_idx;                 // worker index of the digitizer
+  int trace_idx;               // digitizer channel
+  int out_idx;                 // probe index in the event
+  bool prestage;               // may be switched during the previous round
+};
+
+template <class MuxBoard>
+class SequenceRouting {
+
+public:
+
+  typedef mux_route_t<MuxBoard> route_t;
+  typedef std::pair<std::string, int> mux_conf_t;
+
+  // Resolves every channel of every round once.  Channels that cannot
+  // be resolved are skipped and counted in the return value.
+  int Compile(const std::vector<std::vector<mux_conf_t>> &trg_seq,
+              const std::vector<MuxBoard *> &mux_boards,
+              const std::map<std::string, int> &mux_idx_map,
+              const std::map<std::string, int> &sis_idx_map,
+              const std::map<std::string, mux_conf_t> &data_in,
+              const std::map<mux_conf_t, mux_conf_t> &data_out)
+  {
+    int num_unresolved = 0;
+
+    Clear();
+
+    // Intern the mux names so routes can point at them.
+    for (auto &mux : mux_idx_map) {
+      names_.push_back(mux.first);
+    }
+
+    offsets_.push_back(0);
+
+    for (auto &round : trg_seq) {
+      for (auto &conf : round) {
+
+        auto mux_it = mux_idx_map.find(conf.first);
+        auto in_it = data_in.find(conf.first);
+        auto out_it = data_out.find(conf);
+
+        if ((mux_it == mux_idx_map.end()) ||
+            (in_it == data_in.end()) ||
+            (out_it == data_out.end())) {
+          ++num_unresolved;
+          continue;
+        }
+
+        auto sis_it = sis_idx_map.find(in_it->second.first);
+
+        if ((sis_it == sis_idx_map.end()) ||
+            (mux_it->second >= (int)mux_boards.size())) {
+          ++num_unresolved;
+          continue;
+        }
+
+        route_t route;
+        route.board = mux_boards[mux_it->second];
+        route.mux_name = &names_[std::distance(mux_idx_map.begin(), mux_it)];
+        route.mux_chan = conf.second;
+        route.wfd_idx = sis_it->second;
+        route.trace_idx = in_it->second.second;
+        route.out_idx = out_it->second.second;
+        route.prestage = false;
+
+        routes_.push_back(route);
+      }
+
+      offsets_.push_back(routes_.size());
+    }
+
+    return num_unresolved;
+  };
+
+  // Flags the routes whose mux can be switched while the previous round
+  // is read out, i.e., the mux is idle in that round and its digitizer
+  // channel is not being read.  Returns the number of flagged routes.
+  int ComputePrestage() {
+    int num_prestaged = 0;
+
+    for (int r = 1; r < num_rounds(); ++r) {
+
+      std::set<std::string> busy_mux;
+      std::set<std::pair<int, int>> busy_chan;
+
+      for (auto it = begin(r - 1); it != end(r - 1); ++it) {
+        busy_mux.insert(*it->mux_name);
+        busy_chan.insert(std::make_pair(it->wfd_idx, it->trace_idx));
+      }
+
+      for (int i = offsets_[r]; i < offsets_[r + 1]; ++i) {
+        auto &route = routes_[i];
+        auto chan = std::make_pair(route.wfd_idx, route.trace_idx);
+
+        route.prestage = (busy_mux.count(*route.mux_name) == 0) &&
+          (busy_chan.count(chan) == 0);
+
+        if (route.prestage) ++num_prestaged;
+      }
+    }
+
+    return num_prestaged;
+  };
+
+  // True if every route of the round was switched in the previous one.
+  inline bool fully_prestaged(int round) const {
+    for (auto it = begin(round); it != end(round); ++it) {
+      if (!it->prestage) return false;
+    }
+    return round > 0;
+  };
+
+  void Clear() {
+    routes_.resize(0);
+    offsets_.resize(0);
+    names_.resize(0);
+  };
+
+  inline int num_rounds() const {
+    return offsets_.empty() ? 0 : offsets_.size() - 1;
+  };
+
+  inline int num_routes() const { return routes_.size(); };
+
+  // Routes of a round are [begin(r), end(r)).
+  inline const route_t *begin(int round) const {
+    return routes_.data() + offsets_[round];
+  };
+
+  inline const route_t *end(int round) const {
+    return routes_.data() + offsets_[round + 1];
+  };
+
+private:
+
+  std::vector<route_t> routes_;
+  std::vector<int> offsets_;
+  std::vector<std::string> names_;
+};
+
+} // ::g2field
+
+#endif
@@ -0,0 +1,171 @@
+#include "sequencer_timing.hh"
+
+//--- std includes ----------------------------------------------------------//
+#include <cmath>
+#include <cstdio>
+
+//--- other includes --------------------------------------------------------//
+#include "midas.h"
+
+namespace g2field {
+
+void TimingHistogram::Reset()
+{
+  for (auto &bin : bins_) {
+    bin.store(0);
+  }
+
+  count_.store(0);
+  sum_ns_.store(0);
+  max_ns_.store(0);
+}
+
+double TimingHistogram::BinLowEdge(int bin)
+{
+  return std::pow(2.0, (double)bin / kBinsPerOctave);
+}
+
+void TimingHistogram::Fill(double us)
+{
+  int bin = 0;
+
+  if (us > 1.0) {
+    bin = (int)(std::log2(us) * kBinsPerOctave);
+  }
+
+  if (bin >= kNumBins) {
+    bin = kNumBins - 1;
+  }
+
+  uint64_t ns = (us > 0.0) ? (uint64_t)(us * 1.0e3) : 0;
+
+  bins_[bin].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+
+  uint64_t prev = max_ns_.load(std::memory_order_relaxed);
+  while ((ns > prev) && !max_ns_.compare_exchange_weak(prev, ns));
+}
+
+double TimingHistogram::Percentile(double q) const
+{
+  uint64_t total = count_.load();
+
+  if (total == 0) {
+    return 0.0;
+  }
+
+  double target = q * total;
+  uint64_t cumulative = 0;
+
+  for (int i = 0; i < kNumBins; ++i) {
+    uint64_t n = bins_[i].load(std::memory_order_relaxed);
+
+    if ((n > 0) && (cumulative + n >= target)) {
+
+      // Interpolate geometrically inside the bin.
+      double frac = (target - cumulative) / n;
+      double lo = (i == 0) ? 0.0 : BinLowEdge(i);
+      double hi = BinLowEdge(i + 1);
+
+      if (i == 0) {
+        return frac * hi;
+      }
+
+      return lo * std::pow(hi / lo, frac);
+    }
+
+    cumulative += n;
+  }
+
+  return max_us();
+}
+
+const char *SequencerTiming::StageName(int stage)
+{
+  static const char *names[kNumStages] = {
+    "mux_configure",
+    "mux_settle",
+    "trigger_fire",
+    "trigger_skew",
+    "first_worker_data",
+    "all_workers_data",
+    "worker_skew",
+    "late_fragment",
+    "copy",
+    "fid_analysis",
+    "fid_collect",
+    "round",
+    "sequence"
+  };
+
+  if ((stage < 0) || (stage >= kNumStages)) {
+    return "unknown";
+  }
+
+  return names[stage];
+}
+
+void SequencerTiming::Reset()
+{
+  for (auto &hist : hist_) {
+    hist.Reset();
+  }
+}
+
+std::vector<timing_summary_t> SequencerTiming::Summary() const
+{
+  std::vector<timing_summary_t> summary;
+
+  for (int i = 0; i < kNumStages; ++i) {
+    timing_summary_t s;
+
+    s.stage = StageName(i);
+    s.count = hist_[i].count();
+    s.mean_us = hist_[i].mean_us();
+    s.p50_us = hist_[i].Percentile(0.50);
+    s.p90_us = hist_[i].Percentile(0.90);
+    s.p99_us = hist_[i].Percentile(0.99);
+    s.max_us = hist_[i].max_us();
+
+    summary.push_back(s);
+  }
+
+  return summary;
+}
+
+int SequencerTiming::PublishToOdb(const std::string &odb_dir) const
+{
+  HNDLE hDB;
+  char str[256];
+
+  cm_get_experiment_database(&hDB, NULL);
+
+  for (auto &s : Summary()) {
+    const char *key = odb_dir.c_str();
+    const char *stage = s.stage.c_str();
+    double count = s.count;
+
+    snprintf(str, sizeof(str), "%s/%s/count", key, stage);
+    db_set_value(hDB, 0, str, &count, sizeof(count), 1, TID_DOUBLE);
+
+    snprintf(str, sizeof(str), "%s/%s/mean_us", key, stage);
+    db_set_value(hDB, 0, str, &s.mean_us, sizeof(s.mean_us), 1, TID_DOUBLE);
+
+    snprintf(str, sizeof(str), "%s/%s/p50_us", key, stage);
+    db_set_value(hDB, 0, str, &s.p50_us, sizeof(s.p50_us), 1, TID_DOUBLE);
+
+    snprintf(str, sizeof(str), "%s/%s/p90_us", key, stage);
+    db_set_value(hDB, 0, str, &s.p90_us, sizeof(s.p90_us), 1, TID_DOUBLE);
+
+    snprintf(str, sizeof(str), "%s/%s/p99_us", key, stage);
+    db_set_value(hDB, 0, str, &s.p99_us, sizeof(s.p99_us), 1, TID_DOUBLE);
+
+    snprintf(str, sizeof(str), "%s/%s/max_us", key, stage);
+    db_set_value(hDB, 0, str, &s.max_us, sizeof(s.max_us), 1, TID_DOUBLE);
+  }
+
+  return SUCCESS;
+}
+
+} // ::g2field
@@ -0,0 +1,126 @@
+#ifndef FIELD_DAQ_FRONTENDS_OBJ_SEQUENCER_TIMING_HH_
+#define FIELD_DAQ_FRONTENDS_OBJ_SEQUENCER_TIMING_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   sequencer_timing.hh
+
+  about:  Always-on timing capture for the fixed probe sequencer.  Each
+          stage of a mux round fills a fixed-size, log-binned histogram
+          with lock-free counters, so recording is cheap enough to
+          leave on.  Percentile summaries can be logged or written to
+          the ODB.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace g2field {
+
+// Durations from 1 us to ~16 s, four bins per octave.
+class TimingHistogram {
+
+public:
+
+  static const int kBinsPerOctave = 4;
+  static const int kNumBins = 24 * kBinsPerOctave;
+
+  TimingHistogram() { Reset(); };
+
+  void Reset();
+
+  // Add one duration in microseconds.
+  void Fill(double us);
+
+  // Returns the q-th quantile (0 < q < 1) in microseconds.
+  double Percentile(double q) const;
+
+  inline uint64_t count() const { return count_.load(); };
+  inline double max_us() const { return 1.0e-3 * max_ns_.load(); };
+  inline double mean_us() const {
+    uint64_t n = count_.load();
+    return (n > 0) ? 1.0e-3 * sum_ns_.load() / n : 0.0;
+  };
+
+private:
+
+  std::array<std::atomic<uint64_t>, kNumBins> bins_;
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_ns_;
+  std::atomic<uint64_t> max_ns_;
+
+  static double BinLowEdge(int bin);
+};
+
+// Percentile summary of one stage.
+struct timing_summary_t {
+  std::string stage;
+  uint64_t count;
+  double mean_us;
+  double p50_us;
+  double p90_us;
+  double p99_us;
+  double max_us;
+};
+
+class SequencerTiming {
+
+public:
+
+  enum Stage {
+    kMuxConfigure = 0, // writing the mux settings for a round
+    kMuxSettle,        // waiting for the muxes to settle
+    kTriggerFire,      // firing the pulser/digitizer triggers
+    kTriggerSkew,      // first trigger board fired -> last board fired
+    kFirstWorkerData,  // trigger fired -> first digitizer has data
+    kAllWorkersData,   // trigger fired -> every digitizer has data
+    kWorkerSkew,       // first digitizer has data -> every digitizer has data
+    kLateFragment,     // gather deadline -> the last digitizer reported
+    kCopy,             // copying a round's traces into the event
+    kFidAnalysis,      // analyzing one probe's FID
+    kFidCollect,       // sequence done -> the FID workers' results are in
+    kRound,            // a whole round, first mux set to data copied
+    kSequence,         // a whole sequence, first mux set to event queued
+    kNumStages
+  };
+
+  // Monotonic time in nanoseconds for the stage bookkeeping.
+  static inline int64_t Now() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+      steady_clock::now().time_since_epoch()).count();
+  };
+
+  static const char *StageName(int stage);
+
+  inline void Record(Stage stage, int64_t t0_ns, int64_t t1_ns) {
+    hist_[stage].Fill(1.0e-3 * (t1_ns - t0_ns));
+  };
+
+  inline void Record(Stage stage, int64_t t0_ns) {
+    Record(stage, t0_ns, Now());
+  };
+
+  void Reset();
+
+  std::vector<timing_summary_t> Summary() const;
+
+  // Writes the summaries under odb_dir/<stage>/..., returns a MIDAS code.
+  int PublishToOdb(const std::string &odb_dir) const;
+
+private:
+
+  std::array<TimingHistogram, kNumStages> hist_;
+};
+
+} // ::g2field
+
+#endif
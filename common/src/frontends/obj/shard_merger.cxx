@@ -0,0 +1,508 @@
+#include "shard_merger.hh"
+
+//--- std includes ----------------------------------------------------------//
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+//--- other includes --------------------------------------------------------//
+#include "midas.h"
+
+//--- project includes ------------------------------------------------------//
+#include "fixed_probe_sequencer.hh"
+
+namespace g2field {
+
+namespace {
+
+const uint32_t kShardMagic = 0x46585348; // "FXSH"
+const int kRecvTimeoutMs = 100;
+
+inline int64_t steady_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(
+    steady_clock::now().time_since_epoch()).count();
+}
+
+// Sets the options every shard socket shares.
+void init_socket(zmq::socket_t &socket, int recv_timeout_ms)
+{
+  int linger = 0;
+  socket.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+
+  if (recv_timeout_ms >= 0) {
+    socket.setsockopt(ZMQ_RCVTIMEO, &recv_timeout_ms, sizeof(recv_timeout_ms));
+  }
+}
+
+// Reads a part off the wire, returns non-zero if it is malformed.
+int parse_shard_part(const zmq::message_t &msg, shard_part_t &part)
+{
+  const char *p = static_cast<const char *>(msg.data());
+
+  if (msg.size() < sizeof(shard_header_t)) return -1;
+  memcpy(&part.header, p, sizeof(shard_header_t));
+
+  auto &h = part.header;
+  size_t num_samples = (size_t)h.num_probes * h.trace_len;
+  size_t expected = sizeof(shard_header_t) +
+    h.num_probes * sizeof(shard_probe_t) + num_samples * sizeof(ushort);
+
+  if ((h.magic != kShardMagic) || (msg.size() != expected)) return -1;
+
+  p += sizeof(shard_header_t);
+  part.probes.resize(h.num_probes);
+  memcpy(part.probes.data(), p, h.num_probes * sizeof(shard_probe_t));
+
+  p += h.num_probes * sizeof(shard_probe_t);
+  part.traces.resize(num_samples);
+  memcpy(part.traces.data(), p, num_samples * sizeof(ushort));
+
+  return 0;
+}
+
+} // ::(anonymous)
+
+void pack_shard_part(uint32_t shard, uint64_t sequence,
+                     const nmr_vector &event, const std::vector<int> &probes,
+                     shard_part_t &part)
+{
+  const int len = NMR_FID_LENGTH_ONLINE;
+
+  part.header.magic = kShardMagic;
+  part.header.shard = shard;
+  part.header.sequence = sequence;
+  part.header.gps_ns = 0;
+  part.header.num_probes = probes.size();
+  part.header.trace_len = len;
+
+  part.probes.resize(probes.size());
+  part.traces.resize(probes.size() * len);
+
+  for (int i = 0; i < (int)probes.size(); ++i) {
+
+    int idx = probes[i];
+    auto &p = part.probes[i];
+
+    p.probe = idx;
+    p.method = event.method[idx];
+    p.health = event.health[idx];
+    p.clock_sys_ns = event.clock_sys_ns[idx];
+    p.clock_gps_ns = event.clock_gps_ns[idx];
+    p.device_clock = event.device_clock[idx];
+    p.device_rate_mhz = event.device_rate_mhz[idx];
+    p.device_gain_vpp = event.device_gain_vpp[idx];
+    p.fid_amp = event.fid_amp[idx];
+    p.fid_snr = event.fid_snr[idx];
+    p.fid_len = event.fid_len[idx];
+    p.freq = event.freq[idx];
+    p.ferr = event.ferr[idx];
+    p.freq_zc = event.freq_zc[idx];
+    p.ferr_zc = event.ferr_zc[idx];
+
+    std::copy(&event.trace[idx][0], &event.trace[idx][0] + len,
+              &part.traces[i * len]);
+
+    if ((p.clock_gps_ns > 0) &&
+        ((part.header.gps_ns == 0) || (p.clock_gps_ns < part.header.gps_ns))) {
+      part.header.gps_ns = p.clock_gps_ns;
+    }
+  }
+}
+
+void unpack_shard_part(const shard_part_t &part, nmr_vector &event)
+{
+  const int num_probes = event.freq.size();
+  const int len = std::min((int)part.header.trace_len,
+                           (int)NMR_FID_LENGTH_ONLINE);
+
+  for (int i = 0; i < (int)part.probes.size(); ++i) {
+
+    auto &p = part.probes[i];
+    int idx = p.probe;
+
+    if ((idx < 0) || (idx >= num_probes)) continue;
+
+    event.method[idx] = p.method;
+    event.health[idx] = p.health;
+    event.clock_sys_ns[idx] = p.clock_sys_ns;
+    event.clock_gps_ns[idx] = p.clock_gps_ns;
+    event.device_clock[idx] = p.device_clock;
+    event.device_rate_mhz[idx] = p.device_rate_mhz;
+    event.device_gain_vpp[idx] = p.device_gain_vpp;
+    event.fid_amp[idx] = p.fid_amp;
+    event.fid_snr[idx] = p.fid_snr;
+    event.fid_len[idx] = p.fid_len;
+    event.freq[idx] = p.freq;
+    event.ferr[idx] = p.ferr;
+    event.freq_zc[idx] = p.freq_zc;
+    event.ferr_zc[idx] = p.ferr_zc;
+
+    auto src = &part.traces[(size_t)i * part.header.trace_len];
+    std::copy(src, src + len, &event.trace[idx][0]);
+  }
+}
+
+ShardMerger::ShardMerger(int num_shards, int num_probes) :
+  num_shards_(num_shards), num_probes_(num_probes),
+  merge_timeout_ms_(5000), max_gps_skew_ns_(0),
+  next_sequence_(0), context_(1), thread_live_(false)
+{
+  stats_ = shard_merge_stats_t();
+}
+
+ShardMerger::~ShardMerger()
+{
+  Close();
+}
+
+int ShardMerger::Bind(const std::string &trigger_address,
+                      const std::string &merge_address)
+{
+  Close();
+
+  try {
+
+    trigger_socket_.reset(new zmq::socket_t(context_, ZMQ_PUB));
+    init_socket(*trigger_socket_, -1);
+    trigger_socket_->bind(trigger_address.c_str());
+
+    merge_socket_.reset(new zmq::socket_t(context_, ZMQ_PULL));
+    init_socket(*merge_socket_, kRecvTimeoutMs);
+    merge_socket_->bind(merge_address.c_str());
+
+  } catch (zmq::error_t &err) {
+
+    trigger_socket_.reset();
+    merge_socket_.reset();
+    return -1;
+  }
+
+  thread_live_ = true;
+  recv_thread_ = std::thread(&ShardMerger::RecvLoop, this);
+
+  return 0;
+}
+
+void ShardMerger::Close()
+{
+  thread_live_ = false;
+
+  if (recv_thread_.joinable()) {
+    recv_thread_.join();
+  }
+
+  trigger_socket_.reset();
+  merge_socket_.reset();
+}
+
+void ShardMerger::Reset()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto &pending : pending_) {
+    free_events_.push_back(std::move(pending.second.event));
+  }
+
+  pending_.clear();
+  stats_ = shard_merge_stats_t();
+}
+
+void ShardMerger::SetTimeout(int merge_timeout_ms, int64_t max_gps_skew_ns)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  merge_timeout_ms_ = merge_timeout_ms;
+  max_gps_skew_ns_ = max_gps_skew_ns;
+}
+
+uint64_t ShardMerger::Trigger()
+{
+  uint64_t sequence;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sequence = next_sequence_++;
+
+    // Open the sequence now, so it goes out even if no part arrives.
+    auto &pending = pending_[sequence];
+
+    if (!free_events_.empty()) {
+      pending.event = std::move(free_events_.back());
+      free_events_.pop_back();
+    }
+
+    MarkMissing(pending.event);
+    pending.have.assign(num_shards_, 0);
+    pending.num_parts = 0;
+    pending.gps_ns = 0;
+    pending.t_trigger_ns = steady_ns();
+
+    ++stats_.triggers;
+  }
+
+  if (trigger_socket_) {
+    zmq::message_t msg(sizeof(sequence));
+    memcpy(msg.data(), &sequence, sizeof(sequence));
+    trigger_socket_->send(msg);
+  }
+
+  return sequence;
+}
+
+int ShardMerger::AddPart(const shard_part_t &part)
+{
+  auto &h = part.header;
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = pending_.find(h.sequence);
+
+  if (it == pending_.end()) {
+    ++stats_.late;
+    return -1;
+  }
+
+  auto &pending = it->second;
+
+  if ((h.shard >= (uint32_t)num_shards_) || pending.have[h.shard]) {
+    ++stats_.mismatched;
+    return -1;
+  }
+
+  // The first timed part sets the sequence's GPS time.
+  if ((max_gps_skew_ns_ > 0) && (h.gps_ns > 0)) {
+
+    if (pending.gps_ns == 0) {
+      pending.gps_ns = h.gps_ns;
+
+    } else {
+
+      int64_t skew = (int64_t)(h.gps_ns - pending.gps_ns);
+
+      if (std::abs(skew) > max_gps_skew_ns_) {
+        ++stats_.mismatched;
+        return -1;
+      }
+    }
+  }
+
+  unpack_shard_part(part, pending.event);
+  pending.have[h.shard] = 1;
+  ++pending.num_parts;
+  ++stats_.parts;
+
+  return 0;
+}
+
+bool ShardMerger::TakeMerged(nmr_vector &event, uint64_t &sequence)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (pending_.empty()) return false;
+
+  // Strictly in order, a later sequence waits for the oldest.
+  auto it = pending_.begin();
+  auto &pending = it->second;
+
+  bool complete = (pending.num_parts >= num_shards_);
+  bool timed_out = (steady_ns() - pending.t_trigger_ns >
+                    1000000LL * merge_timeout_ms_);
+
+  if (!complete && !timed_out) return false;
+
+  if (complete) {
+    ++stats_.merged;
+  } else {
+    ++stats_.partial;
+  }
+
+  std::swap(event, pending.event);
+  free_events_.push_back(std::move(pending.event));
+
+  sequence = it->first;
+  pending_.erase(it);
+
+  return true;
+}
+
+shard_merge_stats_t ShardMerger::GetStats()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+int ShardMerger::PublishStats(const std::string &odb_dir)
+{
+  HNDLE hDB;
+  char str[256];
+
+  cm_get_experiment_database(&hDB, NULL);
+
+  auto s = GetStats();
+
+  std::vector<std::pair<const char *, uint64_t>> counts = {
+    {"triggers", s.triggers},
+    {"parts", s.parts},
+    {"merged", s.merged},
+    {"partial", s.partial},
+    {"late", s.late},
+    {"mismatched", s.mismatched}
+  };
+
+  for (auto &c : counts) {
+    DWORD val = c.second;
+    snprintf(str, sizeof(str), "%s/%s", odb_dir.c_str(), c.first);
+    db_set_value(hDB, 0, str, &val, sizeof(val), 1, TID_DWORD);
+  }
+
+  return SUCCESS;
+}
+
+void ShardMerger::RecvLoop()
+{
+  shard_part_t part;
+
+  while (thread_live_) {
+
+    zmq::message_t msg;
+
+    try {
+
+      if (!merge_socket_->recv(&msg)) continue;
+
+    } catch (zmq::error_t &err) {
+
+      if (err.num() != EINTR) break;
+      continue;
+    }
+
+    if (parse_shard_part(msg, part) != 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++stats_.mismatched;
+      continue;
+    }
+
+    AddPart(part);
+  }
+}
+
+void ShardMerger::MarkMissing(nmr_vector &event)
+{
+  if ((int)event.freq.size() != num_probes_) {
+    event.Resize(num_probes_);
+  }
+
+  std::fill(event.clock_sys_ns.begin(), event.clock_sys_ns.end(), 0);
+  std::fill(event.clock_gps_ns.begin(), event.clock_gps_ns.end(), 0);
+  std::fill(event.device_clock.begin(), event.device_clock.end(), 0);
+  std::fill(event.fid_amp.begin(), event.fid_amp.end(), 0.0);
+  std::fill(event.fid_snr.begin(), event.fid_snr.end(), 0.0);
+  std::fill(event.fid_len.begin(), event.fid_len.end(), 0.0);
+  std::fill(event.freq.begin(), event.freq.end(), 0.0);
+  std::fill(event.ferr.begin(), event.ferr.end(), 0.0);
+  std::fill(event.freq_zc.begin(), event.freq_zc.end(), 0.0);
+  std::fill(event.ferr_zc.begin(), event.ferr_zc.end(), 0.0);
+  std::fill(event.method.begin(), event.method.end(), (ushort)kMethodMissing);
+  std::fill(event.health.begin(), event.health.end(), 0);
+
+  for (auto &trace : event.trace) {
+    std::fill(trace.begin(), trace.end(), 0);
+  }
+}
+
+ShardClient::ShardClient(int shard_id) : shard_id_(shard_id), context_(1)
+{
+}
+
+ShardClient::~ShardClient()
+{
+  Close();
+}
+
+int ShardClient::Connect(const std::string &trigger_address,
+                         const std::string &merge_address)
+{
+  Close();
+
+  try {
+
+    trigger_socket_.reset(new zmq::socket_t(context_, ZMQ_SUB));
+    init_socket(*trigger_socket_, -1);
+    trigger_socket_->setsockopt(ZMQ_SUBSCRIBE, "", 0);
+    trigger_socket_->connect(trigger_address.c_str());
+
+    merge_socket_.reset(new zmq::socket_t(context_, ZMQ_PUSH));
+    init_socket(*merge_socket_, -1);
+    merge_socket_->connect(merge_address.c_str());
+
+  } catch (zmq::error_t &err) {
+
+    trigger_socket_.reset();
+    merge_socket_.reset();
+    return -1;
+  }
+
+  return 0;
+}
+
+void ShardClient::Close()
+{
+  trigger_socket_.reset();
+  merge_socket_.reset();
+}
+
+bool ShardClient::WaitTrigger(uint64_t &sequence, int timeout_ms)
+{
+  if (!trigger_socket_) return false;
+
+  zmq::message_t msg;
+  trigger_socket_->setsockopt(ZMQ_RCVTIMEO, &timeout_ms, sizeof(timeout_ms));
+
+  try {
+
+    if (!trigger_socket_->recv(&msg)) return false;
+
+  } catch (zmq::error_t &err) {
+
+    return false;
+  }
+
+  if (msg.size() != sizeof(sequence)) return false;
+
+  memcpy(&sequence, msg.data(), sizeof(sequence));
+  return true;
+}
+
+int ShardClient::Send(uint64_t sequence, const nmr_vector &event,
+                      const std::vector<int> &probes)
+{
+  if (!merge_socket_) return -1;
+
+  pack_shard_part(shard_id_, sequence, event, probes, part_);
+
+  size_t probe_bytes = part_.probes.size() * sizeof(shard_probe_t);
+  size_t trace_bytes = part_.traces.size() * sizeof(ushort);
+
+  zmq::message_t msg(sizeof(shard_header_t) + probe_bytes + trace_bytes);
+  char *p = static_cast<char *>(msg.data());
+
+  memcpy(p, &part_.header, sizeof(shard_header_t));
+  memcpy(p + sizeof(shard_header_t), part_.probes.data(), probe_bytes);
+  memcpy(p + sizeof(shard_header_t) + probe_bytes, part_.traces.data(),
+         trace_bytes);
+
+  try {
+
+    merge_socket_->send(msg);
+
+  } catch (zmq::error_t &err) {
+
+    return -1;
+  }
+
+  return 0;
+}
+
+} // ::g2field
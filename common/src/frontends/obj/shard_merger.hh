@@ -0,0 +1,200 @@
+#ifndef FIELD_DAQ_FRONTENDS_OBJ_SHARD_MERGER_HH_
+#define FIELD_DAQ_FRONTENDS_OBJ_SHARD_MERGER_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   shard_merger.hh
+
+  about:  Runs the fixed probes as several sequencer shards, one per
+          crate or board group, each with its own rounds.  The merging
+          shard announces every sequence on a PUB socket, and each shard
+          sends its probes back over PUSH.  The merger assembles them by
+          sequence number into one nmr_vector.  A part whose GPS time is
+          too far from the others is rejected as belonging to another
+          sequence, and a sequence missing parts past the timeout goes
+          out with those probes marked kMethodMissing.  Addresses can be
+          tcp:// or ipc://, so shards can be separate processes on a
+          single host.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+//--- other includes --------------------------------------------------------//
+#include <zmq.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "g2field/core/field_structs.hh"
+
+namespace g2field {
+
+// One probe of a shard's part, laid out flat for the wire.
+struct shard_probe_t {
+  uint32_t probe;        // index into the full event
+  uint16_t method;
+  uint16_t health;
+  uint64_t clock_sys_ns;
+  uint64_t clock_gps_ns;
+  uint64_t device_clock;
+  double device_rate_mhz;
+  double device_gain_vpp;
+  double fid_amp;
+  double fid_snr;
+  double fid_len;
+  double freq;
+  double ferr;
+  double freq_zc;
+  double ferr_zc;
+};
+
+struct shard_header_t {
+  uint32_t magic;
+  uint32_t shard;
+  uint64_t sequence;
+  uint64_t gps_ns;       // earliest GPS time of the probes, 0 if none
+  uint32_t num_probes;
+  uint32_t trace_len;
+};
+
+// A shard's probes of one sequence, with their traces back to back.
+struct shard_part_t {
+  shard_header_t header;
+  std::vector<shard_probe_t> probes;
+  std::vector<ushort> traces;
+};
+
+// Per-run accounting of the merge.
+struct shard_merge_stats_t {
+  uint64_t triggers;     // sequences announced
+  uint64_t parts;        // parts accepted
+  uint64_t merged;       // sequences with every part
+  uint64_t partial;      // sequences sent on with parts missing
+  uint64_t late;         // parts for a sequence already sent on
+  uint64_t mismatched;   // parts rejected for their GPS time
+};
+
+// Flattens the given probes of an event into part.
+void pack_shard_part(uint32_t shard, uint64_t sequence,
+                     const nmr_vector &event, const std::vector<int> &probes,
+                     shard_part_t &part);
+
+// Writes the probes of part into event, which must be sized.
+void unpack_shard_part(const shard_part_t &part, nmr_vector &event);
+
+class ShardMerger {
+
+ public:
+
+  ShardMerger(int num_shards, int num_probes);
+  ~ShardMerger();
+
+  // Binds the trigger and result sockets and starts receiving parts.
+  int Bind(const std::string &trigger_address,
+           const std::string &merge_address);
+
+  // Stops receiving and closes the sockets.
+  void Close();
+
+  // Drops the open sequences and the stats, for a new run.  Numbering
+  // continues, so stale parts of the last run are counted late.
+  void Reset();
+
+  // A sequence is sent on merge_timeout_ms after its trigger at the
+  // latest.  Parts more than max_gps_skew_ns from the first are rejected,
+  // zero turns the check off.
+  void SetTimeout(int merge_timeout_ms, int64_t max_gps_skew_ns);
+
+  // Announces the next sequence to the shards and returns its number.
+  uint64_t Trigger();
+
+  // Adds a part of a sequence, the merging shard's own or a received
+  // one.  Returns 0 if it was merged.
+  int AddPart(const shard_part_t &part);
+
+  // Swaps the oldest finished sequence into event, complete or timed
+  // out, and takes event's buffer for reuse.  False if none is ready.
+  bool TakeMerged(nmr_vector &event, uint64_t &sequence);
+
+  shard_merge_stats_t GetStats();
+
+  // Writes the merge counters of this run to the ODB.
+  int PublishStats(const std::string &odb_dir);
+
+  inline int num_shards() const { return num_shards_; };
+
+ private:
+
+  struct pending_t {
+    nmr_vector event;
+    std::vector<char> have;   // by shard
+    int num_parts;
+    uint64_t gps_ns;
+    int64_t t_trigger_ns;
+  };
+
+  int num_shards_;
+  int num_probes_;
+  int merge_timeout_ms_;
+  int64_t max_gps_skew_ns_;
+
+  std::mutex mutex_;
+  std::map<uint64_t, pending_t> pending_;
+  std::vector<nmr_vector> free_events_;
+  uint64_t next_sequence_;
+  shard_merge_stats_t stats_;
+
+  zmq::context_t context_;
+  std::unique_ptr<zmq::socket_t> trigger_socket_;
+  std::unique_ptr<zmq::socket_t> merge_socket_;
+  std::atomic<bool> thread_live_;
+  std::thread recv_thread_;
+
+  void RecvLoop();
+  void MarkMissing(nmr_vector &event);
+};
+
+class ShardClient {
+
+ public:
+
+  ShardClient(int shard_id);
+  ~ShardClient();
+
+  // Subscribes to the merger's triggers and connects the result socket.
+  int Connect(const std::string &trigger_address,
+              const std::string &merge_address);
+
+  void Close();
+
+  // Waits up to timeout_ms for the next sequence, false on timeout.
+  bool WaitTrigger(uint64_t &sequence, int timeout_ms);
+
+  // Sends the given probes of event as this shard's part of sequence.
+  int Send(uint64_t sequence, const nmr_vector &event,
+           const std::vector<int> &probes);
+
+  inline int shard_id() const { return shard_id_; };
+
+ private:
+
+  int shard_id_;
+  shard_part_t part_;
+
+  zmq::context_t context_;
+  std::unique_ptr<zmq::socket_t> trigger_socket_;
+  std::unique_ptr<zmq::socket_t> merge_socket_;
+};
+
+} // ::g2field
+
+#endif
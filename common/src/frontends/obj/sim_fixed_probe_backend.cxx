@@ -0,0 +1,444 @@
+#include "sim_fixed_probe_backend.hh"
+
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <functional>
+
+namespace g2field {
+
+namespace {
+const int kNoiseTableSize = 1 << 16;
+const double kTwoPi = 6.283185307179586;
+}
+
+SimFixedProbeBackend::SimFixedProbeBackend(const boost::property_tree::ptree &conf) :
+  num_triggers_(0), workers_running_(false), t_start_ns_(0)
+{
+  defaults_.freq_khz = conf.get<double>("freq_khz", 47.0);
+  defaults_.amplitude_adc = conf.get<double>("amplitude_adc", 2000.0);
+  defaults_.noise_adc = conf.get<double>("noise_adc", 20.0);
+  defaults_.latency_us = conf.get<double>("latency_us", 12000.0);
+
+  freq_spread_khz_ = conf.get<double>("freq_spread_khz", 1.0);
+  decay_ms_ = conf.get<double>("decay_ms", 3.0);
+  baseline_adc_ = conf.get<double>("baseline_adc", 16384.0);
+  latency_jitter_us_ = conf.get<double>("latency_jitter_us", 500.0);
+  mux_settle_us_ = conf.get<double>("mux_settle_us", 10000.0);
+  mux_set_us_ = conf.get<double>("mux_set_us", 20.0);
+  trigger_us_ = conf.get<double>("trigger_us", 50.0);
+  drop_rate_ = conf.get<double>("drop_rate", 0.0);
+
+  rng_.seed(conf.get<uint64_t>("seed", 2016));
+
+  // Per mux channel overrides, e.g., "channels": {"mux_01": {"ch_03": {}}}
+  auto channels = conf.get_child_optional("channels");
+
+  if (channels) {
+    for (auto &mux : *channels) {
+      for (auto &chan : mux.second) {
+
+        int ch = std::stoi(chan.first.substr(3)); // skip 'ch_'
+        sim_probe_t probe = GetProbe(mux.first, ch);
+
+        probe.freq_khz = chan.second.get<double>("freq_khz", probe.freq_khz);
+        probe.amplitude_adc = chan.second.get<double>("amplitude_adc",
+                                                      probe.amplitude_adc);
+        probe.noise_adc = chan.second.get<double>("noise_adc", probe.noise_adc);
+        probe.latency_us = chan.second.get<double>("latency_us",
+                                                   probe.latency_us);
+
+        probes_[std::make_pair(mux.first, ch)] = probe;
+      }
+    }
+  }
+
+  std::normal_distribution<double> normal(0.0, 1.0);
+  noise_.resize(kNoiseTableSize);
+
+  for (auto &val : noise_) {
+    val = normal(rng_);
+  }
+}
+
+int64_t SimFixedProbeBackend::Now()
+{
+  using namespace std::chrono;
+  auto t = steady_clock::now().time_since_epoch();
+  return duration_cast<nanoseconds>(t).count();
+}
+
+void SimFixedProbeBackend::Spend(double us)
+{
+  if (us > 0.0) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds((int64_t)(us * 1e3)));
+  }
+}
+
+int SimFixedProbeBackend::AddDigitizer(const std::string &model,
+                                       const std::string &name,
+                                       const std::string &conf_file)
+{
+  sim_wfd_t wfd;
+  wfd.name = name;
+  wfd.rate_mhz = 10.0;
+
+  if (model == std::string("sis_3302")) {
+    wfd.num_ch = 8;
+
+  } else if (model == std::string("sis_3316")) {
+    wfd.num_ch = 16;
+
+  } else {
+
+    return -1;
+  }
+
+  wfd.mux_names.resize(wfd.num_ch);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  wfds_.push_back(wfd);
+
+  return 0;
+}
+
+int SimFixedProbeBackend::AddTrigger(int board, int port, int trg_mask)
+{
+  ++num_triggers_;
+  return 0;
+}
+
+int SimFixedProbeBackend::AddMux(int board, const std::string &mux_name,
+                                 int port, const std::string &wfd_name,
+                                 int wfd_chan)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto &wfd : wfds_) {
+    if ((wfd.name == wfd_name) && (wfd_chan >= 0) && (wfd_chan < wfd.num_ch)) {
+
+      sim_mux_t mux;
+      mux.ch = -1;
+      mux.switch_ns = 0;
+
+      muxes_[mux_name] = mux;
+      wfd.mux_names[wfd_chan] = mux_name;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+void SimFixedProbeBackend::FreeDevices()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  wfds_.resize(0);
+  muxes_.clear();
+  num_triggers_ = 0;
+  workers_running_ = false;
+}
+
+int SimFixedProbeBackend::SetMux(int board, const std::string &mux_name, int ch)
+{
+  Spend(mux_set_us_);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = muxes_.find(mux_name);
+
+  if (it == muxes_.end()) {
+    return -1;
+  }
+
+  if (it->second.ch != ch) {
+    it->second.ch = ch;
+    it->second.switch_ns = Now();
+  }
+
+  return 0;
+}
+
+int SimFixedProbeBackend::FireTriggers(int trg_idx)
+{
+  Spend(trigger_us_);
+
+  // The digitizers are triggered along with the last pulser board.
+  if (trg_idx == num_triggers_ - 1) {
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (workers_running_) {
+      int64_t t_fire = Now();
+
+      for (int i = 0; i < (int)wfds_.size(); ++i) {
+        QueueEvent(i, t_fire);
+      }
+    }
+  }
+
+  return 0;
+}
+
+int SimFixedProbeBackend::FireTriggers(int trg_idx, int trg_mask)
+{
+  // Explicit masks only pulse the probes, the digitizers are
+  // triggered separately with GenerateTrigger.
+  Spend(trigger_us_);
+  return 0;
+}
+
+void SimFixedProbeBackend::StartRun()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto &wfd : wfds_) {
+    wfd.events.clear();
+  }
+
+  t_start_ns_ = Now();
+  workers_running_ = true;
+}
+
+void SimFixedProbeBackend::StopRun()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto &wfd : wfds_) {
+    wfd.events.clear();
+  }
+
+  workers_running_ = false;
+}
+
+void SimFixedProbeBackend::StartWorkers()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  workers_running_ = true;
+}
+
+void SimFixedProbeBackend::StopWorkers()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  workers_running_ = false;
+}
+
+bool SimFixedProbeBackend::AnyWorkersHaveEvent()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t now = Now();
+
+  for (auto &wfd : wfds_) {
+    if (IsReady(wfd, now)) return true;
+  }
+
+  return false;
+}
+
+bool SimFixedProbeBackend::AllWorkersHaveEvent()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t now = Now();
+
+  for (auto &wfd : wfds_) {
+    if (!IsReady(wfd, now)) return false;
+  }
+
+  return !wfds_.empty();
+}
+
+bool SimFixedProbeBackend::AnyWorkersHaveMultiEvent()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t now = Now();
+
+  for (auto &wfd : wfds_) {
+    if ((wfd.events.size() > 1) && (wfd.events[1].ready_ns <= now)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void SimFixedProbeBackend::FlushEventData()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t now = Now();
+
+  for (auto &wfd : wfds_) {
+    while (IsReady(wfd, now)) {
+      wfd.events.pop_front();
+    }
+  }
+}
+
+void SimFixedProbeBackend::GetEventData(hw::event_data_t &data)
+{
+  std::vector<sim_event_t> events;
+  std::vector<uint64_t> seeds;
+  std::vector<double> rates;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = Now();
+
+    events.resize(wfds_.size());
+    seeds.resize(wfds_.size());
+    rates.resize(wfds_.size());
+
+    for (int i = 0; i < (int)wfds_.size(); ++i) {
+      rates[i] = wfds_[i].rate_mhz;
+      seeds[i] = rng_();
+
+      if (IsReady(wfds_[i], now)) {
+        std::swap(events[i], wfds_[i].events.front());
+        wfds_[i].events.pop_front();
+      }
+    }
+  }
+
+  // Synthesis stands in for the VME readout, so do it unlocked.
+  data.resize(events.size());
+
+  for (int i = 0; i < (int)events.size(); ++i) {
+    ReadOut(events[i], rates[i], seeds[i], data[i]);
+  }
+}
+
+void SimFixedProbeBackend::ReadOut(const sim_event_t &event, double rate_mhz,
+                                   uint64_t seed, wfd_event_t &data) const
+{
+  auto &chans = event.chans;
+
+  data.trace.resize(chans.size());
+  data.dev_clock.resize(chans.size());
+
+  uint64_t clock = (event.fire_ns - t_start_ns_) * rate_mhz / 1000;
+
+  for (int ch = 0; ch < (int)chans.size(); ++ch) {
+    auto &trace = data.trace[ch];
+    trace.resize(NMR_FID_LENGTH_ONLINE);
+
+    data.dev_clock[ch] = clock;
+    Synthesize(chans[ch], rate_mhz, seed + ch, &trace[0], trace.size());
+  }
+}
+
+int SimFixedProbeBackend::GenerateTrigger(int wfd_idx)
+{
+  Spend(trigger_us_);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if ((wfd_idx < 0) || (wfd_idx >= (int)wfds_.size())) {
+    return -1;
+  }
+
+  QueueEvent(wfd_idx, Now());
+  return 0;
+}
+
+const sim_probe_t &SimFixedProbeBackend::GetProbe(const std::string &mux_name,
+                                                  int ch)
+{
+  auto key = std::make_pair(mux_name, ch);
+  auto it = probes_.find(key);
+
+  if (it != probes_.end()) {
+    return it->second;
+  }
+
+  // Spread the default frequencies reproducibly across the channels.
+  std::mt19937_64 gen(std::hash<std::string>()(mux_name) * 31 + ch);
+  std::uniform_real_distribution<double> spread(-1.0, 1.0);
+
+  sim_probe_t probe = defaults_;
+  probe.freq_khz += freq_spread_khz_ * spread(gen);
+
+  return probes_[key] = probe;
+}
+
+void SimFixedProbeBackend::QueueEvent(int wfd_idx, int64_t fire_ns)
+{
+  auto &wfd = wfds_[wfd_idx];
+  std::uniform_real_distribution<double> jitter(0.0, latency_jitter_us_);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  // A missed trigger, to exercise the round retries.
+  if ((drop_rate_ > 0.0) && (uniform(rng_) < drop_rate_)) {
+    return;
+  }
+
+  sim_event_t event;
+  event.fire_ns = fire_ns;
+  event.chans.resize(wfd.num_ch);
+
+  double latency_us = defaults_.latency_us;
+  bool any_connected = false;
+
+  for (int ch = 0; ch < wfd.num_ch; ++ch) {
+
+    auto &chan = event.chans[ch];
+    auto it = muxes_.find(wfd.mux_names[ch]);
+
+    chan.connected = (it != muxes_.end()) && (it->second.ch >= 0);
+
+    if (!chan.connected) {
+      chan.settled = 0.0;
+      chan.probe = defaults_;
+      continue;
+    }
+
+    chan.probe = GetProbe(it->first, it->second.ch);
+
+    double dt_us = 1e-3 * (fire_ns - it->second.switch_ns);
+    chan.settled = (mux_settle_us_ > 0.0) ?
+      std::min(1.0, dt_us / mux_settle_us_) : 1.0;
+
+    if (!any_connected || (chan.probe.latency_us > latency_us)) {
+      latency_us = chan.probe.latency_us;
+      any_connected = true;
+    }
+  }
+
+  event.ready_ns = fire_ns + (int64_t)(1e3 * (latency_us + jitter(rng_)));
+  wfd.events.push_back(event);
+}
+
+void SimFixedProbeBackend::Synthesize(const sim_chan_t &chan, double rate_mhz,
+                                      uint64_t seed, ushort *trace,
+                                      int len) const
+{
+  std::mt19937_64 gen(seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  const double dt_us = 1.0 / rate_mhz;
+  const double w = kTwoPi * chan.probe.freq_khz * 1e-3 * dt_us;
+  const double r = std::exp(-dt_us / (decay_ms_ * 1e3));
+  const double noise = chan.probe.noise_adc;
+  const int mask = kNoiseTableSize - 1;
+  const int offset = gen() & mask;
+
+  // Rotate a decaying phasor rather than call sin and exp per sample.
+  double amp = chan.connected ? chan.probe.amplitude_adc * chan.settled : 0.0;
+  double phase = kTwoPi * uniform(gen);
+  double re = amp * std::cos(phase);
+  double im = amp * std::sin(phase);
+  const double cr = r * std::cos(w);
+  const double ci = r * std::sin(w);
+
+  for (int n = 0; n < len; ++n) {
+
+    double val = baseline_adc_ + im + noise * noise_[(offset + n) & mask];
+    val = std::min(65535.0, std::max(0.0, val));
+    trace[n] = (ushort)(val + 0.5);
+
+    double tmp = re * cr - im * ci;
+    im = re * ci + im * cr;
+    re = tmp;
+  }
+}
+
+} // ::g2field
@@ -0,0 +1,153 @@
+#ifndef FIELD_DAQ_FRONTENDS_OBJ_SIM_FIXED_PROBE_BACKEND_HH_
+#define FIELD_DAQ_FRONTENDS_OBJ_SIM_FIXED_PROBE_BACKEND_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   sim_fixed_probe_backend.hh
+
+  about:  A hardware-free backend for the FixedProbeSequencer.  Firing
+          the last pulser trigger board latches the mux settings, and
+          each digitizer reports an event once the slowest of its
+          channels' latencies has passed.  The traces are synthetic FIDs
+          whose frequency, amplitude, noise and latency can be set per
+          mux channel.  A mux that has not settled when the triggers
+          fire gives a proportionally weaker FID.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <utility>
+#include <cstdint>
+
+//--- project includes ------------------------------------------------------//
+#include "fixed_probe_backend.hh"
+
+namespace g2field {
+
+// Signal model of one simulated probe.
+struct sim_probe_t {
+  double freq_khz;      // FID frequency
+  double amplitude_adc; // initial FID amplitude
+  double noise_adc;     // rms of the white noise
+  double latency_us;    // trigger to data available on the digitizer
+};
+
+class SimFixedProbeBackend : public FixedProbeBackend {
+
+ public:
+
+  // Takes the "sim" section of the sequencer config.
+  SimFixedProbeBackend(const boost::property_tree::ptree &conf);
+
+  std::string name() const { return std::string("sim"); };
+
+  int AddDigitizer(const std::string &model,
+                   const std::string &name,
+                   const std::string &conf_file);
+
+  int AddTrigger(int board, int port, int trg_mask);
+
+  int AddMux(int board, const std::string &mux_name, int port,
+             const std::string &wfd_name, int wfd_chan);
+
+  void FreeDevices();
+
+  int SetMux(int board, const std::string &mux_name, int ch);
+  int num_triggers() const { return num_triggers_; };
+  int FireTriggers(int trg_idx);
+  int FireTriggers(int trg_idx, int trg_mask);
+
+  void StartRun();
+  void StopRun();
+  void StartWorkers();
+  void StopWorkers();
+  bool AnyWorkersHaveEvent();
+  bool AllWorkersHaveEvent();
+  bool AnyWorkersHaveMultiEvent();
+  void FlushEventData();
+  void GetEventData(hw::event_data_t &data);
+  int GenerateTrigger(int wfd_idx);
+
+ private:
+
+  // What a digitizer channel saw when the triggers fired.
+  struct sim_chan_t {
+    bool connected;
+    double settled;  // fraction of the mux settle time elapsed
+    sim_probe_t probe;
+  };
+
+  struct sim_event_t {
+    int64_t fire_ns;
+    int64_t ready_ns;
+    std::vector<sim_chan_t> chans;
+  };
+
+  struct sim_wfd_t {
+    std::string name;
+    int num_ch;
+    double rate_mhz;
+    std::vector<std::string> mux_names; // mux wired to each channel
+    std::deque<sim_event_t> events;
+  };
+
+  struct sim_mux_t {
+    int ch;
+    int64_t switch_ns;
+  };
+
+  std::mutex mutex_;
+  std::vector<sim_wfd_t> wfds_;
+  std::map<std::string, sim_mux_t> muxes_;
+  std::map<std::pair<std::string, int>, sim_probe_t> probes_;
+  int num_triggers_;
+  bool workers_running_;
+  int64_t t_start_ns_;
+
+  // Model parameters, see the "sim" section of the sequencer config.
+  sim_probe_t defaults_;
+  double freq_spread_khz_;
+  double decay_ms_;
+  double baseline_adc_;
+  double latency_jitter_us_;
+  double mux_settle_us_;
+  double mux_set_us_;
+  double trigger_us_;
+  double drop_rate_;    // fraction of triggers a digitizer misses
+
+  std::mt19937_64 rng_;
+  std::vector<double> noise_; // unit normal samples, reused at random offsets
+
+  static int64_t Now();
+  static void Spend(double us);
+
+  // Returns the model of a mux channel, deriving and caching a default.
+  const sim_probe_t &GetProbe(const std::string &mux_name, int ch);
+
+  // Latches the mux state of a digitizer into a pending event.
+  void QueueEvent(int wfd_idx, int64_t fire_ns);
+
+  inline bool IsReady(const sim_wfd_t &wfd, int64_t now) const {
+    return !wfd.events.empty() && (wfd.events.front().ready_ns <= now);
+  };
+
+  // Synthesizes the traces and timestamp of a popped event.
+  void ReadOut(const sim_event_t &event, double rate_mhz, uint64_t seed,
+               wfd_event_t &data) const;
+
+  // Writes len samples of the channel's FID into trace.
+  void Synthesize(const sim_chan_t &chan, double rate_mhz, uint64_t seed,
+                  ushort *trace, int len) const;
+};
+
+} // ::g2field
+
+#endif
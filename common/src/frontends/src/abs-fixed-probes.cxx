@@ -34,6 +34,7 @@ using std::string;
 #include "g2field/core/field_constants.hh"
 #include "fixed_probe_sequencer.hh"
 #include "frontend_utils.hh"
+#include "trace_decimation.hh"
 
 //--- globals ---------------------------------------------------------------//
 #define FRONTEND_NAME "Abs Fixed Probes"
@@ -117,6 +118,9 @@ bool write_midas = true;
 bool use_stepper = true;
 bool ino_stepper_type = false;
 
+// Every tenth sample, offset to avoid spikes in the sis3302.
+g2field::TraceDecimator record_decimator(10, 1);
+
 TFile *pf;
 TTree *pt_abs;
 TTree *pt_full;
@@ -364,6 +368,8 @@ INT begin_of_run(INT run_number, char *error)
 
   // HW part
   event_rate_limit = conf.get<double>("event_rate_limit");
+  // Filter over the odd samples only, the even ones spike.
+  record_decimator.SetFilter(conf.get<int>("record_fir_taps", 0), 2);
 
   event_number = 0;
   run_in_progress = true;
@@ -485,7 +491,6 @@ INT read_fixed_probe_event(char *pevent, INT off)
   static unsigned long long events_written;
 
   // Allocate vectors for the FIDs
-  static std::vector<double> tm;
   static std::vector<double> wf;
 
   int count = 0;
@@ -506,34 +511,39 @@ INT read_fixed_probe_event(char *pevent, INT off)
     cm_msg(MDEBUG, "read_fixed_event", "got data");
   }
 
-  auto abs_data = event_manager->GetCurrentEvent();
+  // Take ownership of the event buffer, no trace copy.
+  auto abs_event = event_manager->TakeEvent();
 
+  if (!abs_event) {
+    return 0;
+  }
+
+  const auto &abs_data = *abs_event;
 
   if ((abs_data.clock_sys_ns[0] == 0) && (abs_data.clock_sys_ns[nprobes-1] == 0)) {
-    event_manager->PopCurrentEvent();
     triggered = false;
     return 0;
   }
 
-  // Set the time vector.
-  if (tm.size() == 0) {
-
-    tm.resize(g2field::kNmrFidLengthRecord);
+  // Allocate the waveform, the time axis is shared.
+  if (wf.size() == 0) {
     wf.resize(g2field::kNmrFidLengthRecord);
-
-    for (int n = 0; n < g2field::kNmrFidLengthRecord; ++n) {
-      tm[n] = 0.001 * n;
-    }
   }
 
+  const auto &tm = g2field::time_axis(0.001, g2field::kNmrFidLengthRecord);
+
   data_mutex.lock();
 
   for (int idx = 0; idx < nprobes; ++idx) {
 
-    for (int n = 0; n < g2field::kNmrFidLengthRecord; ++n) {
-      wf[n] = abs_data.trace[idx][n*10 + 1]; // Offset avoid spikes in sis3302
-      data.trace[idx][n] = wf[n];
-    }
+    record_decimator.Decimate(&abs_data.trace[idx][0],
+                              g2field::kNmrFidLengthOnline,
+                              &data.trace[idx][0],
+                              g2field::kNmrFidLengthRecord);
+
+    std::copy(&data.trace[idx][0],
+              &data.trace[idx][0] + g2field::kNmrFidLengthRecord,
+              wf.begin());
 
     fid::Fid myfid(wf, tm);
 
@@ -646,9 +656,8 @@ INT read_fixed_probe_event(char *pevent, INT off)
     bk_close(pevent, pdata);
   }
 
-  // Pop the event now that we are done copying it.
-  cm_msg(MINFO, "read_fixed_event", "Finished with event, popping from queue");
-  event_manager->PopCurrentEvent();
+  // The event buffer goes back to the sequencer when abs_event is released.
+  cm_msg(MINFO, "read_fixed_event", "Finished with event, releasing buffer");
 
   // Let the front-end know we are ready for another trigger.
   triggered = false;
@@ -19,11 +19,15 @@ About:  Implements a MIDAS frontend that is aware of the
 #include <sys/types.h>
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <array>
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <ctime>
 #include <random>
 #include <fstream>
+#include <thread>
 using std::string;
 
 //--- other includes --------------------------------------------------------//
@@ -35,7 +39,10 @@ using std::string;
 #include "g2field/core/field_structs.hh"
 #include "g2field/core/field_constants.hh"
 #include "fixed_probe_sequencer.hh"
+#include "shard_merger.hh"
 #include "frontend_utils.hh"
+#include "trace_decimation.hh"
+#include "fid_batch.hh"
 
 //--- globals ---------------------------------------------------------------//
 #define FRONTEND_NAME "Fixed Probes"
@@ -73,6 +80,7 @@ extern "C" {
 
   INT frontend_loop();
   INT read_fixed_probe_event(char *pevent, INT off);
+  INT read_fixed_probe_round(char *pevent, INT off);
   INT poll_event(INT source, INT count, BOOL test);
   INT interrupt_configure(INT cmd, INT source, POINTER_T adr);
 
@@ -80,7 +88,7 @@ extern "C" {
 
   EQUIPMENT equipment[] =
     {
-      {FRONTEND_NAME,  // equipment name
+      {FRONTEND_NAME "%02d",  // equipment name, with the frontend index
        { EVENTID_FIXED_PROBES, 0x01,        // event ID, trigger mask
          "SYSTEM",      // event buffer (use to be SYSTEM)
          EQ_PERIODIC,   // equipment type
@@ -97,6 +105,23 @@ extern "C" {
        read_fixed_probe_event,      // readout routine
       },
 
+      {"Fixed Probe Rounds%02d",  // equipment name, with the frontend index
+       { EVENTID_FIXED_PROBE_ROUNDS, 0x01,  // event ID, trigger mask
+         "SYSTEM",      // event buffer (use to be SYSTEM)
+         EQ_PERIODIC,   // equipment type
+         0,             // not used
+         "MIDAS",       // format
+         TRUE,          // enabled
+         RO_RUNNING,    // read only when running
+         10,            // poll for 10ms
+         0,             // stop run after this event limit
+         0,             // number of sub events
+         0,             // don't log history
+         "", "", "",
+       },
+       read_fixed_probe_round,      // readout routine, streamed rounds
+      },
+
       {""}
     };
 
@@ -114,12 +139,29 @@ bool write_full_waveform = false;
 int full_waveform_subsampling = 1;
 bool simulation_mode = false;
 bool recrunch_in_fe = false;
+bool batch_recrunch = false;
+bool direct_bank = false;
+
+// Recrunches the whole event at once when batch_recrunch is set.
+g2field::FidBatch recrunch_batch;
+
+// Every tenth sample, offset to avoid the wfd spikes.
+g2field::TraceDecimator record_decimator(10, 1);
 
 boost::property_tree::ptree conf;
 std::string nmr_sequence_conf_file;
 std::atomic<bool> run_in_progress;
 std::mutex data_mutex;
 
+// A sequence has been requested and its event not yet read.
+bool triggered = false;
+
+// Rounds streamed by the sequencer ahead of the full event.
+const int max_pending_rounds = 64;
+std::mutex round_mutex;
+std::deque<g2field::fixed_round_t> pending_rounds;
+unsigned long dropped_rounds = 0;
+
 // Data variables
 TFile *pf;
 TTree *pt;
@@ -131,16 +173,67 @@ g2field::FixedProbeSequencer *event_manager;
 
 const int nprobes = g2field::kNmrNumFixedProbes;
 const char *const mbank_name = (char *)"FXPR";
+const char *const qbank_name = (char *)"FXQS";
+const char *const rbank_name = (char *)"FXRD";
 
 std::vector<int> PSFB_probe; 
 
+// The latest results of every probe, from full events or streamed rounds.
+struct feedback_data_t {
+  double freq[nprobes];
+  double ferr[nprobes];
+  double freq_zc[nprobes];
+  double ferr_zc[nprobes];
+  double fid_snr[nprobes];
+  double fid_len[nprobes];
+  ushort health[nprobes];
+} feedback_data;
+
+// Under the equipment, which carries the frontend index (-i) if given.
+std::string timing_odb_dir;
+std::string queue_odb_dir;
+std::string fault_odb_dir;
+std::string shard_odb_dir;
+char equipment_name[NAME_LENGTH];
+
+// With more than one shard, shard 0 triggers the others, merges their
+// probes with its own and writes the events.  The other shards only
+// answer its triggers.  Each shard is a frontend started with its own
+// index, -i 0 to -i num_shards - 1, and reads the settings of its own
+// equipment, e.g. "/Equipment/Fixed Probes01/Settings".  A lone
+// frontend runs as -i 0.
+int shard_id = 0;
+int num_shards = 1;
+std::vector<int> shard_probes;
+
+// Shard 0's own sequencer takes one sequence at a time.  Its event is
+// filed under the sequence it was triggered for, unless the clock shows
+// it was measured before that trigger.  One that never comes is given
+// up after a few sequences.
+bool local_pending = false;
+uint64_t local_sequence = 0;
+uint64_t local_trigger_ns = 0;
+int local_skipped = 0;
+const int max_local_skipped = 3;
+g2field::ShardMerger *shard_merger = nullptr;
+g2field::ShardClient *shard_client = nullptr;
+std::atomic<bool> shard_live;
+std::thread shard_thread;
+
 }
 
 void trigger_loop();
 void set_json_tmpfiles();
 int load_device_classes();
 int simulate_fixed_probe_event();
+DWORD *open_fixed_banks(char *pevent);
+void decode_fixed_event(const g2field::nmr_vector &fp_data,
+                        g2field::fixed_t &out);
 void update_feedback_params();
+void queue_round(const g2field::fixed_round_t &round);
+int start_shards();
+void stop_shards();
+void shard_loop();
 void systems_check();
 int load_psfb_probes(); 
 
@@ -224,31 +317,163 @@ void set_json_tmpfiles()
 
 INT load_device_classes()
 {
-  // Set up the event mananger.
+  // Set up the event mananger once, later runs only reload what changed.
   if (event_manager == nullptr) {
     event_manager = new g2field::FixedProbeSequencer(nmr_sequence_conf_file, 
 						     nprobes);
+
+    event_manager->SetRoundCallback(queue_round);
+    event_manager->SetPriorityProbes(PSFB_probe);
+
+    if (event_manager->BeginOfRun() != 0) {
+      return FE_ERR_HW;
+    }
+
   } else {
 
-    event_manager->EndOfRun();
-    delete event_manager;
-    event_manager = new g2field::FixedProbeSequencer(nmr_sequence_conf_file, 
-						     nprobes);
+    event_manager->SetPriorityProbes(PSFB_probe);
+
+    if (event_manager->Reconfigure(nmr_sequence_conf_file) != 0) {
+      return FE_ERR_HW;
+    }
+  }
+
+  // A request left over from the last run will never be answered.
+  triggered = false;
+
+  {
+    std::lock_guard<std::mutex> lock(round_mutex);
+    pending_rounds.clear();
+    dropped_rounds = 0;
   }
 
-  event_manager->BeginOfRun();
+  return SUCCESS;
+}
+
+int start_shards()
+{
+  num_shards = conf.get<int>("shards.num_shards", 1);
+
+  if (num_shards <= 1) {
+    return SUCCESS;
+  }
+
+  shard_id = get_frontend_index();
+
+  if ((shard_id < 0) || (shard_id >= num_shards)) {
+    cm_msg(MERROR, "start_shards", "%i shards need frontend indices "
+           "0 to %i (-i), got %i", num_shards, num_shards - 1, shard_id);
+    return FE_ERR_HW;
+  }
+
+  auto trg_addr = conf.get<std::string>("shards.trigger_address",
+                                        "tcp://127.0.0.1:5571");
+  auto merge_addr = conf.get<std::string>("shards.merge_address",
+                                          "tcp://127.0.0.1:5572");
+
+  shard_probes = event_manager->GetProbeIndices();
+  local_pending = false;
+
+  cm_msg(MINFO, "start_shards", "shard %i of %i, %i probes", shard_id,
+         num_shards, (int)shard_probes.size());
+
+  if (shard_id == 0) {
+
+    shard_merger = new g2field::ShardMerger(num_shards, nprobes);
+    shard_merger->SetTimeout(
+      conf.get<int>("shards.merge_timeout_ms", 5000),
+      1000000LL * conf.get<int>("shards.max_gps_skew_ms", 500));
+
+    if (shard_merger->Bind(trg_addr, merge_addr) != 0) {
+      cm_msg(MERROR, "start_shards", "could not bind %s and %s",
+             trg_addr.c_str(), merge_addr.c_str());
+      return FE_ERR_HW;
+    }
+
+  } else {
+
+    shard_client = new g2field::ShardClient(shard_id);
+
+    if (shard_client->Connect(trg_addr, merge_addr) != 0) {
+      cm_msg(MERROR, "start_shards", "could not connect to %s and %s",
+             trg_addr.c_str(), merge_addr.c_str());
+      return FE_ERR_HW;
+    }
+
+    shard_live = true;
+    shard_thread = std::thread(shard_loop);
+  }
 
   return SUCCESS;
 }
 
+void stop_shards()
+{
+  shard_live = false;
+
+  if (shard_thread.joinable()) {
+    shard_thread.join();
+  }
+
+  if (shard_merger != nullptr) {
+    shard_merger->PublishStats(shard_odb_dir);
+    delete shard_merger;
+    shard_merger = nullptr;
+  }
+
+  if (shard_client != nullptr) {
+    delete shard_client;
+    shard_client = nullptr;
+  }
+}
+
+void shard_loop()
+{
+  uint64_t sequence;
+
+  while (shard_live) {
+
+    if (!shard_client->WaitTrigger(sequence, 100)) continue;
+
+    event_manager->IssueTrigger();
+
+    // The merger gives up on this sequence after its timeout, so a
+    // slow sequence is sent anyway and counted late there.
+    g2field::FixedProbeSequencer::event_handle_t fp_event;
+
+    while (shard_live && !(fp_event = event_manager->TakeEvent(100000)));
+
+    if (fp_event) {
+      shard_client->Send(sequence, *fp_event, shard_probes);
+    }
+  }
+}
+
 //--- Frontend Init ----------------------------------------------------------//
 INT frontend_init()
 {
+  // The equipment names take the frontend index, but mfe only expands
+  // them after this.
+  int fe_index = get_frontend_index();
+
+  if (fe_index < 0) {
+    cm_msg(MERROR, "frontend_init", "no frontend index, start with -i");
+    return FE_ERR_HW;
+  }
+
+  snprintf(equipment_name, NAME_LENGTH, equipment[0].name, fe_index);
+
+  std::string odb_dir = std::string("/Equipment/") + equipment_name;
+  timing_odb_dir = odb_dir + "/Sequencer/Timing";
+  queue_odb_dir = odb_dir + "/Sequencer/Queues";
+  fault_odb_dir = odb_dir + "/Sequencer/Faults";
+  shard_odb_dir = odb_dir + "/Sequencer/Shards";
+
   // Perform the initial hardware check.
   systems_check();
 
   // Load settings and save to temp files.
-  INT rc = load_settings(frontend_name, conf);
+  INT rc = load_settings(equipment_name, conf);
 
   if (rc != SUCCESS) {
     std::string al_msg("Fixed Probe System: failed to load settings from ODB");
@@ -258,15 +483,16 @@ INT frontend_init()
 
   set_json_tmpfiles();
 
+  // load probes for field avg (PS feedback stuff), the sequencer
+  // gives them a priority sub-sequence.
+  load_psfb_probes();
+
   rc = load_device_classes();
   if (rc != SUCCESS) {
     std::string al_msg("Fixed Probe System: failed to load device classes.");
     al_trigger_class("Error", al_msg.c_str(), false);
     return rc;
   }
-
-  // load probes for field avg (PS feedback stuff) 
-  load_psfb_probes();
  
   run_in_progress = false;
 
@@ -278,6 +504,7 @@ INT frontend_init()
 INT frontend_exit()
 {
   run_in_progress = false;
+  stop_shards();
 
   event_manager->EndOfRun();
   delete event_manager;
@@ -302,7 +529,7 @@ INT begin_of_run(INT run_number, char *error)
   std::string filename;
   
   // Load settings and save to temp files.
-  rc = load_settings(frontend_name, conf);
+  rc = load_settings(equipment_name, conf);
 
   if (rc != SUCCESS) {
     std::string al_msg("Fixed Probe System: failed to load settings from ODB");
@@ -376,9 +603,37 @@ INT begin_of_run(INT run_number, char *error)
   // HW part
   simulation_mode = conf.get<bool>("simulation_mode", simulation_mode);
   recrunch_in_fe = conf.get<bool>("recrunch_in_fe", recrunch_in_fe);
+  batch_recrunch = conf.get<bool>("batch_recrunch", batch_recrunch);
+  direct_bank = conf.get<bool>("direct_bank", direct_bank);
+
+  if (recrunch_in_fe && batch_recrunch) {
+    std::string fid_params = conf.get<std::string>("config.fid_analysis", "");
+
+    if ((fid_params != std::string("")) &&
+        (fid_params[0] != '/') && (fid_params[0] != '\\')) {
+      fid_params = hw::conf_dir + fid_params;
+    }
+
+    if ((fid_params != std::string("")) &&
+        (recrunch_batch.LoadParams(fid_params) != 0)) {
+      cm_msg(MERROR, "begin_of_run", "could not read %s, batch recrunch "
+             "keeps the default FID parameters", fid_params.c_str());
+    }
+  }
+
+  // Filter over the odd samples only, the even ones spike.
+  record_decimator.SetFilter(conf.get<int>("record_fir_taps", 0), 2);
 
   run_in_progress = true;
 
+  rc = start_shards();
+  if (rc != SUCCESS) {
+    std::string al_msg("Fixed Probe System: failed to connect the shards.");
+    al_trigger_class("Error", al_msg.c_str(), false);
+    run_in_progress = false;
+    return rc;
+  }
+
   cm_msg(MLOG, "begin_of_run", "Completed successfully");
 
   return SUCCESS;
@@ -387,10 +642,16 @@ INT begin_of_run(INT run_number, char *error)
 //--- End of Run ----------------------------------------------------*/
 INT end_of_run(INT run_number, char *error)
 {
-  // Destroy the event manager.
-  event_manager->EndOfRun();
-  delete event_manager;
-  event_manager = nullptr;
+  // Stop the digitizers, the threads and devices stay up and the next
+  // run reconfigures them in place.
+  event_manager->ParkRun();
+
+  // Keep the timing summary and queue counters of the full run.
+  event_manager->PublishTiming(timing_odb_dir);
+  event_manager->PublishQueueStats(queue_odb_dir);
+  event_manager->PublishFaultStats(fault_odb_dir);
+
+  stop_shards();
 
   // Make sure we write the ROOT data.
   if (run_in_progress && write_root) {
@@ -478,20 +739,206 @@ INT interrupt_configure(INT cmd, INT source, PTYPE adr)
 
 //--- Event readout -------------------------------------------------*/
 
+DWORD *open_fixed_banks(char *pevent)
+{
+  DWORD *pdata;
+
+  bk_init32(pevent);
+
+  // The queue counters so far, to tell VME-side from MIDAS-side losses:
+  // enqueued, dropped and high water of the data, then the run queue.
+  // Banks are padded to 8 bytes, so after this one the FXPR data is
+  // aligned for its doubles.
+  bk_create(pevent, qbank_name, TID_DWORD, &pdata);
+
+  for (auto &q : event_manager->GetQueueStats()) {
+    *(pdata++) = q.second.enqueued;
+    *(pdata++) = q.second.dropped;
+    *(pdata++) = q.second.high_water;
+  }
+
+  bk_close(pevent, pdata);
+
+  // Left open for the fixed probe data.
+  bk_create(pevent, mbank_name, TID_DWORD, &pdata);
+
+  return pdata;
+}
+
+void decode_fixed_event(const g2field::nmr_vector &fp_data,
+                        g2field::fixed_t &out)
+{
+  static std::vector<double> wf(g2field::kNmrFidLengthRecord);
+
+  // cm_msg(MINFO, frontend_name, "copying the data from event");
+  std::copy(fp_data.clock_sys_ns.begin(),
+	    fp_data.clock_sys_ns.begin() + nprobes,
+	    &out.clock_sys_ns[0]);
+
+  std::copy(fp_data.clock_gps_ns.begin(),
+	    fp_data.clock_gps_ns.begin() + nprobes,
+	    &out.clock_gps_ns[0]);
+
+  std::copy(fp_data.device_clock.begin(),
+	    fp_data.device_clock.begin() + nprobes,
+	    &out.device_clock[0]);
+
+  std::copy(fp_data.device_rate_mhz.begin(),
+	    fp_data.device_rate_mhz.begin() + nprobes,
+	    &out.device_rate_mhz[0]);
+
+  std::copy(fp_data.device_gain_vpp.begin(),
+	    fp_data.device_gain_vpp.begin() + nprobes,
+	    &out.device_gain_vpp[0]);
+
+  std::copy(fp_data.fid_amp.begin(),
+	    fp_data.fid_amp.begin() + nprobes,
+	    &out.fid_amp[0]);
+
+  std::copy(fp_data.fid_snr.begin(),
+	    fp_data.fid_snr.begin() + nprobes,
+	    &out.fid_snr[0]);
+
+  std::copy(fp_data.fid_len.begin(),
+	    fp_data.fid_len.begin() + nprobes,
+	    &out.fid_len[0]);
+
+  std::copy(fp_data.freq.begin(),
+	    fp_data.freq.begin() + nprobes,
+	    &out.freq[0]);
+
+  std::copy(fp_data.ferr.begin(),
+	    fp_data.ferr.begin() + nprobes,
+	    &out.ferr[0]);
+
+  std::copy(fp_data.freq_zc.begin(),
+	    fp_data.freq_zc.begin() + nprobes,
+	    &out.freq_zc[0]);
+
+  std::copy(fp_data.ferr_zc.begin(),
+	    fp_data.ferr_zc.begin() + nprobes,
+	    &out.ferr_zc[0]);
+
+  std::copy(fp_data.health.begin(),
+	    fp_data.health.begin() + nprobes,
+	    &out.health[0]);
+
+  for (int idx = 0; idx < nprobes; ++idx) {
+
+    record_decimator.Decimate(&fp_data.trace[idx][0],
+			      g2field::kNmrFidLengthOnline,
+			      &out.trace[idx][0],
+			      g2field::kNmrFidLengthRecord);
+
+    if (recrunch_in_fe && !batch_recrunch) {
+
+      // One cached time axis per device rate.
+      const auto &tm = g2field::time_axis(0.1 / fp_data.device_rate_mhz[idx],
+					  g2field::kNmrFidLengthRecord);
+
+      std::copy(&out.trace[idx][0],
+		&out.trace[idx][0] + g2field::kNmrFidLengthRecord,
+		wf.begin());
+
+      fid::Fid myfid(wf, tm);
+
+      // Make sure we got an FID signal
+      if (myfid.isgood()) {
+
+	out.freq[idx] = myfid.CalcPhaseFreq();
+	out.ferr[idx] = myfid.freq_err();
+	out.fid_amp[idx] = myfid.amp();
+	out.fid_snr[idx] = myfid.snr();
+	out.fid_len[idx] = myfid.fid_time();
+
+      } else {
+
+	myfid.DiagnosticInfo();
+	out.freq[idx] = -1.0;
+	out.ferr[idx] = -1.0;
+	out.fid_amp[idx] = -1.0;
+	out.fid_snr[idx] = -1.0;
+	out.fid_len[idx] = -1.0;
+      }
+    }
+  }
+
+  if (recrunch_in_fe && batch_recrunch && (nprobes > 0)) {
+
+    // The batch counts in samples of the first probe's rate, the
+    // other probes are rescaled to their own.
+    const double rate = fp_data.device_rate_mhz[0];
+
+    recrunch_batch.Reset(nprobes, g2field::kNmrFidLengthRecord, 0.1 / rate);
+
+    for (int idx = 0; idx < nprobes; ++idx) {
+      recrunch_batch.Load(idx, &out.trace[idx][0]);
+    }
+
+    recrunch_batch.Analyze();
+
+    for (int idx = 0; idx < nprobes; ++idx) {
+
+      double scale = fp_data.device_rate_mhz[idx] / rate;
+
+      if (recrunch_batch.health[idx] > 0) {
+
+	out.freq[idx] = recrunch_batch.freq_ph[idx] * scale;
+	out.ferr[idx] = recrunch_batch.ferr_ph[idx] * scale;
+	out.fid_amp[idx] = recrunch_batch.amp[idx];
+	out.fid_snr[idx] = recrunch_batch.snr[idx];
+	out.fid_len[idx] = recrunch_batch.fid_len[idx] / scale;
+
+      } else {
+
+	out.freq[idx] = -1.0;
+	out.ferr[idx] = -1.0;
+	out.fid_amp[idx] = -1.0;
+	out.fid_snr[idx] = -1.0;
+	out.fid_len[idx] = -1.0;
+      }
+    }
+  }
+}
+
 INT read_fixed_probe_event(char *pevent, INT off)
 {
   // Allocations
-  static bool triggered = false;
   static unsigned long long num_events;
-  static std::vector<double> tm;
-  static std::vector<double> wf;
 
-  char bk_name[10];
-  DWORD *pdata;
+  g2field::fixed_t *pout = &data;
+  DWORD *pbank = nullptr;
+
+  // The merging shard writes the events of the other shards.
+  if (shard_client != nullptr) {
+    return 0;
+  }
 
   // Trigger the digitizers if not triggered.
   if (!triggered) {
-    event_manager->IssueTrigger();
+
+    if (shard_merger != nullptr) {
+
+      uint64_t sequence = shard_merger->Trigger();
+
+      if (local_pending && (++local_skipped > max_local_skipped)) {
+        local_pending = false;
+      }
+
+      if (!local_pending) {
+        local_pending = true;
+        local_sequence = sequence;
+        local_trigger_ns = hw::systime_us() * 1000;
+        local_skipped = 0;
+
+        event_manager->IssueTrigger();
+      }
+
+    } else {
+
+      event_manager->IssueTrigger();
+    }
+
     cm_msg(MDEBUG, "read_fixed_probe_event", "issued trigger");
     triggered = true;
   }
@@ -502,124 +949,113 @@ INT read_fixed_probe_event(char *pevent, INT off)
     simulate_fixed_probe_event();
     triggered = false;
 
-  } else if (triggered && !event_manager->HasEvent()) {
+  } else if (triggered && (shard_merger == nullptr) &&
+             !event_manager->HasEvent()) {
     // No event yet.
     //cm_msg(MDEBUG, "read_fixed_probe_event", "no data yet");
     return 0;
 
   } else {
 
-    cm_msg(MDEBUG, "read_fixed_probe_event", "got event data event");
+    // Take ownership of the event buffer, no trace copy.
+    g2field::FixedProbeSequencer::event_handle_t fp_event;
+    const g2field::nmr_vector *fp_ptr = nullptr;
 
-    auto fp_data = event_manager->GetCurrentEvent();
-    event_manager->PopCurrentEvent();
+    if (shard_merger != nullptr) {
 
-    if ((fp_data.clock_sys_ns[0] == 0) && 
-	(fp_data.clock_sys_ns[nprobes-1] == 0)) {
+      static g2field::nmr_vector merged_event;
+      static g2field::shard_part_t local_part;
+      static unsigned long num_merged = 0;
+      uint64_t sequence;
 
-      triggered = false;
-      return 0;
-    }
+      // Hand our own probes over, then wait for the other shards.
+      auto local_event = event_manager->TakeEvent();
 
-    // Set the time vector.
-    if (tm.size() == 0) {
-      tm.resize(g2field::kNmrFidLengthRecord);
-      wf.resize(g2field::kNmrFidLengthRecord);
-    }
+      if (local_event && local_pending) {
 
-    data_mutex.lock();
+	uint64_t t_first = ~0ULL;
 
-    // cm_msg(MINFO, frontend_name, "copying the data from event");
-    std::copy(fp_data.clock_sys_ns.begin(),
-	      fp_data.clock_sys_ns.begin() + nprobes,
-	      &data.clock_sys_ns[0]);
-    
-    std::copy(fp_data.clock_gps_ns.begin(),
-	      fp_data.clock_gps_ns.begin() + nprobes,
-	      &data.clock_gps_ns[0]);
-    
-    std::copy(fp_data.device_clock.begin(),
-	      fp_data.device_clock.begin() + nprobes,
-	      &data.device_clock[0]);
+	for (int idx : shard_probes) {
+	  t_first = std::min(t_first,
+			     (uint64_t)local_event->clock_sys_ns[idx]);
+	}
 
-    std::copy(fp_data.device_rate_mhz.begin(),
-	      fp_data.device_rate_mhz.begin() + nprobes,
-	      &data.device_rate_mhz[0]);
+	if (t_first >= local_trigger_ns) {
+	  g2field::pack_shard_part(0, local_sequence, *local_event,
+				   shard_probes, local_part);
+	  shard_merger->AddPart(local_part);
+	  local_pending = false;
+	}
+      }
 
-    std::copy(fp_data.device_gain_vpp.begin(),
-	      fp_data.device_gain_vpp.begin() + nprobes,
-	      &data.device_gain_vpp[0]);
-    
-    std::copy(fp_data.fid_amp.begin(),
-	      fp_data.fid_amp.begin() + nprobes,
-	      &data.fid_amp[0]);
+      if (!shard_merger->TakeMerged(merged_event, sequence)) {
+	return 0;
+      }
 
-    std::copy(fp_data.fid_snr.begin(),
-	      fp_data.fid_snr.begin() + nprobes,
-	      &data.fid_snr[0]);
-    
-    std::copy(fp_data.fid_len.begin(),
-	      fp_data.fid_len.begin() + nprobes,
-	      &data.fid_len[0]);
+      // The ODB stats are refreshed now and then, and at the end.
+      if (++num_merged % 10 == 0) {
+	shard_merger->PublishStats(shard_odb_dir);
+      }
+
+      fp_ptr = &merged_event;
+
+    } else {
 
-    std::copy(fp_data.freq.begin(),
-	      fp_data.freq.begin() + nprobes,
-	      &data.freq[0]);
+      fp_event = event_manager->TakeEvent();
 
-    std::copy(fp_data.ferr.begin(),
-	      fp_data.ferr.begin() + nprobes,
-	      &data.ferr[0]);
+      if (!fp_event) {
+	return 0;
+      }
 
-    std::copy(fp_data.freq_zc.begin(),
-	      fp_data.freq_zc.begin() + nprobes,
-	      &data.freq_zc[0]);
+      fp_ptr = fp_event.get();
+    }
 
-    std::copy(fp_data.ferr_zc.begin(),
-	      fp_data.ferr_zc.begin() + nprobes,
-	      &data.ferr_zc[0]);
+    cm_msg(MDEBUG, "read_fixed_probe_event", "got event data event");
 
-    std::copy(fp_data.health.begin(),
-	      fp_data.health.begin() + nprobes,
-	      &data.health[0]);
+    const auto &fp_data = *fp_ptr;
 
-    for (int idx = 0; idx < nprobes; ++idx) {
-      
-      for (int n = 0; n < g2field::kNmrFidLengthRecord; ++n) {
-	wf[n] = fp_data.trace[idx][n*10 + 1]; // Offset avoids wfd spikes
-	tm[n] = 0.1 * n / fp_data.device_rate_mhz[idx];
-	data.trace[idx][n] = wf[n];
-      }
+    // One event per sequence, so refresh the timing, queue and fault
+    // summaries.
+    event_manager->PublishTiming(timing_odb_dir);
+    event_manager->PublishQueueStats(queue_odb_dir);
+    event_manager->PublishFaultStats(fault_odb_dir);
 
-      if (recrunch_in_fe) {
-	
-	fid::Fid myfid(wf, tm);
-      
-	// Make sure we got an FID signal
-	if (myfid.isgood()) {
-	  
-	  data.freq[idx] = myfid.CalcPhaseFreq();
-	  data.ferr[idx] = myfid.freq_err();
-	  data.fid_amp[idx] = myfid.amp();
-	  data.fid_snr[idx] = myfid.snr();
-	  data.fid_len[idx] = myfid.fid_time();
-	  
-	} else {
-	  
-	  myfid.DiagnosticInfo();
-	  data.freq[idx] = -1.0;
-	  data.ferr[idx] = -1.0;
-	  data.fid_amp[idx] = -1.0;
-	  data.fid_snr[idx] = -1.0;
-	  data.fid_len[idx] = -1.0;
-	}
+    if ((fp_data.clock_sys_ns[0] == 0) && 
+	(fp_data.clock_sys_ns[nprobes-1] == 0)) {
+
+      triggered = false;
+      return 0;
+    }
+
+    // Decode straight into the bank when it sits aligned, else into
+    // data and copy it over below.
+    if (direct_bank && write_midas) {
+
+      pbank = open_fixed_banks(pevent);
+
+      if ((uintptr_t)pbank % alignof(g2field::fixed_t) == 0) {
+	pout = reinterpret_cast<g2field::fixed_t *>(pbank);
       }
     }
 
-    data_mutex.unlock();
+    if (pout == &data) {
+      std::lock_guard<std::mutex> lock(data_mutex);
+      decode_fixed_event(fp_data, data);
+
+    } else {
+
+      decode_fixed_event(fp_data, *pout);
+    }
   }
 
   if (write_root && run_in_progress) {
-    // Now that we have a copy of the latest event, fill the tree.
+    // The branch reads data, an event decoded into the bank is copied
+    // back for it.
+    if (pout != &data) {
+      std::lock_guard<std::mutex> lock(data_mutex);
+      memcpy(&data, pout, sizeof(g2field::fixed_t));
+    }
+
     pt->Fill();
 
     if (write_full_waveform) {
@@ -641,21 +1077,35 @@ INT read_fixed_probe_event(char *pevent, INT off)
   }
 
   // And MIDAS output.
-  bk_init32(pevent);
-
   if (write_midas) {
 
-    // Copy the fixed probe data.
-    bk_create(pevent, mbank_name, TID_DWORD, &pdata);
+    if (pbank == nullptr) {
+      pbank = open_fixed_banks(pevent);
+    }
 
-    memcpy(pdata, &data, sizeof(data));
-    pdata += sizeof(data) / sizeof(DWORD);
+    // Copy the fixed probe data, unless it was decoded in place.
+    if ((void *)pbank != (void *)pout) {
+      memcpy(pbank, pout, sizeof(g2field::fixed_t));
+    }
+
+    bk_close(pevent, pbank + sizeof(g2field::fixed_t) / sizeof(DWORD));
+
+  } else {
 
-    bk_close(pevent, pdata);
+    bk_init32(pevent);
   }
 
   // Pop the event now that we are done copying it.
   cm_msg(MDEBUG, "read_fixed_event", "Updating PS Feedback variables");
+
+  std::copy(&pout->freq[0], &pout->freq[0] + nprobes, feedback_data.freq);
+  std::copy(&pout->ferr[0], &pout->ferr[0] + nprobes, feedback_data.ferr);
+  std::copy(&pout->freq_zc[0], &pout->freq_zc[0] + nprobes, feedback_data.freq_zc);
+  std::copy(&pout->ferr_zc[0], &pout->ferr_zc[0] + nprobes, feedback_data.ferr_zc);
+  std::copy(&pout->fid_snr[0], &pout->fid_snr[0] + nprobes, feedback_data.fid_snr);
+  std::copy(&pout->fid_len[0], &pout->fid_len[0] + nprobes, feedback_data.fid_len);
+  std::copy(&pout->health[0], &pout->health[0] + nprobes, feedback_data.health);
+
   update_feedback_params();
 
   // Let the front-end know we are ready for another trigger.
@@ -664,6 +1114,78 @@ INT read_fixed_probe_event(char *pevent, INT off)
   return bk_size(pevent);
 }
 
+//--- Streamed rounds -----------------------------------------------*/
+void queue_round(const g2field::fixed_round_t &round)
+{
+  // Called from the builder thread, so only copy and return.
+  std::lock_guard<std::mutex> lock(round_mutex);
+
+  if ((int)pending_rounds.size() >= max_pending_rounds) {
+    pending_rounds.pop_front();
+    ++dropped_rounds;
+  }
+
+  pending_rounds.push_back(round);
+}
+
+INT read_fixed_probe_round(char *pevent, INT off)
+{
+  g2field::fixed_round_t round;
+  unsigned long dropped;
+  DWORD *pdata;
+
+  {
+    std::lock_guard<std::mutex> lock(round_mutex);
+
+    if (pending_rounds.empty()) {
+      return 0;
+    }
+
+    round = pending_rounds.front();
+    pending_rounds.pop_front();
+    dropped = dropped_rounds;
+  }
+
+  bk_init32(pevent);
+
+  // Header: sequence (2 words), round, number of rounds, number of
+  // probes, flags, rounds dropped so far, padding.  Then one
+  // fixed_round_probe_t per probe.
+  bk_create(pevent, rbank_name, TID_DWORD, &pdata);
+
+  *(pdata++) = round.sequence & 0xffffffff;
+  *(pdata++) = round.sequence >> 32;
+  *(pdata++) = round.round;
+  *(pdata++) = round.num_rounds;
+  *(pdata++) = round.probes.size();
+  *(pdata++) = round.flags;
+  *(pdata++) = dropped;
+  *(pdata++) = 0;
+
+  int nbytes = round.probes.size() * sizeof(g2field::fixed_round_probe_t);
+  memcpy(pdata, round.probes.data(), nbytes);
+  pdata += nbytes / sizeof(DWORD);
+
+  bk_close(pevent, pdata);
+
+  // Feedback probes only need their sub-sequence, not the full event.
+  for (auto &p : round.probes) {
+    feedback_data.freq[p.probe] = p.freq;
+    feedback_data.ferr[p.probe] = p.ferr;
+    feedback_data.freq_zc[p.probe] = p.freq_zc;
+    feedback_data.ferr_zc[p.probe] = p.ferr_zc;
+    feedback_data.fid_snr[p.probe] = p.fid_snr;
+    feedback_data.fid_len[p.probe] = p.fid_len;
+    feedback_data.health[p.probe] = p.health;
+  }
+
+  if (round.flags & g2field::fixed_round_t::kSubsequenceEnd) {
+    update_feedback_params();
+  }
+
+  return bk_size(pevent);
+}
+
 INT simulate_fixed_probe_event()
 {
   // Allocate vectors for the FIDs
@@ -810,19 +1332,19 @@ void update_feedback_params()
   for (int i = 0; i < nprobes; ++i) {
     
     if (use_zc) {
-      freq[i] = data.freq_zc[i];
-      ferr[i] = data.ferr_zc[i];
+      freq[i] = feedback_data.freq_zc[i];
+      ferr[i] = feedback_data.ferr_zc[i];
 
     } else {
 
-      freq[i] = data.freq[i];
-      ferr[i] = data.ferr[i];
+      freq[i] = feedback_data.freq[i];
+      ferr[i] = feedback_data.ferr[i];
     }
 
-    fid_snr[i] = data.fid_snr[i];
-    fid_len[i] = data.fid_len[i];
+    fid_snr[i] = feedback_data.fid_snr[i];
+    fid_len[i] = feedback_data.fid_len[i];
    
-    if (data.health[i] > health_thresh) {
+    if (feedback_data.health[i] > health_thresh) {
       uniform_mean_freq += freq[i];
       weighted_mean_freq += freq[i] / (ferr[i] + 0.001);
 
@@ -0,0 +1,182 @@
+/*****************************************************************************\
+
+Name:   fid_batch_bench.cxx
+Author: Matthias W. Smith
+Email:  mwsmith2@uw.edu
+
+About:  Benchmarks the batched FID analysis against fid::FastFid one
+        probe at a time.  It simulates an event of decaying FIDs with
+        known frequencies, analyzes it both ways, and reports the
+        throughput in probes per second and how far the batch results
+        are from FastFid's and from the true frequencies.
+
+\*****************************************************************************/
+
+//--- std includes ----------------------------------------------------------//
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+//--- other includes --------------------------------------------------------//
+#include "fid.h"
+
+//--- project includes ------------------------------------------------------//
+#include "fid_batch.hh"
+#include "trace_decimation.hh"
+#include "g2field/core/field_constants.hh"
+
+//--- globals ---------------------------------------------------------------//
+namespace {
+
+// The decimated traces the sequencer analyzes.
+const int len = NMR_FID_LENGTH_ONLINE / 2;
+const double dt = NMR_SAMPLE_PERIOD * 2;
+
+// Largest and rms difference, for the report.
+struct diff_t {
+  double max;
+  double sum2;
+  int n;
+
+  diff_t() : max(0.0), sum2(0.0), n(0) {};
+
+  void Add(double d) {
+    max = std::max(max, std::fabs(d));
+    sum2 += d * d;
+    ++n;
+  };
+
+  double rms() const { return (n > 0) ? std::sqrt(sum2 / n) : 0.0; };
+};
+
+}
+
+int main(int argc, char *argv[])
+{
+  using namespace std::chrono;
+
+  if (argc < 2) {
+    printf("usage:\n");
+    printf("fid_batch_bench <fid-params-file> [num-probes] [iterations]\n");
+    return 1;
+  }
+
+  std::string params_file(argv[1]);
+  int num_probes = (argc > 2) ? atoi(argv[2]) : 378;
+  int iterations = (argc > 3) ? atoi(argv[3]) : 10;
+
+  fid::load_params(params_file);
+
+  g2field::FidBatch batch;
+
+  if (batch.LoadParams(params_file) != 0) {
+    printf("fid_batch_bench: could not read %s\n", params_file.c_str());
+    return 1;
+  }
+
+  // Simulate the event, ADC counts around a baseline.
+  std::mt19937 gen(1234);
+  std::uniform_real_distribution<double> freq_dist(45.0, 50.0);
+  std::uniform_real_distribution<double> phase_dist(0.0, 2 * M_PI);
+  std::normal_distribution<double> noise(0.0, 20.0);
+
+  std::vector<double> freq(num_probes);
+  std::vector<std::vector<unsigned short>> traces(num_probes);
+
+  for (int p = 0; p < num_probes; ++p) {
+
+    freq[p] = freq_dist(gen);
+    double phase = phase_dist(gen);
+    traces[p].resize(len);
+
+    for (int s = 0; s < len; ++s) {
+      double t = s * dt;
+      double v = 8192.0 + noise(gen) +
+        2000.0 * std::exp(-t / 3.0) * std::cos(2 * M_PI * freq[p] * t + phase);
+      traces[p][s] = (unsigned short)std::lround(v);
+    }
+  }
+
+  const auto &tm = g2field::time_axis(dt, len);
+  std::vector<double> wf(len);
+
+  // One probe at a time, as the sequencer does now.
+  std::vector<double> ff_freq(num_probes), ff_amp(num_probes);
+  std::vector<double> ff_snr(num_probes), ff_len(num_probes);
+
+  auto t0 = steady_clock::now();
+
+  for (int it = 0; it < iterations; ++it) {
+    for (int p = 0; p < num_probes; ++p) {
+
+      std::copy(traces[p].begin(), traces[p].end(), wf.begin());
+      fid::FastFid myfid(wf, tm);
+
+      ff_freq[p] = myfid.CalcFreq();
+      ff_amp[p] = myfid.amp();
+      ff_snr[p] = myfid.snr();
+      ff_len[p] = myfid.fid_time();
+    }
+  }
+
+  double ff_s = 1e-6 * duration_cast<microseconds>(steady_clock::now() -
+                                                   t0).count();
+
+  // The whole event at once.
+  batch.Reset(num_probes, len, dt);
+
+  t0 = steady_clock::now();
+
+  for (int it = 0; it < iterations; ++it) {
+
+    for (int p = 0; p < num_probes; ++p) {
+      batch.Load(p, &traces[p][0]);
+    }
+
+    batch.Analyze();
+  }
+
+  double batch_s = 1e-6 * duration_cast<microseconds>(steady_clock::now() -
+                                                      t0).count();
+
+  diff_t zc_ff, zc_true, ph_true, amp_ff, snr_ff, len_ff;
+
+  for (int p = 0; p < num_probes; ++p) {
+    zc_ff.Add(batch.freq_zc[p] - ff_freq[p]);
+    zc_true.Add(batch.freq_zc[p] - freq[p]);
+    ph_true.Add(batch.freq_ph[p] - freq[p]);
+    amp_ff.Add((batch.amp[p] - ff_amp[p]) / ff_amp[p]);
+    snr_ff.Add((batch.snr[p] - ff_snr[p]) / ff_snr[p]);
+    len_ff.Add(batch.fid_len[p] - ff_len[p]);
+  }
+
+  printf("\n--- batched FID analysis benchmark ---\n");
+  printf("event:          %i probes x %i samples, %i iterations\n",
+         num_probes, len, iterations);
+  printf("fid::FastFid:   %.0f probes/s\n",
+         num_probes * iterations / ff_s);
+  printf("FidBatch:       %.0f probes/s, %.1fx\n",
+         num_probes * iterations / batch_s, ff_s / batch_s);
+
+  printf("\n%-26s %12s %12s\n", "difference", "rms", "max");
+  printf("%-26s %12.3e %12.3e\n", "freq_zc - FastFid [kHz]",
+         zc_ff.rms(), zc_ff.max);
+  printf("%-26s %12.3e %12.3e\n", "freq_zc - true [kHz]",
+         zc_true.rms(), zc_true.max);
+  printf("%-26s %12.3e %12.3e\n", "freq_ph - true [kHz]",
+         ph_true.rms(), ph_true.max);
+  printf("%-26s %12.3e %12.3e\n", "amp / FastFid - 1",
+         amp_ff.rms(), amp_ff.max);
+  printf("%-26s %12.3e %12.3e\n", "snr / FastFid - 1",
+         snr_ff.rms(), snr_ff.max);
+  printf("%-26s %12.3e %12.3e\n", "fid_len - FastFid [ms]",
+         len_ff.rms(), len_ff.max);
+  printf("\n");
+
+  return 0;
+}
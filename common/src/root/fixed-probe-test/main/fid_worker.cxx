@@ -0,0 +1,68 @@
+/*****************************************************************************\
+
+Name:   fid_worker.cxx
+Author: Matthias W. Smith
+Email:  mwsmith2@uw.edu
+
+About:  Analyzes FIDs for a fixed probe sequencer with "fid_workers"
+        configured.  It connects to the sequencer's job and result
+        sockets and answers jobs until interrupted, so the analysis
+        scales by starting more of these, here or on other nodes.
+
+\*****************************************************************************/
+
+//--- std includes ----------------------------------------------------------//
+#include <csignal>
+#include <iostream>
+#include <atomic>
+#include <string>
+
+//--- other includes --------------------------------------------------------//
+#include "fid.h"
+
+//--- project includes ------------------------------------------------------//
+#include "fid_worker_pool.hh"
+
+//--- globals ---------------------------------------------------------------//
+namespace {
+std::atomic<bool> worker_live(true);
+}
+
+void stop_worker(int)
+{
+  worker_live = false;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 4) {
+    std::cout << "usage:" << std::endl;
+    std::cout << "fid_worker <fid-params-file> <job-address> <result-address>";
+    std::cout << std::endl;
+    std::cout << "  e.g. fid_worker config/fid-params.json ";
+    std::cout << "tcp://fe-host:5581 tcp://fe-host:5582" << std::endl;
+    return 1;
+  }
+
+  fid::load_params(std::string(argv[1]));
+
+  g2field::FidWorker worker;
+
+  if (worker.Connect(argv[2], argv[3]) != 0) {
+    std::cout << "fid_worker: could not connect to " << argv[2];
+    std::cout << " and " << argv[3] << std::endl;
+    return 1;
+  }
+
+  signal(SIGINT, stop_worker);
+  signal(SIGTERM, stop_worker);
+
+  while (worker_live) {
+    worker.Serve(100);
+  }
+
+  std::cout << "fid_worker: analyzed " << worker.num_served();
+  std::cout << " FIDs" << std::endl;
+
+  return 0;
+}
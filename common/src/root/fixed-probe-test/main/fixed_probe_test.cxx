@@ -5,7 +5,14 @@ Author: Matthias W. Smith
 Email:  mwsmith2@uw.edu
 
 About:  Implements a test front-end that sequences fixed probes and
-        writes a ROOT file.
+        writes a ROOT file.  With "backend": "sim" in the config it runs
+        without hardware, and it doubles as a throughput benchmark: at
+        exit it reports the sustained sequences per second and the
+        per-round and per-stage latencies, the queue and round fault
+        counters and the time saved by pruning failing probes.  With a
+        "shards" block in the config several copies run as shards of one
+        sequence, shard 0 merges the events and the others only answer
+        its triggers.
 
 \*****************************************************************************/
 
@@ -13,23 +20,26 @@ About:  Implements a test front-end that sequences fixed probes and
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <sys/types.h>
 #include <iostream>
 #include <vector>
 #include <atomic>
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cmath>
 #include <ctime>
 using std::string;
 
 //--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
 #include "TFile.h"
 #include "TTree.h"
 
 //--- project includes ------------------------------------------------------//
 #include "fixed_probe_sequencer.hh"
+#include "shard_merger.hh"
+#include "trace_decimation.hh"
 #include "g2field/core/field_structs.hh"
 
 //--- globals ---------------------------------------------------------------//
@@ -39,16 +49,33 @@ namespace {
 int event_total = 120;
 std::atomic<int> event_count(0);
 double event_rate_limit = 1.0;
-bool save_full_waveforms = false;
+double event_timeout_s = 30.0;
+bool write_root = true;
 
 // ROOT vars
 TFile *pf;
 TTree *pt;
 
 g2field::fixed_t data;
-g2field::online_fixed_t full_data;
 g2field::FixedProbeSequencer *event_manager;
 
+// Benchmark bookkeeping
+std::chrono::steady_clock::time_point t_start;
+std::vector<double> sequence_times_ms;
+
+// With "stream_rounds" on, when the first round of a sequence arrived.
+std::atomic<long> streamed_rounds(0);
+std::atomic<bool> first_round_seen(false);
+std::chrono::steady_clock::time_point t_first_round;
+std::vector<double> first_round_times_ms;
+
+// Shards, as in the frontend.
+int shard_id = 0;
+int num_shards = 1;
+std::vector<int> shard_probes;
+g2field::ShardMerger *shard_merger = nullptr;
+g2field::ShardClient *shard_client = nullptr;
+
 // Constants
 const int nprobes = g2field::kNmrNumFixedProbes;
 }
@@ -56,18 +83,38 @@ const int nprobes = g2field::kNmrNumFixedProbes;
 int m_init(int argc, char *argv[]);
 int m_exit();
 int read_event();
+int answer_trigger();
+void print_report();
 
 int main(int argc, char *argv[])
 {
-  m_init(argc, argv);
+  if (m_init(argc, argv) != 0) {
+    return 1;
+  }
 
   while (event_count < event_total) {
-    read_event();
-    usleep(1e6 / event_rate_limit);
+
+    if (shard_client != nullptr) {
+
+      if (answer_trigger() != 0) {
+        break;
+      }
+
+      continue;
+    }
+
+    if (read_event() != 0) {
+      break;
+    }
+
+    if (event_rate_limit > 0.0) {
+      usleep(1e6 / event_rate_limit);
+    }
   }
 
+  print_report();
   m_exit();
-  
+
   return 0;
 }
 
@@ -76,46 +123,103 @@ int main(int argc, char *argv[])
 //---------------------------------------------------------------------------//
 int m_init(int argc, char *argv[])
 {
-  // Allocations
-  int rc = 0;
   std::string conf_file;
   std::string filename;
 
   // Parse args
-  if (argc >= 2) {
+  if (argc >= 3) {
 
     conf_file = std::string(argv[1]);
     filename = std::string(argv[2]);
 
+    if (argc >= 4) {
+      event_total = std::atoi(argv[3]);
+    }
+
   } else {
 
     std::cout << "usage:" << std::endl;
-    std::cout << "fixed_probe_test <config-file> <output-file>" << std::endl;
+    std::cout << "fixed_probe_test <config-file> <output-file> [num-sequences]";
+    std::cout << std::endl;
+    std::cout << "  an output-file of '-' skips the ROOT output" << std::endl;
     exit(1);
   }
 
-  // Optional args
-  save_full_waveforms = false;
-  event_rate_limit = 1.0; 
+  // Optional config, zero rate limit runs sequences back to back.
+  boost::property_tree::ptree conf;
+  boost::property_tree::read_json(conf_file, conf);
 
-  // Set up the ROOT output.
-  pf = new TFile(filename.c_str(), "recreate");
-  pt = new TTree("t", "Fixed Probe Test Data");
-  pt->SetAutoSave(5);
-  pt->SetAutoFlush(20);
+  event_rate_limit = conf.get<double>("event_rate_limit", 1.0);
+  event_timeout_s = conf.get<double>("event_timeout_s", event_timeout_s);
+  write_root = (filename != std::string("-"));
 
-  pt->Branch("fixed", &data.sys_clock[0], g2field::fixed_str);
+  // Set up the ROOT output.
+  if (write_root) {
+    pf = new TFile(filename.c_str(), "recreate");
+    pt = new TTree("t", "Fixed Probe Test Data");
+    pt->SetAutoSave(5);
+    pt->SetAutoFlush(20);
 
-  if (save_full_waveforms) {
-    pt->Branch("full_fixed",
-               &full_data.sys_clock[0],
-               g2field::online_fixed_str);
+    pt->Branch("fixed", &data.clock_sys_ns[0], g2field::fixed_str);
   }
 
   // Set up the event mananger.
   event_manager = new g2field::FixedProbeSequencer(conf_file, nprobes);
 
-  event_manager->BeginOfRun();
+  event_manager->SetRoundCallback([](const g2field::fixed_round_t &round) {
+    if (!first_round_seen) {
+      t_first_round = std::chrono::steady_clock::now();
+      first_round_seen = true;
+    }
+    ++streamed_rounds;
+  });
+
+  if (event_manager->BeginOfRun() != 0) {
+    std::cout << "fixed_probe_test: BeginOfRun failed" << std::endl;
+    return -1;
+  }
+
+  num_shards = conf.get<int>("shards.num_shards", 1);
+  shard_id = conf.get<int>("shards.shard_id", 0);
+
+  if (num_shards > 1) {
+
+    auto trg_addr = conf.get<std::string>("shards.trigger_address",
+                                          "tcp://127.0.0.1:5571");
+    auto merge_addr = conf.get<std::string>("shards.merge_address",
+                                            "tcp://127.0.0.1:5572");
+    int rc;
+
+    shard_probes = event_manager->GetProbeIndices();
+
+    if (shard_id == 0) {
+
+      shard_merger = new g2field::ShardMerger(num_shards, nprobes);
+      shard_merger->SetTimeout(
+        conf.get<int>("shards.merge_timeout_ms", 5000),
+        1000000LL * conf.get<int>("shards.max_gps_skew_ms", 500));
+
+      rc = shard_merger->Bind(trg_addr, merge_addr);
+
+    } else {
+
+      shard_client = new g2field::ShardClient(shard_id);
+      rc = shard_client->Connect(trg_addr, merge_addr);
+    }
+
+    if (rc != 0) {
+      std::cout << "fixed_probe_test: could not open the shard sockets";
+      std::cout << std::endl;
+      return -1;
+    }
+
+    std::cout << "fixed_probe_test: shard " << shard_id << " of ";
+    std::cout << num_shards << ", " << shard_probes.size() << " probes";
+    std::cout << std::endl;
+  }
+
+  sequence_times_ms.reserve(event_total);
+  t_start = std::chrono::steady_clock::now();
 
   return 0;
 }
@@ -126,163 +230,294 @@ int m_init(int argc, char *argv[])
 int m_exit()
 {
   // Make sure we write the ROOT data.
-  pt->Write();
-  pf->Write();
-  pf->Close();
+  if (write_root) {
+    pt->Write();
+    pf->Write();
+    pf->Close();
 
-  delete pf;
+    delete pf;
+  }
 
   // Clean up the event manager.
   event_manager->EndOfRun();
   delete event_manager;
 
+  delete shard_merger;
+  delete shard_client;
+
   return 0;
 }
 
 //--- read_event ------------------------------------------------------------//
 int read_event()
 {
-  static bool triggered = false;
-  static unsigned long long num_events;
-  static unsigned long long events_written;
+  using namespace std::chrono;
+
+  // Trigger a sequence and wait for the event to be built.
+  auto t0 = steady_clock::now();
+  first_round_seen = false;
 
-  // Allocate vectors for the FIDs
-  static std::vector<double> tm;
-  static std::vector<double> wf;
+  uint64_t sequence = 0;
 
-  if (!triggered) {
-    event_manager->IssueTrigger();
-    triggered = true;
+  if (shard_merger != nullptr) {
+    sequence = shard_merger->Trigger();
   }
 
-  if (triggered && !event_manager->HasEvent()) {
+  event_manager->IssueTrigger();
 
-    std::cout << "Event Manager has no data, exiting readout" << std::endl;
-    return 0;
+  auto fp_event = event_manager->TakeEvent();
 
-  } else {
+  while (!fp_event) {
+
+    if (duration_cast<seconds>(steady_clock::now() - t0).count() >
+        event_timeout_s) {
+      std::cout << "read_event: no event after " << event_timeout_s;
+      std::cout << " s, stopping" << std::endl;
+      return -1;
+    }
 
-    std::cout << "Event Manager has data, beginning readout" << std::endl;
-    
+    usleep(100);
+    fp_event = event_manager->TakeEvent();
   }
 
-  auto event_data = event_manager->GetCurrentEvent();
+  // Merge our own probes with the other shards'.
+  static g2field::nmr_vector merged_event;
+  const g2field::nmr_vector *fp_ptr = fp_event.get();
 
-  std::cout << "event_readout: copied data" << std::endl;
+  if (shard_merger != nullptr) {
 
-  if ((event_data.sys_clock[0] == 0) && (event_data.sys_clock[nprobes-1] == 0)) {
-    event_manager->PopCurrentEvent();
-    triggered = false;
-    std::cout << "event_readout: empty event, aborting" << std::endl;
-    return 0;
+    static g2field::shard_part_t local_part;
+
+    g2field::pack_shard_part(0, sequence, *fp_event, shard_probes, local_part);
+    shard_merger->AddPart(local_part);
+
+    while (!shard_merger->TakeMerged(merged_event, sequence)) {
+      usleep(100);
+    }
+
+    fp_ptr = &merged_event;
   }
 
-  // Set the time vector.
-  if (tm.size() == 0) {
+  double dt_ms = 1e-3 * duration_cast<microseconds>(steady_clock::now() - t0).count();
+  sequence_times_ms.push_back(dt_ms);
+
+  if (first_round_seen) {
+    first_round_times_ms.push_back(
+      1e-3 * duration_cast<microseconds>(t_first_round - t0).count());
+  }
 
-    tm.resize(g2field::kNmrFidLengthRecord);
-    wf.resize(g2field::kNmrFidLengthRecord);
+  const auto &event_data = *fp_ptr;
 
-    for (int n = 0; n < g2field::kNmrFidLengthRecord; ++n) {
-      tm[n] = 0.001 * n;
+  if (write_root) {
+
+    std::copy(event_data.clock_sys_ns.begin(),
+              event_data.clock_sys_ns.begin() + nprobes,
+              &data.clock_sys_ns[0]);
+
+    std::copy(event_data.clock_gps_ns.begin(),
+              event_data.clock_gps_ns.begin() + nprobes,
+              &data.clock_gps_ns[0]);
+
+    std::copy(event_data.device_clock.begin(),
+              event_data.device_clock.begin() + nprobes,
+              &data.device_clock[0]);
+
+    std::copy(event_data.device_rate_mhz.begin(),
+              event_data.device_rate_mhz.begin() + nprobes,
+              &data.device_rate_mhz[0]);
+
+    std::copy(event_data.device_gain_vpp.begin(),
+              event_data.device_gain_vpp.begin() + nprobes,
+              &data.device_gain_vpp[0]);
+
+    std::copy(event_data.fid_amp.begin(),
+              event_data.fid_amp.begin() + nprobes,
+              &data.fid_amp[0]);
+
+    std::copy(event_data.fid_snr.begin(),
+              event_data.fid_snr.begin() + nprobes,
+              &data.fid_snr[0]);
+
+    std::copy(event_data.fid_len.begin(),
+              event_data.fid_len.begin() + nprobes,
+              &data.fid_len[0]);
+
+    std::copy(event_data.freq.begin(),
+              event_data.freq.begin() + nprobes,
+              &data.freq[0]);
+
+    std::copy(event_data.ferr.begin(),
+              event_data.ferr.begin() + nprobes,
+              &data.ferr[0]);
+
+    std::copy(event_data.freq_zc.begin(),
+              event_data.freq_zc.begin() + nprobes,
+              &data.freq_zc[0]);
+
+    std::copy(event_data.ferr_zc.begin(),
+              event_data.ferr_zc.begin() + nprobes,
+              &data.ferr_zc[0]);
+
+    std::copy(event_data.method.begin(),
+              event_data.method.begin() + nprobes,
+              &data.method[0]);
+
+    std::copy(event_data.health.begin(),
+              event_data.health.begin() + nprobes,
+              &data.health[0]);
+
+    // Every tenth sample, offset to avoid spikes.
+    static g2field::TraceDecimator decimator(10, 1);
+
+    for (int idx = 0; idx < nprobes; ++idx) {
+      decimator.Decimate(&event_data.trace[idx][0],
+                         g2field::kNmrFidLengthOnline,
+                         &data.trace[idx][0],
+                         g2field::kNmrFidLengthRecord);
     }
-  }
 
-  for (int idx = 0; idx < nprobes; ++idx) {
-    
-    std::cout << "read_event: re-analyzing event " << idx << std::endl;
+    // Now that we have a copy of the latest event, fill the tree.
+    pt->Fill();
 
-    for (int n = 0; n < g2field::kNmrFidLengthRecord; ++n) {
-      wf[n] = event_data.trace[idx][n*10 + 1]; // Offset avoid spikes in sis3302
-      data.trace[idx][n] = wf[n];
+    if (event_count % 10 == 1) {
+      pt->AutoSave("SaveSelf,FlushBaskets");
+      pf->Flush();
     }
+  }
 
-    std::cout << "read_event: copied waveform " << idx << std::endl;
+  event_count++;
+  std::cout << "read_event: sequence " << event_count << " took ";
+  std::cout << dt_ms << " ms" << std::endl;
 
-    fid::FastFid myfid(wf, tm);
+  return 0;
+}
 
-    std::cout << "read_event: Fid initialized " << idx << std::endl;
+//--- answer_trigger --------------------------------------------------------//
+int answer_trigger()
+{
+  using namespace std::chrono;
 
-    // Make sure we got an FID signal
-    if (myfid.isgood()) {
+  // The merging shard sets the pace, stop once it has gone quiet.
+  uint64_t sequence;
 
-      //      data.freq[idx] = myfid.CalcPhaseFreq();
-      data.freq[idx] = myfid.freq();
-      data.ferr[idx] = myfid.freq_err();
-      data.snr[idx] = myfid.snr();
-      data.len[idx] = myfid.fid_time();
+  if (!shard_client->WaitTrigger(sequence, 1000 * event_timeout_s)) {
+    std::cout << "answer_trigger: no trigger after " << event_timeout_s;
+    std::cout << " s, stopping" << std::endl;
+    return -1;
+  }
 
-    } else {
+  auto t0 = steady_clock::now();
+  event_manager->IssueTrigger();
 
-      myfid.DiagnosticInfo();
-      data.freq[idx] = -1.0;
-      data.ferr[idx] = -1.0;
-      data.snr[idx] = -1.0;
-      data.len[idx] = -1.0;
+  auto fp_event = event_manager->TakeEvent();
+
+  while (!fp_event) {
+
+    if (duration_cast<seconds>(steady_clock::now() - t0).count() >
+        event_timeout_s) {
+      std::cout << "answer_trigger: no event after " << event_timeout_s;
+      std::cout << " s, stopping" << std::endl;
+      return -1;
     }
+
+    usleep(100);
+    fp_event = event_manager->TakeEvent();
   }
 
-  std::copy(event_data.sys_clock.begin(),
-            event_data.sys_clock.begin() + nprobes,
-            &data.sys_clock[0]);
+  shard_client->Send(sequence, *fp_event, shard_probes);
 
-  std::copy(event_data.gps_clock.begin(),
-            event_data.gps_clock.begin() + nprobes,
-            &data.gps_clock[0]);
+  double dt_ms = 1e-3 * duration_cast<microseconds>(steady_clock::now() - t0).count();
+  sequence_times_ms.push_back(dt_ms);
+
+  event_count++;
+  return 0;
+}
 
-  std::copy(event_data.dev_clock.begin(),
-            event_data.dev_clock.begin() + nprobes,
-            &data.dev_clock[0]);
+//--- print_report ----------------------------------------------------------//
+void print_report()
+{
+  using namespace std::chrono;
 
-  std::copy(event_data.snr.begin(),
-            event_data.snr.begin() + nprobes,
-            &data.snr[0]);
+  double elapsed_s = 1e-6 * duration_cast<microseconds>(steady_clock::now() -
+                                                        t_start).count();
 
-  std::copy(event_data.len.begin(),
-            event_data.len.begin() + nprobes,
-            &data.len[0]);
+  std::sort(sequence_times_ms.begin(), sequence_times_ms.end());
 
-  std::copy(event_data.freq.begin(),
-            event_data.freq.begin() + nprobes,
-            &data.freq[0]);
+  printf("\n--- fixed probe sequencer benchmark ---\n");
+  printf("sequences:      %i in %.2f s\n", (int)event_count, elapsed_s);
 
-  std::copy(event_data.ferr.begin(),
-            event_data.ferr.begin() + nprobes,
-            &data.ferr[0]);
+  if (elapsed_s > 0.0) {
+    printf("throughput:     %.3f sequences/s\n", event_count / elapsed_s);
+  }
 
-  std::copy(event_data.freq_zc.begin(),
-            event_data.freq_zc.begin() + nprobes,
-            &data.freq_zc[0]);
+  if (!sequence_times_ms.empty()) {
+    int n = sequence_times_ms.size();
+    printf("trigger->event: p50 = %.1f ms, p90 = %.1f ms, max = %.1f ms\n",
+           sequence_times_ms[n / 2],
+           sequence_times_ms[(9 * n) / 10],
+           sequence_times_ms[n - 1]);
+  }
 
-  std::copy(event_data.ferr_zc.begin(),
-            event_data.ferr_zc.begin() + nprobes,
-            &data.ferr_zc[0]);
+  if (!first_round_times_ms.empty()) {
+    std::sort(first_round_times_ms.begin(), first_round_times_ms.end());
+    int n = first_round_times_ms.size();
+    printf("trigger->round: p50 = %.1f ms, max = %.1f ms, %li rounds streamed\n",
+           first_round_times_ms[n / 2], first_round_times_ms[n - 1],
+           (long)streamed_rounds);
+  }
 
-  std::copy(event_data.method.begin(),
-            event_data.method.begin() + nprobes,
-            &data.method[0]);
+  printf("\n%-18s %8s %10s %10s %10s %10s %10s\n", "stage [us]", "count",
+         "mean", "p50", "p90", "p99", "max");
 
-  std::copy(event_data.health.begin(),
-            event_data.health.begin() + nprobes,
-            &data.health[0]);
+  for (auto &s : event_manager->GetTiming()) {
+    printf("%-18s %8lu %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+           s.stage.c_str(), (unsigned long)s.count, s.mean_us,
+           s.p50_us, s.p90_us, s.p99_us, s.max_us);
+  }
 
-  // Now that we have a copy of the latest event, fill the tree.
-  pt->Fill();
-  
-  num_events++;
+  printf("\n%-18s %8s %10s %10s %10s %10s\n", "queue", "capacity",
+         "enqueued", "dropped", "high", "blocked");
 
-  if (num_events % 10 == 1) {
-    
-    pt->AutoSave("SaveSelf,FlushBaskets");
-    pf->Flush();
+  for (auto &q : event_manager->GetQueueStats()) {
+    printf("%-18s %8lu %10lu %10lu %10lu %10lu\n", q.first.c_str(),
+           (unsigned long)q.second.capacity, (unsigned long)q.second.enqueued,
+           (unsigned long)q.second.dropped, (unsigned long)q.second.high_water,
+           (unsigned long)q.second.blocked);
   }
 
-  // Pop the event now that we are done copying it.
-  event_manager->PopCurrentEvent();
+  auto faults = event_manager->GetFaultStats();
 
-  // Let the front-end know we are ready for another trigger.
-  triggered = false;
-  event_count++;
+  printf("\nfaults:         %lu rounds, %lu retries, %lu abandoned, "
+         "%lu desyncs, %lu probes missing\n", (unsigned long)faults.rounds,
+         (unsigned long)faults.retries, (unsigned long)faults.abandoned,
+         (unsigned long)faults.desyncs, (unsigned long)faults.probes_missing);
 
-  return 0;
+  if (shard_merger != nullptr) {
+    auto shards = shard_merger->GetStats();
+
+    printf("shards:         %lu merged, %lu partial, %lu parts, "
+           "%lu late, %lu mismatched\n", (unsigned long)shards.merged,
+           (unsigned long)shards.partial, (unsigned long)shards.parts,
+           (unsigned long)shards.late, (unsigned long)shards.mismatched);
+  }
+
+  auto workers = event_manager->GetFidWorkerStats();
+
+  if (workers.sent + workers.unsent > 0) {
+    printf("fid workers:    %lu sent, %lu received, %lu late, "
+           "%lu timed out, %lu unsent\n", (unsigned long)workers.sent,
+           (unsigned long)workers.received, (unsigned long)workers.late,
+           (unsigned long)workers.timed_out, (unsigned long)workers.unsent);
+  }
+
+  auto pruning = event_manager->GetPruning();
+
+  if (pruning.demotions > 0) {
+    printf("\npruning:        %i probes demoted, %lu recovered, "
+           "%lu rounds skipped, %.1f ms saved\n", pruning.num_demoted,
+           (unsigned long)pruning.recoveries,
+           (unsigned long)pruning.rounds_skipped, pruning.saved_ms);
+  }
+
+  printf("\n");
 }
@@ -0,0 +1,126 @@
+// This program times the trace decimation of a full 378 probe event.
+// It compares the per-sample loops the frontends used against
+// TraceDecimator with the time axis cache, for both the every tenth
+// sample record copy and the every other sample FID analysis copy,
+// and reports the cost of the optional FIR low-pass.
+// usage: decimation-bench [num_events]
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include "trace_decimation.hh"
+
+const int num_probes = 378;
+const int len_online = 100000;
+const int len_record = 10000;
+
+typedef std::vector<std::vector<unsigned short>> event_t;
+
+double ms_per_event(std::chrono::steady_clock::time_point t0, int num_events)
+{
+  using namespace std::chrono;
+  auto dt = duration_cast<microseconds>(steady_clock::now() - t0).count();
+  return 1e-3 * dt / num_events;
+}
+
+int main(int argc, char *argv[])
+{
+  using namespace std::chrono;
+
+  int num_events = (argc > 1) ? std::atoi(argv[1]) : 20;
+
+  event_t event(num_probes, std::vector<unsigned short>(len_online));
+  event_t record(num_probes, std::vector<unsigned short>(len_record));
+  std::vector<double> rate_mhz(num_probes, 10.0);
+  std::vector<double> wf(len_online / 2);
+  std::vector<double> tm(len_record);
+  double checksum = 0.0;
+
+  for (int idx = 0; idx < num_probes; ++idx) {
+    for (int n = 0; n < len_online; ++n) {
+      event[idx][n] = (n * 7 + idx) & 0x3fff;
+    }
+  }
+
+  // The record copy as done in read_fixed_probe_event.
+  auto t0 = steady_clock::now();
+
+  for (int ev = 0; ev < num_events; ++ev) {
+    for (int idx = 0; idx < num_probes; ++idx) {
+      for (int n = 0; n < len_record; ++n) {
+        wf[n] = event[idx][n*10 + 1];
+        tm[n] = 0.1 * n / rate_mhz[idx];
+        record[idx][n] = wf[n];
+      }
+      checksum += tm[len_record - 1] + record[idx][len_record - 1];
+    }
+  }
+
+  double t_loop = ms_per_event(t0, num_events);
+
+  // The same with the decimator and cached time axis.
+  g2field::TraceDecimator dec10(10, 1);
+  t0 = steady_clock::now();
+
+  for (int ev = 0; ev < num_events; ++ev) {
+    for (int idx = 0; idx < num_probes; ++idx) {
+      const auto &t = g2field::time_axis(0.1 / rate_mhz[idx], len_record);
+      dec10.Decimate(&event[idx][0], len_online, &record[idx][0], len_record);
+      checksum += t[len_record - 1] + record[idx][len_record - 1];
+    }
+  }
+
+  double t_dec10 = ms_per_event(t0, num_events);
+
+  // With a 31 tap anti-alias filter over the odd samples.
+  g2field::TraceDecimator fir10(10, 1);
+  fir10.SetFilter(31, 2);
+  t0 = steady_clock::now();
+
+  for (int ev = 0; ev < num_events; ++ev) {
+    for (int idx = 0; idx < num_probes; ++idx) {
+      fir10.Decimate(&event[idx][0], len_online, &record[idx][0], len_record);
+      checksum += record[idx][len_record - 1];
+    }
+  }
+
+  double t_fir10 = ms_per_event(t0, num_events);
+
+  // The spike skipping copy as done in the sequencer's FID analysis.
+  t0 = steady_clock::now();
+
+  for (int ev = 0; ev < num_events; ++ev) {
+    for (int idx = 0; idx < num_probes; ++idx) {
+      for (int i = 0; i < len_online / 2; ++i) {
+        wf[i] = event[idx][2 * i + 1];
+      }
+      checksum += wf[len_online / 2 - 1];
+    }
+  }
+
+  double t_loop2 = ms_per_event(t0, num_events);
+
+  g2field::TraceDecimator dec2(2, 1);
+  t0 = steady_clock::now();
+
+  for (int ev = 0; ev < num_events; ++ev) {
+    for (int idx = 0; idx < num_probes; ++idx) {
+      dec2.Decimate(&event[idx][0], len_online, &wf[0], len_online / 2);
+      checksum += wf[len_online / 2 - 1];
+    }
+  }
+
+  double t_dec2 = ms_per_event(t0, num_events);
+
+  printf("%i probes, %i events, per event:\n", num_probes, num_events);
+  printf("  every 10th, loop + time axis: %8.3f ms\n", t_loop);
+  printf("  every 10th, TraceDecimator:   %8.3f ms\n", t_dec10);
+  printf("  every 10th, 31 tap FIR:       %8.3f ms\n", t_fir10);
+  printf("  every 2nd, loop:              %8.3f ms\n", t_loop2);
+  printf("  every 2nd, TraceDecimator:    %8.3f ms\n", t_dec2);
+  printf("(checksum %g)\n", checksum);
+
+  return 0;
+}
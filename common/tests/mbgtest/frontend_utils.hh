@@ -1 +0,0 @@
-../../src/frontends/include/frontend_utils.hh
\ No newline at end of file
@@ -1,19 +1,33 @@
 // This program tests the functionality and accuracy of calling
 // the meinberg utility program in the backgroun and parsing
-// the output.
+// the output, and benchmarks the GpsClock service built on it.
 // Results: 
 // - accuracy: ~1ms
 // - parsing: the mbg string is in the format 
 //   <seconds(hex)>.<fraction-of-second*INT_MAX(hex)>.
+// The benchmark runs the service for a while, then compares fresh
+// direct readings against the model's prediction at the same moment,
+// and compares the cost of a direct reading to a now_gps_ns() call.
+// usage: mbg-timestamp-test [duration_s] [period_ms]
 
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
 #include "frontend_utils.hh"
+#include "gps_clock.hh"
 
 int main(int argc, char* argv[])
 {
+  using g2field::GpsClock;
+
+  const std::string cmd("mbgfasttstamp");
+  int duration_s = (argc > 1) ? std::atoi(argv[1]) : 60;
+  int period_ms = (argc > 2) ? std::atoi(argv[2]) : 1000;
+
   std::vector<std::string> outvec;
  
   for (int i = 0; i < 20; ++i) {
-    outvec.push_back(exec("mbgfasttstamp"));
+    outvec.push_back(exec(cmd.c_str()));
   }
 
   for (auto s : outvec) {
@@ -21,5 +35,77 @@ int main(int argc, char* argv[])
     std::cout << parse_mbg_string_ns(s) * 1.0e-9 << std::endl;
   }
 
+  // Latency of a direct, forking reading.
+  const int num_direct = 50;
+  int64_t t0 = GpsClock::monotonic_ns();
+
+  for (int i = 0; i < num_direct; ++i) {
+    parse_mbg_string_ns(exec(cmd.c_str()));
+  }
+
+  double direct_us = 1e-3 * (GpsClock::monotonic_ns() - t0) / num_direct;
+
+  // Let the service build its model.
+  auto &clock = GpsClock::Instance();
+  clock.Start(cmd, period_ms);
+
+  std::cout << "training the clock model for " << duration_s << " s";
+  std::cout << std::endl;
+  sleep(duration_s);
+
+  // Latency of the interpolated model.
+  const int num_model = 1000000;
+  uint64_t sum = 0;
+  t0 = GpsClock::monotonic_ns();
+
+  for (int i = 0; i < num_model; ++i) {
+    sum += clock.now_gps_ns();
+  }
+
+  double model_ns = 1.0 * (GpsClock::monotonic_ns() - t0) / num_model;
+
+  // Accuracy, model prediction against fresh readings.
+  std::vector<double> residuals_us;
+  double read_width_us = 0.0;
+
+  for (int i = 0; i < 20; ++i) {
+    int64_t t_start = GpsClock::monotonic_ns();
+    uint64_t gps = parse_mbg_string_ns(exec(cmd.c_str()));
+    int64_t t_stop = GpsClock::monotonic_ns();
+
+    if (gps == 0) continue;
+
+    uint64_t model = clock.to_gps_ns(t_start + (t_stop - t_start) / 2);
+    residuals_us.push_back(1e-3 * ((int64_t)gps - (int64_t)model));
+    read_width_us += 1e-3 * (t_stop - t_start) / 20;
+
+    usleep(100000);
+  }
+
+  auto fit = clock.GetFit();
+  clock.Stop();
+
+  double mean = 0.0, rms = 0.0, max = 0.0;
+
+  for (auto r : residuals_us) {
+    mean += r / residuals_us.size();
+    rms += r * r / residuals_us.size();
+    max = std::max(max, std::fabs(r));
+  }
+
+  printf("\n--- gps clock benchmark ---\n");
+  printf("direct reading:   %10.1f us per call\n", direct_us);
+  printf("now_gps_ns():     %10.1f ns per call\n", model_ns);
+  printf("model:            locked = %i, %lu samples, %lu failures\n",
+         fit.locked, (unsigned long)fit.num_samples,
+         (unsigned long)fit.num_failures);
+  printf("                  drift = %.3f ppm, fit residual = %.1f us\n",
+         fit.drift_ppm, 1e-3 * fit.residual_ns);
+  printf("model vs direct:  mean = %.1f us, rms = %.1f us, max = %.1f us\n",
+         mean, std::sqrt(rms), max);
+  printf("                  (direct reads span %.1f us each)\n",
+         read_width_us);
+  printf("(checksum %lu)\n", (unsigned long)(sum & 0xff));
+
   return 0;
 }
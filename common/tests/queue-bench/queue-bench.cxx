@@ -0,0 +1,101 @@
+// This program times the EventQueue hand-off between one producer and
+// one consumer thread under each full-queue policy, with event sized
+// payloads.  It checks that the consumer sees the events in order and
+// that the counters add up: under block nothing may be lost, under the
+// drop policies every event is either consumed or counted as dropped.
+// usage: queue-bench [num_events]
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include "event_queue.hh"
+
+const int queue_size = 4;
+const int event_len = 4096;
+
+typedef std::vector<double> event_t;
+
+int run(g2field::QueuePolicy policy, int num_events)
+{
+  using namespace std::chrono;
+
+  g2field::EventQueue<event_t> queue;
+  queue.Reset(queue_size, event_t(event_len), policy);
+
+  std::atomic<bool> done(false);
+  long consumed = 0;
+  long out_of_order = 0;
+
+  auto t0 = steady_clock::now();
+
+  std::thread consumer([&]() {
+    event_t event(event_len);
+    double last = -1.0;
+
+    while (true) {
+
+      if (queue.Pop(event)) {
+        if (event[0] <= last) ++out_of_order;
+        last = event[0];
+        ++consumed;
+
+      } else if (done) {
+
+        if (queue.empty()) break;
+
+      } else {
+
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  event_t event(event_len);
+
+  for (int i = 0; i < num_events; ++i) {
+    event[0] = i;
+    queue.Push(event);
+  }
+
+  done = true;
+  consumer.join();
+
+  double ns = duration_cast<nanoseconds>(steady_clock::now() - t0).count();
+  auto stats = queue.GetStats();
+
+  bool ok = (out_of_order == 0) &&
+    (stats.enqueued + ((policy == g2field::QueuePolicy::kDropOldest) ?
+                       0 : stats.dropped) == (uint64_t)num_events) &&
+    ((uint64_t)consumed + ((policy == g2field::QueuePolicy::kDropOldest) ?
+                           stats.dropped : 0) == stats.enqueued);
+
+  if (policy == g2field::QueuePolicy::kBlock) {
+    ok = ok && (consumed == num_events);
+  }
+
+  printf("  %-12s %8.1f ns/event, %8li consumed, %8lu dropped, "
+         "%8lu blocked  %s\n", g2field::queue_policy_name(policy),
+         ns / num_events, consumed, (unsigned long)stats.dropped,
+         (unsigned long)stats.blocked, ok ? "ok" : "FAILED");
+
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+  int num_events = (argc > 1) ? std::atoi(argv[1]) : 200000;
+  int rc = 0;
+
+  printf("%i events of %i samples, queue of %i:\n", num_events, event_len,
+         queue_size);
+
+  rc |= run(g2field::QueuePolicy::kBlock, num_events);
+  rc |= run(g2field::QueuePolicy::kDropNewest, num_events);
+  rc |= run(g2field::QueuePolicy::kDropOldest, num_events);
+
+  return rc;
+}
@@ -0,0 +1,133 @@
+// This program compares the per-sequence cost of routing the fixed
+// probe mux sequence the old way, with string and pair keyed std::map
+// lookups for every channel, against walking the table compiled by
+// SequenceRouting.  The topology mimics the ring: 378 probes on 28
+// muxes split across two digitizers and four DIO boards.
+// usage: routing-bench [num_sequences]
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "sequence_routing.hh"
+
+// Stand-in for hw::DioMuxController, counts the calls it gets.
+struct FakeMuxBoard {
+  long calls = 0;
+  int SetMux(const std::string &, int ch) { calls += ch; return 0; }
+};
+
+typedef std::pair<std::string, int> conf_t;
+
+int main(int argc, char *argv[])
+{
+  using namespace std::chrono;
+
+  const int num_probes = 378;
+  const int num_mux = 28;
+  int num_seq = (argc > 1) ? std::atoi(argv[1]) : 10000;
+
+  std::vector<FakeMuxBoard *> mux_boards;
+  std::map<std::string, int> mux_idx_map;
+  std::map<std::string, int> sis_idx_map;
+  std::map<std::string, conf_t> data_in;
+  std::map<conf_t, conf_t> data_out;
+  std::vector<std::vector<conf_t>> trg_seq;
+
+  for (int i = 0; i < 4; ++i) {
+    mux_boards.push_back(new FakeMuxBoard());
+  }
+
+  sis_idx_map["sis_3302_0"] = 0;
+  sis_idx_map["sis_3316_0"] = 1;
+
+  for (int m = 0; m < num_mux; ++m) {
+    char name[16];
+    snprintf(name, sizeof(name), "mux_%02i", m);
+
+    mux_idx_map[name] = m % 4;
+    data_in[name] = conf_t(m < 16 ? "sis_3316_0" : "sis_3302_0", m % 16);
+  }
+
+  for (int p = 0; p < num_probes; ++p) {
+    char name[16];
+    snprintf(name, sizeof(name), "mux_%02i", p % num_mux);
+
+    int round = p / num_mux;
+    conf_t trg(name, round + 1);
+
+    if ((int)trg_seq.size() <= round) {
+      trg_seq.resize(round + 1);
+    }
+
+    trg_seq[round].push_back(trg);
+    data_out[trg] = conf_t("fixed", p);
+  }
+
+  std::vector<int> out(num_probes, 0);
+  long checksum_map = 0;
+  long checksum_table = 0;
+
+  // Old path: map lookups in both the trigger and builder loops.
+  auto t0 = steady_clock::now();
+
+  for (int n = 0; n < num_seq; ++n) {
+    for (auto &round : trg_seq) {
+      for (auto &conf : round) {
+        mux_boards[mux_idx_map[conf.first]]->SetMux(conf.first, conf.second);
+      }
+
+      for (auto &pair : round) {
+        auto sis_name = data_in[pair.first].first;
+        int sis_idx = sis_idx_map[sis_name];
+        int trace_idx = data_in[pair.first].second;
+        int idx = data_out[pair].second;
+
+        out[idx] = sis_idx * 16 + trace_idx;
+        checksum_map += out[idx];
+      }
+    }
+  }
+
+  auto t1 = steady_clock::now();
+
+  // New path: compile once, then walk the flat table.
+  g2field::SequenceRouting<FakeMuxBoard> routing;
+  int unresolved = routing.Compile(trg_seq, mux_boards, mux_idx_map,
+                                   sis_idx_map, data_in, data_out);
+
+  auto t2 = steady_clock::now();
+
+  for (int n = 0; n < num_seq; ++n) {
+    for (int r = 0; r < routing.num_rounds(); ++r) {
+      for (auto it = routing.begin(r); it != routing.end(r); ++it) {
+        it->board->SetMux(*it->mux_name, it->mux_chan);
+      }
+
+      for (auto it = routing.begin(r); it != routing.end(r); ++it) {
+        out[it->out_idx] = it->wfd_idx * 16 + it->trace_idx;
+        checksum_table += out[it->out_idx];
+      }
+    }
+  }
+
+  auto t3 = steady_clock::now();
+
+  double map_ns = duration_cast<nanoseconds>(t1 - t0).count() / (double)num_seq;
+  double table_ns = duration_cast<nanoseconds>(t3 - t2).count() / (double)num_seq;
+  double compile_ns = duration_cast<nanoseconds>(t2 - t1).count();
+
+  std::cout << "probes: " << num_probes << ", rounds: " << routing.num_rounds();
+  std::cout << ", unresolved: " << unresolved << std::endl;
+  std::cout << "map lookups:   " << map_ns << " ns/sequence" << std::endl;
+  std::cout << "routing table: " << table_ns << " ns/sequence" << std::endl;
+  std::cout << "compile:       " << compile_ns << " ns (once per run)" << std::endl;
+  std::cout << "speedup:       " << map_ns / table_ns << "x" << std::endl;
+
+  if (checksum_map != checksum_table) {
+    std::cout << "error: routing mismatch" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
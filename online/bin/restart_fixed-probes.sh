@@ -1,2 +1,2 @@
 #!/bin/bash
-./restart_frontend.sh g2field-fe2 fixed-probes
+./restart_frontend.sh g2field-fe2 fixed-probes -i 0
@@ -5,6 +5,7 @@ source $(dirname $(readlink -f $0))/../../common/.expt-env
 
 host=$1
 fe=$2
+args="${@:3}"
 
 scname="${EXPT}.${fe//_/-}"
 fename="${EXPT_DIR}/common/bin/${fe}"
@@ -18,7 +19,7 @@ sleep 0.5
 cmd="screen -dmS $scname"
 ssh $host "$cmd"
 cmd1="screen -S $scname -p 0 -rX stuff"
-cmd2="${fename} -e $EXPT -h $EXPT_IP_L$(printf \\r)"
+cmd2="${fename} -e $EXPT -h $EXPT_IP_L ${args}$(printf \\r)"
 cmd3="cd /home/newg2/Applications/field-daq/common/src/frontends/bin $(printf \\r)"
 cmd="$cmd1 \"$cmd3\""
 ssh $host "$cmd"